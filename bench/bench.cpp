@@ -0,0 +1,430 @@
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../src/parser.h"
+#include "../src/document.h"
+#include "../src/perfect.h"
+#include "../src/emit.h"
+#include "corpus.h"
+
+// Heap calls made by the code under test. The Makefile links the bench with
+// malloc, calloc and realloc wrapped, and operator new is routed to malloc
+// here, so every container and arena growth lands in this counter.
+static std::size_t allocations = 0;
+
+extern "C" {
+    void *__real_malloc (std::size_t size);
+    void *__real_calloc (std::size_t count, std::size_t size);
+    void *__real_realloc (void *ptr, std::size_t size);
+
+    void *__wrap_malloc (std::size_t size) {
+        allocations++;
+        return __real_malloc(size);
+    }
+
+    void *__wrap_calloc (std::size_t count, std::size_t size) {
+        allocations++;
+        return __real_calloc(count, size);
+    }
+
+    void *__wrap_realloc (void *ptr, std::size_t size) {
+        allocations++;
+        return __real_realloc(ptr, size);
+    }
+}
+
+// GCC pairs these by name and cannot tell that new is malloc underneath.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new (std::size_t size) {
+    auto ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        lain::panic("Allocation failure");
+    }
+    return ptr;
+}
+
+void *operator new[] (std::size_t size) {
+    return ::operator new(size);
+}
+
+void *operator new (std::size_t size, const std::nothrow_t&) noexcept {
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete (void *ptr) noexcept { std::free(ptr); }
+void operator delete[] (void *ptr) noexcept { std::free(ptr); }
+void operator delete (void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[] (void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace lain::bench {
+
+using Clock = std::chrono::steady_clock;
+
+// Resets the peak resident set to the current one, where the kernel allows.
+void reset_peak () {
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+// Peak resident set in KiB since the last reset.
+std::size_t peak_rss () {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.starts_with("VmHWM:")) {
+            return std::stoul(line.substr(6));
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<std::size_t>(usage.ru_maxrss);
+}
+
+struct Result {
+    std::string_view corpus;
+    std::string_view phase;
+    std::size_t bytes = 0;
+    std::size_t tokens = 0;
+    std::size_t nodes = 0;
+    std::size_t output = 0;
+    std::size_t allocs = 0;
+    std::size_t peak = 0;
+    double seconds = 0;
+};
+
+struct Config {
+    std::size_t size = 8 << 20;
+    uint reps = 3;
+    std::string dir = "_bench";
+    std::string only;
+    bool generate = false;
+};
+
+// What one run of a phase produced.
+struct Count {
+    std::size_t tokens = 0;
+    std::size_t nodes = 0;
+    std::size_t output = 0;
+};
+
+// Runs `phase` `reps` times, keeping the fastest time and the allocations
+// and peak of the last run. Setup done by `phase` before it calls `start`
+// is not timed or counted.
+template <typename F>
+Result measure (std::string_view corpus, std::string_view name, std::size_t bytes, uint reps, F &&phase) {
+    Result best{corpus, name, bytes};
+    for (uint rep = 0; rep < reps; rep++) {
+        Clock::time_point begin;
+        std::size_t allocs = 0;
+        auto start = [&] {
+            reset_peak();
+            allocs = allocations;
+            begin = Clock::now();
+        };
+        Count count = phase(start);
+        auto seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+        best.allocs = allocations - allocs;
+        best.peak = peak_rss();
+        best.tokens = count.tokens;
+        best.nodes = count.nodes;
+        best.output = count.output;
+        if (rep == 0 || seconds < best.seconds) {
+            best.seconds = seconds;
+        }
+    }
+    return best;
+}
+
+// Pieces of text the edit check inserts, besides ones cut from the corpus:
+// mostly what opens or closes a construct, so edits break and mend it.
+constexpr std::string_view Fragments[] = {
+    "{", "}", "(", ")", ";", "\n", " ", "if 2 ", "return 1; ", "fun f () ",
+    "var y = 3;\n", "#ff00ff", "# ", "\"", "/*", "*/", "@",
+};
+
+// Applies random edits to a Document over the start of `text`, failing as
+// soon as the result differs from a Document made afresh from the same text.
+void check_edits (std::string_view corpus, std::string_view text, uint edits) {
+    text = text.substr(0, text.find('\n', 8 << 10));
+    Rng rng(hash_bytes(corpus));
+    Interner interner;
+    Document doc("edit.lain", text, interner);
+    for (uint i = 0; i < edits; i++) {
+        auto size = doc.text().size();
+        auto offset = rng.below(static_cast<uint32_t>(size + 1));
+        auto removed = std::min<std::size_t>(rng.chance(50) ? rng.below(16) : 0, size - offset);
+        std::string inserted;
+        if (rng.chance(30)) {
+            auto from = rng.below(static_cast<uint32_t>(text.size()));
+            inserted = text.substr(from, rng.below(64));
+        } else if (rng.chance(70)) {
+            inserted = rng.pick(Fragments);
+        }
+        if (!doc.edit({offset, removed, inserted})) {
+            panic("{} edit {} does not fit", corpus, i);
+        }
+
+        Document fresh("edit.lain", doc.text(), interner);
+        auto &a = doc.token_buffer(), &b = fresh.token_buffer();
+        auto same = a.size() == b.size() && doc.declarations().size() == fresh.declarations().size();
+        for (std::size_t t = 0; same && t < a.size(); t++) {
+            same = a.type(t) == b.type(t) && a.offset(t) == b.offset(t) && a.length(t) == b.length(t);
+        }
+        for (std::size_t d = 0; same && d < doc.declarations().size(); d++) {
+            auto &x = doc.declarations()[d], &y = fresh.declarations()[d];
+            same = x.first == y.first && x.last == y.last && x.failed == y.failed;
+        }
+        if (!same || doc.diagnostics().render() != fresh.diagnostics().render()) {
+            panic("{} edit {} ({} at {}, removing {}) differs from a fresh parse", corpus, i, inserted, offset, removed);
+        }
+    }
+}
+
+// Lexes `file` serially and in chunks on a pool, failing unless both give
+// the same tokens, values and diagnostics. Files under two chunks are cut
+// at no newline, so this only checks something from 2 MiB up.
+void check_chunks (std::string_view corpus, const SourceFile &file) {
+    Interner interner;
+    WorkPool pool(4);
+    Diagnostics serial_diagnostics, chunked_diagnostics;
+
+    diagnostic_sink = &serial_diagnostics;
+    Lexer serial_lexer(file, interner);
+    auto &a = serial_lexer.scan();
+    diagnostic_sink = &chunked_diagnostics;
+    Lexer chunked_lexer(file, interner);
+    auto &b = chunked_lexer.scan(pool);
+    diagnostic_sink = nullptr;
+
+    if (a.size() != b.size()) {
+        panic("{} lexes to {} tokens serially but {} in chunks", corpus, a.size(), b.size());
+    }
+    std::size_t hint_a = 0, hint_b = 0;
+    for (std::size_t t = 0; t < a.size(); t++) {
+        if (a.type(t) != b.type(t) || a.offset(t) != b.offset(t) || a.length(t) != b.length(t)
+            || a.value(t, hint_a) != b.value(t, hint_b)) {
+            panic("{} token {} at {} differs between serial and chunked lexing", corpus, t, a.offset(t));
+        }
+    }
+    if (serial_diagnostics.render() != chunked_diagnostics.render()) {
+        panic("{} reports different errors when lexed in chunks", corpus);
+    }
+}
+
+std::vector<Result> run_corpus (const Profile &profile, const Config &config) {
+    auto path = std::format("{}/{}.lain", config.dir, profile.name);
+    {
+        auto source = CorpusGenerator(profile, hash_bytes(profile.name)).generate(config.size);
+        std::ofstream(path, std::ios::binary).write(source.data(), static_cast<std::streamsize>(source.size()));
+    }
+    if (config.generate) {
+        return {};
+    }
+
+    auto file = global_sources().load(path);
+    if (!file) {
+        panic("could not read {}", path);
+    }
+    auto bytes = file->buffer.size();
+    // Fault the mapping in, so no phase pays for the first read.
+    volatile std::size_t sum = 0;
+    for (std::size_t i = 0; i < bytes; i += 4096) {
+        sum = sum + static_cast<unsigned char>(file->buffer[i]);
+    }
+
+    check_edits(profile.name, file->buffer.view(), 1000);
+    check_chunks(profile.name, *file);
+
+    std::vector<Result> results;
+
+    results.push_back(measure(profile.name, "lex", bytes, config.reps, [&](auto start) {
+        Interner interner;
+        start();
+        Lexer lexer(*file, interner);
+        return Count{lexer.scan().size(), 0};
+    }));
+
+    results.push_back(measure(profile.name, "stream", bytes, config.reps, [&](auto start) {
+        Interner interner;
+        StreamReader reader(path);
+        start();
+        TokenStream stream(reader, interner);
+        while (!stream.done()) {
+            stream.bump();
+        }
+        return Count{stream.position(), 0};
+    }));
+
+    results.push_back(measure(profile.name, "parse", bytes, config.reps, [&](auto start) {
+        Interner interner;
+        TokenStream stream(*file, interner);
+        Ast ast;
+        start();
+        Parser(stream, ast).parse();
+        return Count{stream.position(), ast.nodes.size()};
+    }));
+
+    // Typing a word and deleting it again, one byte per edit, at a cursor
+    // that jumps to another line after each word, on a Document over the
+    // whole corpus. The whole text counts once per edit, so the rate is
+    // that of parsing it all again after every edit to get the same.
+    constexpr uint Edits = 256;
+    results.push_back(measure(profile.name, "edit", bytes * Edits, config.reps, [&](auto start) {
+        Interner interner;
+        Document doc(path, file->buffer.view(), interner);
+        Rng rng(bytes);
+        std::size_t relexed = 0, cursor = 0;
+        start();
+        for (uint i = 0; i < Edits; i++) {
+            if (i % 16 == 0) {
+                cursor = doc.text().find('\n', rng.below(static_cast<uint32_t>(bytes))) + 1;
+            }
+            if (i % 16 < 8) {
+                doc.edit({cursor + i % 16, 0, "x"});
+            } else {
+                doc.edit({cursor + 15 - i % 16, 1, ""});
+            }
+            relexed += doc.last_relexed();
+        }
+        return Count{relexed, 0};
+    }));
+
+    // Comp declarations are not evaluated, so comp variables are emitted from
+    // their initializers. The buffer is kept from one rep to the next, as a
+    // driver worker keeps it from one unit to the next.
+    OutputBuffer buffer;
+    results.push_back(measure(profile.name, "emit", bytes, config.reps, [&](auto start) {
+        Interner interner;
+        TokenStream stream(*file, interner);
+        Ast ast;
+        auto root = Parser(stream, ast).parse();
+        ConstData data;
+        buffer.clear();
+        start();
+        CEmitter(ast, data, buffer, file->path, interner).unit(root);
+        return Count{stream.position(), ast.nodes.size(), buffer.size()};
+    }));
+
+    return results;
+}
+
+// Enum sizes the perfect hash generator is timed at. Keys per second should
+// stay flat from the smallest to the largest, as building is linear.
+constexpr std::pair<std::string_view, uint32_t> EnumSizes[] = {
+    {"enum1k", 1000}, {"enum10k", 10000}, {"enum100k", 100000},
+};
+
+// Builds the conversion hash of an enum whose values are distinct strings,
+// then looks every value up through it.
+std::vector<Result> run_enum (std::string_view name, uint32_t count, const Config &config) {
+    std::vector<uint64_t> keys(count);
+    std::size_t bytes = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        auto value = std::format("entry_{}", i);
+        keys[i] = hash_bytes(value);
+        bytes += value.size();
+    }
+
+    std::vector<Result> results;
+    PerfectHash hash;
+    results.push_back(measure(name, "hash", bytes, config.reps, [&](auto start) {
+        hash = {};
+        start();
+        if (!hash.build(keys)) {
+            panic("no perfect hash for {}", name);
+        }
+        return Count{count, hash.slots};
+    }));
+
+    results.push_back(measure(name, "lookup", bytes, config.reps, [&](auto start) {
+        start();
+        for (uint32_t i = 0; i < count; i++) {
+            if (hash.find(keys[i]) != i) {
+                panic("{} misplaced entry {}", name, i);
+            }
+        }
+        return Count{count, 0};
+    }));
+    return results;
+}
+
+std::string to_json (const Result &r) {
+    auto rate = [&](std::size_t n) { return r.seconds > 0 ? static_cast<double>(n) / r.seconds : 0.0; };
+    return std::format(
+        "{{\"corpus\":\"{}\",\"phase\":\"{}\",\"bytes\":{},\"tokens\":{},\"nodes\":{},\"output_bytes\":{},\"seconds\":{:.6f},"
+        "\"bytes_per_s\":{:.0f},\"tokens_per_s\":{:.0f},\"nodes_per_s\":{:.0f},"
+        "\"allocs\":{},\"allocs_per_token\":{:.6f},\"peak_rss_kb\":{}}}\n",
+        r.corpus, r.phase, r.bytes, r.tokens, r.nodes, r.output, r.seconds,
+        rate(r.bytes), rate(r.tokens), rate(r.nodes),
+        r.allocs, r.tokens ? static_cast<double>(r.allocs) / static_cast<double>(r.tokens) : 0.0, r.peak);
+}
+
+std::string to_row (const Result &r) {
+    return std::format("{:<12} {:<7} {:>9.1f} {:>9.2f} {:>9.2f} {:>10.4f} {:>10}\n",
+        r.corpus, r.phase,
+        static_cast<double>(r.bytes) / r.seconds / 1e6,
+        static_cast<double>(r.tokens) / r.seconds / 1e6,
+        static_cast<double>(r.nodes) / r.seconds / 1e6,
+        r.tokens ? static_cast<double>(r.allocs) / static_cast<double>(r.tokens) : 0.0,
+        r.peak);
+}
+
+Config parse_config (int argc, char **argv) {
+    Config config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            config.size = std::stoul(argv[++i]) << 20;
+        } else if (arg == "--reps" && i + 1 < argc) {
+            config.reps = static_cast<uint>(std::max(std::stoi(argv[++i]), 1));
+        } else if (arg == "--dir" && i + 1 < argc) {
+            config.dir = argv[++i];
+        } else if (arg == "--only" && i + 1 < argc) {
+            config.only = argv[++i];
+        } else if (arg == "--generate") {
+            config.generate = true;
+        } else {
+            panic("usage: {} [--size MiB] [--reps N] [--dir path] [--only corpus] [--generate]", argv[0]);
+        }
+    }
+    return config;
+}
+
+}
+
+// Writes one JSON object per corpus and phase to stdout, and a table of the
+// same results to stderr.
+int main (int argc, char **argv) {
+    using namespace lain::bench;
+
+    auto config = parse_config(argc, argv);
+    ::mkdir(config.dir.c_str(), 0755);
+
+    std::fputs(std::format("{:<12} {:<7} {:>9} {:>9} {:>9} {:>10} {:>10}\n",
+        "corpus", "phase", "MB/s", "Mtok/s", "Mnode/s", "allocs/tok", "peak KiB").c_str(), stderr);
+
+    for (auto &profile: Profiles) {
+        if (!config.only.empty() && profile.name != config.only) {
+            continue;
+        }
+        for (auto &result: run_corpus(profile, config)) {
+            std::fputs(to_json(result).c_str(), stdout);
+            std::fputs(to_row(result).c_str(), stderr);
+        }
+    }
+    for (auto &[name, count]: EnumSizes) {
+        if ((!config.only.empty() && name != config.only) || config.generate) {
+            continue;
+        }
+        for (auto &result: run_enum(name, count, config)) {
+            std::fputs(to_json(result).c_str(), stdout);
+            std::fputs(to_row(result).c_str(), stderr);
+        }
+    }
+    return 0;
+}
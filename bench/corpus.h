@@ -0,0 +1,347 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+
+#include "../src/token.h"
+
+namespace lain::bench {
+
+// splitmix64, so a seed yields the same corpus with every standard library.
+class Rng {
+    uint64_t state;
+
+public:
+    explicit Rng (uint64_t seed) : state(seed) {}
+
+    uint64_t next () {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    uint32_t below (uint32_t n) {
+        return static_cast<uint32_t>(next() % n);
+    }
+
+    bool chance (uint32_t percent) {
+        return below(100) < percent;
+    }
+
+    template <typename T, std::size_t N>
+    const T &pick (const T (&items)[N]) {
+        return items[below(N)];
+    }
+};
+
+// Mix of constructs a corpus leans towards. Weights are relative within each
+// choice, percentages absolute.
+struct Profile {
+    std::string_view name;
+
+    // Operands: identifiers against literals.
+    uint32_t identifiers;
+    uint32_t literals;
+
+    // Chance of an operand growing into an operator, and of it being binary
+    // rather than prefix, a call or a subscript.
+    uint32_t operators;
+    uint32_t binary;
+
+    // Nesting budget of each expression.
+    uint32_t depth;
+
+    // Chance of a comment line before each statement, and of a trailing one.
+    uint32_t comments;
+
+    // Chance of a declaration being a literal table rather than a function.
+    uint32_t tables;
+
+    // Chance of a literal being hex, binary, float, IPv4 or color rather
+    // than decimal or a string.
+    uint32_t numerals;
+};
+
+constexpr Profile Profiles[] = {
+    {"identifiers", 90, 10, 45, 85, 5,  5,  2,  0},
+    {"operators",   50, 50, 80, 90, 6,  2,  2,  0},
+    {"literals",    10, 90, 40, 90, 4,  2,  40, 0},
+    {"comments",    60, 40, 40, 85, 4,  70, 5,  0},
+    {"nested",      55, 45, 92, 60, 24, 2,  0,  0},
+    {"tables",      5,  95, 10, 90, 2,  2,  90, 50},
+};
+
+// Writes deterministic, syntactically valid lain source of a given profile.
+class CorpusGenerator {
+    const Profile &profile;
+    Rng rng;
+
+    std::vector<std::string> names;
+    std::string out;
+
+    static constexpr std::string_view Syllables[] = {
+        "al", "be", "co", "de", "el", "fi", "ga", "ho", "in", "ju", "ka", "lo", "me",
+        "no", "op", "pu", "qu", "re", "si", "to", "ur", "ve", "wa", "xi", "yo", "ze",
+        "count", "node", "value", "index", "buf", "len", "next", "prev", "ptr", "size",
+    };
+
+    static constexpr std::string_view Binary[] = {
+        "+", "-", "*", "/", "<", ">", "<=", ">=", "==", "&", "^", "|", "&&", "||",
+    };
+
+    static constexpr std::string_view Prefix[] = {"-", "!", "~", "*", "&"};
+
+    static constexpr std::string_view Assign[] = {"=", "+=", "-=", "*=", "/="};
+
+    static constexpr std::string_view Types[] = {"u8", "u16", "u32", "u64", "int", "uint", "i32", "i64"};
+
+    static constexpr std::string_view Words[] = {
+        "the", "token", "buffer", "is", "scanned", "once", "per", "line", "and", "then",
+        "parsed", "into", "flat", "nodes", "with", "no", "copies", "of", "text",
+    };
+
+    const std::string &name () {
+        // Zipf-like reuse: most references go to a few hot names.
+        auto r = rng.below(static_cast<uint32_t>(names.size()));
+        return names[rng.chance(70) ? r % 32 : r];
+    }
+
+    void hex (uint64_t value, int digits) {
+        for (int shift = 4 * (digits - 1); shift >= 0; shift -= 4) {
+            out += "0123456789abcdef"[(value >> shift) & 0xf];
+        }
+    }
+
+    void numeral () {
+        switch (rng.below(5)) {
+        case 0:
+            out += "0x";
+            hex(rng.next(), static_cast<int>(rng.below(16)) + 1);
+            break;
+        case 1:
+            out += "0b";
+            for (auto n = rng.below(16) + 1; n; n--) {
+                out += rng.chance(50) ? '1' : '0';
+            }
+            break;
+        case 2:
+            out += std::to_string(rng.below(100000));
+            out += '.';
+            out += std::to_string(rng.below(1000));
+            if (rng.chance(20)) {
+                out += "e-";
+                out += std::to_string(rng.below(30));
+            }
+            break;
+        case 3:
+            for (int part = 0; part < 4; part++) {
+                out += part ? "." : "";
+                out += std::to_string(rng.below(256));
+            }
+            break;
+        default:
+            out += '#';
+            hex(rng.next(), rng.chance(25) ? 8 : 6);
+            break;
+        }
+    }
+
+    void literal () {
+        if (profile.numerals && rng.chance(profile.numerals)) {
+            numeral();
+            return;
+        }
+        switch (rng.below(3)) {
+        case 0:
+            out += std::to_string(rng.below(10));
+            break;
+        case 1:
+            out += std::to_string(rng.next() % 1000000007);
+            break;
+        default:
+            out += '"';
+            for (auto n = rng.below(5) + 1; n; n--) {
+                out += rng.pick(Words);
+                out += n > 1 ? " " : "";
+            }
+            out += '"';
+            break;
+        }
+    }
+
+    void operand () {
+        if (rng.below(profile.identifiers + profile.literals) < profile.identifiers) {
+            out += name();
+        } else {
+            literal();
+        }
+    }
+
+    void expression (uint32_t depth) {
+        if (depth == 0 || !rng.chance(profile.operators)) {
+            operand();
+            return;
+        }
+        if (rng.chance(profile.binary)) {
+            bool group = rng.chance(25);
+            out += group ? "(" : "";
+            expression(depth - 1);
+            out += ' ';
+            out += rng.pick(Binary);
+            out += ' ';
+            expression(depth - 1);
+            out += group ? ")" : "";
+            return;
+        }
+        switch (rng.below(4)) {
+        case 0:
+            out += rng.pick(Prefix);
+            out += ' ';
+            expression(depth - 1);
+            break;
+        case 1:
+            out += name();
+            out += '(';
+            for (auto n = rng.below(4); n; n--) {
+                expression(depth / 2);
+                out += n > 1 ? ", " : "";
+            }
+            out += ')';
+            break;
+        case 2:
+            out += name();
+            out += '[';
+            expression(depth - 1);
+            out += ']';
+            break;
+        default:
+            out += name();
+            out += '.';
+            out += name();
+            break;
+        }
+    }
+
+    void indent (uint32_t level) {
+        out.append(level * 4, ' ');
+    }
+
+    void comment (uint32_t level) {
+        indent(level);
+        out += "# ";
+        for (auto n = rng.below(10) + 2; n; n--) {
+            out += rng.pick(Words);
+            out += ' ';
+        }
+        out += "(\"quoted\" += symbols & more)\n";
+    }
+
+    void statement (uint32_t level, uint32_t nesting) {
+        if (rng.chance(profile.comments)) {
+            comment(level);
+        }
+        indent(level);
+        auto kind = rng.below(10);
+        if (nesting && kind == 0) {
+            out += "if (";
+            expression(profile.depth / 2);
+            out += ") {\n";
+            block(level + 1, nesting - 1);
+            indent(level);
+            out += "} else {\n";
+            block(level + 1, nesting - 1);
+            indent(level);
+            out += "}\n";
+        } else if (nesting && kind == 1) {
+            out += "for (int i = 0; i < ";
+            expression(2);
+            out += "; i += 1) {\n";
+            block(level + 1, nesting - 1);
+            indent(level);
+            out += "}\n";
+        } else if (kind < 5) {
+            out += rng.pick(Types);
+            out += ' ';
+            out += name();
+            out += " = ";
+            expression(profile.depth);
+            out += ";\n";
+        } else if (kind == 5) {
+            out += "return ";
+            expression(profile.depth);
+            out += ";\n";
+        } else {
+            out += name();
+            out += ' ';
+            out += rng.pick(Assign);
+            out += ' ';
+            expression(profile.depth);
+            out += ";\n";
+        }
+    }
+
+    void block (uint32_t level, uint32_t nesting) {
+        for (auto n = rng.below(6) + 1; n; n--) {
+            statement(level, nesting);
+        }
+    }
+
+    void declaration (uint32_t index) {
+        if (rng.chance(profile.tables)) {
+            out += "comp u32 table";
+            out += std::to_string(index);
+            out += "[] = {\n";
+            for (auto rows = rng.below(8) + 1; rows; rows--) {
+                indent(1);
+                for (auto n = 8; n; n--) {
+                    literal();
+                    out += rows > 1 || n > 1 ? ", " : "";
+                }
+                out += '\n';
+            }
+            out += "};\n\n";
+            return;
+        }
+        if (rng.chance(profile.comments)) {
+            comment(0);
+        }
+        out += "fun ";
+        out += name();
+        out += std::to_string(index);
+        out += " (int ";
+        out += name();
+        out += ", u8 *";
+        out += name();
+        out += ") : int {\n";
+        block(1, 3);
+        out += "}\n\n";
+    }
+
+public:
+    CorpusGenerator (const Profile &profile, uint64_t seed) : profile(profile), rng(seed) {
+        while (names.size() < 2048) {
+            std::string name;
+            for (auto n = rng.below(3) + 1; n; n--) {
+                name += rng.pick(Syllables);
+            }
+            if (check_type(name) == Token::Unknown) {
+                names.push_back(std::move(name));
+            }
+        }
+    }
+
+    // Generates at least `size` bytes of source.
+    std::string generate (std::size_t size) {
+        out.clear();
+        out.reserve(size + 4096);
+        out += "module bench;\n\n";
+        for (uint32_t index = 0; out.size() < size; index++) {
+            declaration(index);
+        }
+        return std::move(out);
+    }
+};
+
+}
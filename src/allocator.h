@@ -0,0 +1,210 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "error.h"
+
+namespace lain {
+
+// Part of the compiler a heap block is charged to.
+enum class Subsystem : uint8_t {
+    General,
+    Source,
+    Lexer,
+    Tokens,
+    Ast,
+    Symbols,
+    Diagnostics,
+    Comp,
+    Backend,
+    Count,
+};
+
+constexpr const char *SubsystemNames[] = {
+    "general", "source", "lexer", "tokens", "ast", "symbols", "diagnostics", "comp", "backend",
+};
+
+static_assert(std::size(SubsystemNames) == static_cast<std::size_t>(Subsystem::Count));
+
+const char *to_string (Subsystem tag) {
+    return SubsystemNames[static_cast<std::size_t>(tag)];
+}
+
+// Where the compiler's own heap blocks come from. Every call carries the
+// subsystem it is made for and, when freeing or resizing, the size the block
+// was allocated with, so an implementation can keep exact accounts without
+// headers. Resizing may move the block, as realloc does, and zeroed blocks
+// should come from fresh pages where possible, as calloc's do.
+struct Allocator {
+    void *(*allocate) (std::size_t size, Subsystem tag);
+    void *(*zeroed) (std::size_t size, Subsystem tag);
+    void *(*resize) (void *ptr, std::size_t old_size, std::size_t size, Subsystem tag);
+    void (*release) (void *ptr, std::size_t size, Subsystem tag);
+};
+
+// Plain malloc, for when nothing is being measured.
+constexpr Allocator SystemAllocator = {
+    [](std::size_t size, Subsystem) { return std::malloc(size); },
+    [](std::size_t size, Subsystem) { return std::calloc(size, 1); },
+    [](void *ptr, std::size_t, std::size_t size, Subsystem) { return std::realloc(ptr, size); },
+    [](void *ptr, std::size_t, Subsystem) { std::free(ptr); },
+};
+
+// The allocator in use. Set it before any thread starts allocating, and never
+// change it while blocks from the old one are still alive.
+const Allocator *heap = &SystemAllocator;
+
+void *heap_alloc (std::size_t size, Subsystem tag) {
+    return heap->allocate(size, tag);
+}
+
+void *heap_zeroed (std::size_t size, Subsystem tag) {
+    return heap->zeroed(size, tag);
+}
+
+void *heap_resize (void *ptr, std::size_t old_size, std::size_t size, Subsystem tag) {
+    return heap->resize(ptr, old_size, size, tag);
+}
+
+void heap_free (void *ptr, std::size_t size, Subsystem tag) {
+    if (ptr) {
+        heap->release(ptr, size, tag);
+    }
+}
+
+// Standard allocator charging a container's storage to `Tag`.
+template <typename T, Subsystem Tag>
+struct TaggedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = TaggedAllocator<U, Tag>;
+    };
+
+    TaggedAllocator () = default;
+
+    template <typename U>
+    TaggedAllocator (const TaggedAllocator<U, Tag>&) noexcept {}
+
+    T *allocate (std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            panic("Allocation failure");
+        }
+        auto ptr = static_cast<T*>(heap_alloc(n * sizeof(T), Tag));
+        if (!ptr) {
+            panic("Allocation failure");
+        }
+        return ptr;
+    }
+
+    void deallocate (T *ptr, std::size_t n) noexcept {
+        heap_free(ptr, n * sizeof(T), Tag);
+    }
+
+    template <typename U>
+    bool operator== (const TaggedAllocator<U, Tag>&) const noexcept { return true; }
+};
+
+template <typename T, Subsystem Tag>
+using tagged_vector = std::vector<T, TaggedAllocator<T, Tag>>;
+
+// Counts the bytes and calls charged to every subsystem, and the most each
+// has held at once, on top of malloc, with one more account for all of them
+// together. Counters are relaxed atomics, so the figures are exact once the
+// threads that allocated have been joined.
+class CountingAllocator {
+    struct alignas(64) Account {
+        std::atomic<std::size_t> live = 0;
+        std::atomic<std::size_t> peak = 0;
+        std::atomic<std::size_t> total = 0;
+        std::atomic<std::size_t> calls = 0;
+    };
+
+    static Account accounts[static_cast<std::size_t>(Subsystem::Count) + 1];
+
+    static Account &account (Subsystem tag) {
+        return accounts[static_cast<std::size_t>(tag)];
+    }
+
+    static void charge (Account &acc, std::size_t size) {
+        acc.calls.fetch_add(1, std::memory_order_relaxed);
+        acc.total.fetch_add(size, std::memory_order_relaxed);
+        auto live = acc.live.fetch_add(size, std::memory_order_relaxed) + size;
+        auto peak = acc.peak.load(std::memory_order_relaxed);
+        while (live > peak && !acc.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+    }
+
+    static void grow (Subsystem tag, std::size_t size) {
+        charge(account(tag), size);
+        charge(account(Subsystem::Count), size);
+    }
+
+    static void shrink (Subsystem tag, std::size_t size) {
+        account(tag).live.fetch_sub(size, std::memory_order_relaxed);
+        account(Subsystem::Count).live.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+public:
+    struct Usage {
+        std::size_t live, peak, total, calls;
+    };
+
+    static constexpr Allocator hooks = {
+        [](std::size_t size, Subsystem tag) {
+            auto ptr = std::malloc(size);
+            if (ptr) {
+                grow(tag, size);
+            }
+            return ptr;
+        },
+        [](std::size_t size, Subsystem tag) {
+            auto ptr = std::calloc(size, 1);
+            if (ptr) {
+                grow(tag, size);
+            }
+            return ptr;
+        },
+        [](void *ptr, std::size_t old_size, std::size_t size, Subsystem tag) {
+            auto grown = std::realloc(ptr, size);
+            if (grown) {
+                shrink(tag, old_size);
+                grow(tag, size);
+            }
+            return grown;
+        },
+        [](void *ptr, std::size_t size, Subsystem tag) {
+            shrink(tag, size);
+            std::free(ptr);
+        },
+    };
+
+    // Starts measuring afresh: every peak drops to what is live now, and the
+    // totals and calls to zero. No other thread may be allocating.
+    static void rebase () {
+        for (auto &acc: accounts) {
+            acc.peak.store(acc.live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            acc.total.store(0, std::memory_order_relaxed);
+            acc.calls.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Usage of one subsystem, or of all of them for Subsystem::Count.
+    static Usage usage (Subsystem tag) {
+        auto &acc = account(tag);
+        return {
+            acc.live.load(std::memory_order_relaxed),
+            acc.peak.load(std::memory_order_relaxed),
+            acc.total.load(std::memory_order_relaxed),
+            acc.calls.load(std::memory_order_relaxed),
+        };
+    }
+};
+
+CountingAllocator::Account CountingAllocator::accounts[static_cast<std::size_t>(Subsystem::Count) + 1];
+
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <type_traits>
+#include <cstdlib>
+#include <cstdint>
+#include <span>
+#include <new>
+
+#include "error.h"
+#include "allocator.h"
+
+namespace lain {
+
+// 32-bit index of a T inside an Arena<T>.
+template <typename T>
+struct Handle {
+    uint32_t id = UINT32_MAX;
+
+    explicit operator bool () const noexcept { return id != UINT32_MAX; }
+
+    bool operator== (const Handle&) const = default;
+
+    Handle operator+ (uint32_t off) const noexcept { return {id + off}; }
+};
+
+// Typed bump allocator. Objects are appended to one contiguous block and
+// named by their index, so handles survive the block moving as it grows,
+// children allocated together stay adjacent in memory, and tearing the whole
+// arena down is a single free. Only trivially destructible types qualify,
+// since nothing is ever destroyed individually.
+template <typename T>
+class Arena {
+    static_assert(
+        std::is_trivially_destructible_v<T> &&
+        std::is_trivially_copyable_v<T>,
+        "Arena types must be released without destructors.");
+
+    T *raw = nullptr;
+    uint32_t len = 0;
+    uint32_t cap = 0;
+    Subsystem tag = Subsystem::General;
+
+    void grow (std::size_t need) {
+        if (need >= UINT32_MAX) {
+            panic("Arena exhausted");
+        }
+        std::size_t size = cap ? cap : 256;
+        while (size < need) {
+            size *= 2;
+        }
+        size = std::min<std::size_t>(size, UINT32_MAX - 1);
+        auto grown = static_cast<T*>(heap_resize(raw, bytes(), size * sizeof(T), tag));
+        if (!grown) {
+            panic("Allocation failure");
+        }
+        raw = grown;
+        cap = static_cast<uint32_t>(size);
+    }
+
+public:
+    Arena () = default;
+
+    explicit Arena (Subsystem tag) : tag(tag) {}
+
+    Arena (const Arena&) = delete;
+    Arena& operator= (const Arena&) = delete;
+
+    ~Arena () {
+        heap_free(raw, bytes(), tag);
+    }
+
+    template <typename... Args>
+    Handle<T> make (Args&&... args) {
+        if (len == cap) {
+            grow(std::size_t{len} + 1);
+        }
+        if constexpr (std::is_aggregate_v<T>) {
+            new (raw + len) T{std::forward<Args>(args)...};
+        } else {
+            new (raw + len) T(std::forward<Args>(args)...);
+        }
+        return {len++};
+    }
+
+    // Copies `items` to the end of the arena as one contiguous run.
+    Handle<T> append (std::span<const T> items) {
+        if (std::size_t{len} + items.size() > cap) {
+            grow(std::size_t{len} + items.size());
+        }
+        Handle<T> first{len};
+        for (const auto &item: items) {
+            new (raw + len++) T(item);
+        }
+        return first;
+    }
+
+    T &operator[] (Handle<T> h) noexcept { return raw[h.id]; }
+    const T &operator[] (Handle<T> h) const noexcept { return raw[h.id]; }
+
+    std::span<T> span (Handle<T> first, uint32_t count) noexcept {
+        return {raw + first.id, count};
+    }
+
+    std::span<const T> span (Handle<T> first, uint32_t count) const noexcept {
+        return {raw + first.id, count};
+    }
+
+    uint32_t size () const noexcept { return len; }
+
+    std::size_t bytes () const noexcept { return std::size_t{cap} * sizeof(T); }
+
+    // Drops every object at once, keeping the block for reuse.
+    void clear () noexcept { len = 0; }
+};
+
+}
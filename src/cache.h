@@ -0,0 +1,375 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "source.h"
+#include "token.h"
+#include "lexer.h"
+#include "allocator.h"
+
+namespace lain {
+
+// Hashes a whole buffer eight bytes at a time over four independent lanes,
+// fast enough that keying a file costs a small fraction of lexing it.
+uint64_t hash_content (std::string_view data) {
+    constexpr uint64_t K = 0x9e3779b97f4a7c15;
+    uint64_t lanes[4] = {K, K ^ 1, K ^ 2, K ^ 3};
+
+    auto word = [](const char *p) {
+        uint64_t w;
+        std::memcpy(&w, p, sizeof(w));
+        return w;
+    };
+    auto step = [](uint64_t h, uint64_t w) {
+        h = (h ^ w) * K;
+        return h ^ (h >> 31);
+    };
+
+    auto p = data.data();
+    auto n = data.size();
+    for (; n >= 32; p += 32, n -= 32) {
+        for (int l = 0; l < 4; l++) {
+            lanes[l] = step(lanes[l], word(p + 8 * l));
+        }
+    }
+    for (int l = 0; n >= 8; p += 8, n -= 8, l++) {
+        lanes[l] = step(lanes[l], word(p));
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, p, n);
+
+    uint64_t h = hash_mix(data.size() ^ step(K, tail));
+    for (auto lane: lanes) {
+        h = hash_mix(h ^ lane) * K;
+    }
+    return hash_mix(h);
+}
+
+// Creates each missing directory along `path`.
+void make_directories (const std::string &path) {
+    for (auto slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        ::mkdir(path.substr(0, slash).c_str(), 0755);
+        if (slash == std::string::npos) {
+            break;
+        }
+    }
+}
+
+// Writes `data` to `path` through a temporary file renamed into place, so
+// readers sharing the directory only ever see whole files.
+bool write_atomic (const std::string &path, std::string_view data) {
+    auto temp = std::format("{}.{}.{}", path, ::getpid(), std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    std::size_t written = 0;
+    while (written < data.size()) {
+        auto n = ::write(fd, data.data() + written, data.size() - written);
+        if (n <= 0) {
+            break;
+        }
+        written += static_cast<std::size_t>(n);
+    }
+    ::close(fd);
+    if (written != data.size() || ::rename(temp.c_str(), path.c_str()) != 0) {
+        ::unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Bumped whenever the layout below changes. The lexer's version and the token
+// table are folded in as well, so a compiler that lexes differently never
+// reads another's files.
+constexpr uint32_t TokenCacheFormat = 1;
+
+consteval uint64_t token_cache_version () {
+    uint64_t h = hash_mix(hash_bytes("lain.tok") ^ TokenCacheFormat) ^ LexerVersion;
+    for (auto name: TypeNames) {
+        h = hash_mix(h ^ hash_bytes(name));
+    }
+    return h;
+}
+
+// A token cache file is this header followed by the token columns, the side
+// table and the names its symbols refer to, each section 8-byte aligned:
+//
+//   types[tokens] offsets[tokens] lengths[tokens] values[values]
+//   name_ends[names] text[text]
+//
+// Identifier and string values hold an index into the names instead of a
+// Symbol, since symbols only mean something inside one interner. `check` is
+// the hash of everything after the header.
+struct TokenCacheHeader {
+    char magic[8];
+    uint64_t version;
+    uint64_t key;
+    uint64_t size;
+    uint32_t tokens;
+    uint32_t values;
+    uint32_t names;
+    uint32_t reserved;
+    uint64_t text;
+    uint64_t check;
+};
+
+static_assert(sizeof(TokenCacheHeader) == 64);
+
+struct TokenCacheLayout {
+    std::size_t types, offsets, lengths, values, names, text, total;
+
+    explicit TokenCacheLayout (const TokenCacheHeader &header) {
+        auto align = [](std::size_t n) { return (n + 7) & ~std::size_t{7}; };
+        types = sizeof(TokenCacheHeader);
+        offsets = align(types + header.tokens * sizeof(Token::Type));
+        lengths = align(offsets + header.tokens * sizeof(uint32_t));
+        values = align(lengths + header.tokens * sizeof(uint32_t));
+        names = align(values + header.values * sizeof(TokenValue));
+        text = align(names + header.names * sizeof(uint32_t));
+        total = text + header.text;
+    }
+};
+
+// Tokens of one file mapped from the cache. The type, offset and length
+// columns are read straight from the mapping; only the side table is copied,
+// with each name index turned into a Symbol of the current interner.
+class CachedTokens {
+    void *map = nullptr;
+    std::size_t len = 0;
+    tagged_vector<TokenValue, Subsystem::Tokens> values;
+    TokenColumns cols;
+
+    friend class TokenCache;
+
+public:
+    CachedTokens () = default;
+
+    CachedTokens (const CachedTokens&) = delete;
+    CachedTokens& operator= (const CachedTokens&) = delete;
+
+    ~CachedTokens () {
+        if (map) {
+            ::munmap(map, len);
+        }
+    }
+
+    const TokenColumns &columns () const { return cols; }
+
+    std::size_t bytes () const { return values.capacity() * sizeof(TokenValue); }
+};
+
+// Directory of token files keyed by a hash of the source text and the cache
+// version. Files are written under a temporary name and renamed into place,
+// so concurrent compilers sharing a directory only ever see whole files, and
+// a file that fails any check is treated as a miss.
+class TokenCache {
+    std::string dir;
+
+    std::atomic<uint32_t> hit_count = 0;
+    std::atomic<uint32_t> miss_count = 0;
+    std::atomic<uint32_t> store_count = 0;
+
+    std::string path (uint64_t key) const {
+        return std::format("{}/{:016x}.lain.tok", dir, hash_mix(key ^ token_cache_version()));
+    }
+
+    static bool usable (const TokenCacheHeader &header, std::size_t size, uint64_t key, std::size_t source);
+
+public:
+    explicit TokenCache (std::string dir);
+
+    // Tokens of `file` from the cache, or null on a miss.
+    uptr<CachedTokens> load (const SourceFile &file, Interner &interner);
+
+    // Writes the tokens of `file` to the cache. Failing to is not an error.
+    void store (const SourceFile &file, const TokenBuffer &tokens, const Interner &interner);
+
+    // Starts counting afresh. Files are keyed by content, so none go stale.
+    void refresh () {
+        hit_count = miss_count = store_count = 0;
+    }
+
+    uint32_t hits () const { return hit_count.load(); }
+    uint32_t misses () const { return miss_count.load(); }
+    uint32_t stores () const { return store_count.load(); }
+};
+
+TokenCache::TokenCache (std::string dir) : dir(std::move(dir)) {
+    if (this->dir.empty()) {
+        this->dir = ".";
+    }
+    make_directories(this->dir);
+}
+
+bool TokenCache::usable (const TokenCacheHeader &header, std::size_t size, uint64_t key, std::size_t source) {
+    if (size < sizeof(TokenCacheHeader) ||
+        std::memcmp(header.magic, "lain.tok", 8) != 0 ||
+        header.version != token_cache_version() ||
+        header.key != key || header.size != source ||
+        header.tokens == 0 || header.values > header.tokens) {
+        return false;
+    }
+    return TokenCacheLayout(header).total == size;
+}
+
+uptr<CachedTokens> TokenCache::load (const SourceFile &file, Interner &interner) {
+    auto text = file.buffer.view();
+    auto key = hash_content(text);
+
+    int fd = ::open(path(key).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(TokenCacheHeader))) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        miss_count++;
+        return nullptr;
+    }
+    auto size = static_cast<std::size_t>(st.st_size);
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        miss_count++;
+        return nullptr;
+    }
+
+    auto cached = uptr<CachedTokens>(new CachedTokens);
+    cached->map = map;
+    cached->len = size;
+
+    auto base = static_cast<const char*>(map);
+    auto &header = *reinterpret_cast<const TokenCacheHeader*>(base);
+    if (!usable(header, size, key, text.size()) ||
+        hash_content({base + sizeof(header), size - sizeof(header)}) != header.check) {
+        miss_count++;
+        return nullptr;
+    }
+    TokenCacheLayout layout(header);
+
+    auto types = reinterpret_cast<const Token::Type*>(base + layout.types);
+    auto offsets = reinterpret_cast<const uint32_t*>(base + layout.offsets);
+    auto lengths = reinterpret_cast<const uint32_t*>(base + layout.lengths);
+    auto values = reinterpret_cast<const TokenValue*>(base + layout.values);
+    auto ends = reinterpret_cast<const uint32_t*>(base + layout.names);
+    auto names = base + layout.text;
+
+    if (types[header.tokens - 1] != Token::Eof) {
+        miss_count++;
+        return nullptr;
+    }
+    // The columns are used as they are from here on, so every token must
+    // have a known type and lie within the source, in order.
+    uint32_t previous = 0;
+    for (uint32_t i = 0; i < header.tokens; i++) {
+        if (types[i] >= std::size(TypeNames) || offsets[i] < previous ||
+            uint64_t{offsets[i]} + lengths[i] > text.size()) {
+            miss_count++;
+            return nullptr;
+        }
+        previous = offsets[i];
+    }
+
+    tagged_vector<Symbol, Subsystem::Tokens> symbols(header.names);
+    uint32_t begin = 0;
+    for (uint32_t i = 0; i < header.names; i++) {
+        if (ends[i] < begin || ends[i] > header.text) {
+            miss_count++;
+            return nullptr;
+        }
+        symbols[i] = interner.intern({names + begin, ends[i] - begin});
+        begin = ends[i];
+    }
+
+    cached->values.resize(header.values);
+    for (uint32_t i = 0; i < header.values; i++) {
+        auto entry = values[i];
+        if (entry.token >= header.tokens) {
+            miss_count++;
+            return nullptr;
+        }
+        auto type = types[entry.token];
+        if (type == Token::Identifier || type == Token::String) {
+            if (entry.value >= header.names) {
+                miss_count++;
+                return nullptr;
+            }
+            entry.value = static_cast<uint64_t>(symbols[entry.value]);
+        }
+        cached->values[i] = entry;
+    }
+
+    cached->cols = {
+        text,
+        {types, header.tokens},
+        {offsets, header.tokens},
+        {lengths, header.tokens},
+        cached->values,
+    };
+    hit_count++;
+    return cached;
+}
+
+void TokenCache::store (const SourceFile &file, const TokenBuffer &tokens, const Interner &interner) {
+    auto text = file.buffer.view();
+    auto cols = tokens.columns();
+
+    // Number the symbols in order of first use, and swap them for those numbers.
+    std::unordered_map<uint64_t, uint32_t> numbers;
+    tagged_vector<TokenValue, Subsystem::Tokens> values(cols.values.begin(), cols.values.end());
+    tagged_vector<uint32_t, Subsystem::Tokens> ends;
+    std::string names;
+    for (auto &entry: values) {
+        auto type = cols.types[entry.token];
+        if (type != Token::Identifier && type != Token::String) {
+            continue;
+        }
+        auto [it, fresh] = numbers.try_emplace(entry.value, static_cast<uint32_t>(numbers.size()));
+        if (fresh) {
+            names += interner.name(static_cast<Symbol>(entry.value));
+            ends.push_back(static_cast<uint32_t>(names.size()));
+        }
+        entry.value = it->second;
+    }
+
+    TokenCacheHeader header{};
+    std::memcpy(header.magic, "lain.tok", 8);
+    header.version = token_cache_version();
+    header.key = hash_content(text);
+    header.size = text.size();
+    header.tokens = static_cast<uint32_t>(cols.size());
+    header.values = static_cast<uint32_t>(values.size());
+    header.names = static_cast<uint32_t>(ends.size());
+    header.text = names.size();
+    TokenCacheLayout layout(header);
+
+    std::string out(layout.total, '\0');
+    std::memcpy(out.data() + layout.types, cols.types.data(), cols.types.size_bytes());
+    std::memcpy(out.data() + layout.offsets, cols.offsets.data(), cols.offsets.size_bytes());
+    std::memcpy(out.data() + layout.lengths, cols.lengths.data(), cols.lengths.size_bytes());
+    for (std::size_t i = 0; i < values.size(); i++) {
+        // Field by field, so the padding in the file is always zero.
+        std::memcpy(out.data() + layout.values + i * sizeof(TokenValue), &values[i].token, sizeof(uint32_t));
+        std::memcpy(out.data() + layout.values + i * sizeof(TokenValue) + offsetof(TokenValue, value),
+            &values[i].value, sizeof(uint64_t));
+    }
+    std::memcpy(out.data() + layout.names, ends.data(), ends.size() * sizeof(uint32_t));
+    std::memcpy(out.data() + layout.text, names.data(), names.size());
+    header.check = hash_content({out.data() + sizeof(header), out.size() - sizeof(header)});
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    if (write_atomic(path(header.key), out)) {
+        store_count++;
+    }
+}
+
+}
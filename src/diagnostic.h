@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <string>
+#include <string_view>
+
+#include "allocator.h"
+#include "error.h"
+#include "intern.h"
+#include "source.h"
+#include "token.h"
+
+namespace lain {
+
+// Every error the lexer, parser and evaluator can report. Messages live in a table,
+// so a report site only stores the id and its arguments.
+enum class Diag : uint16_t {
+    NumericSuffix,
+    IntegerOverflow,
+    MissingDigits,
+    FloatRange,
+    Ipv4Parts,
+    Ipv4Range,
+    Ipv4Extra,
+    StringNewline,
+    StringIncomplete,
+    StringEscape,
+    UnexpectedCharacter,
+
+    BeforeBof,
+    EofBumped,
+    ExpectedToken,
+    ExpressionComplex,
+    ExpressionDeep,
+    NestedDeep,
+    ExpectedBracket,
+    ExpectedParen,
+    ExpectedExpression,
+    Unclosed,
+    ExpectedType,
+    UnclosedBlock,
+    ExpectedDeclaration,
+
+    CompConstant,
+    CompUnsupported,
+    CompSteps,
+    CompMemory,
+    CompDepth,
+    CompDivide,
+    CompIndex,
+    CompReadOnly,
+    CompCycle,
+    CompConvert,
+    CompRange,
+    CompRangeUnsigned,
+    CompArguments,
+    CompInitializers,
+    CompSize,
+    CompReturn,
+    EnumValues,
+    ImportMissing,
+    EmitUnsupported,
+
+    Count,
+};
+
+struct DiagInfo {
+    enum Phase : uint8_t {
+        // Points at a byte, showing the line up to it.
+        Lexical,
+        // Highlights a token within its whole line.
+        Syntax,
+        // Points into the whole line at a node, whose length is unknown.
+        Semantic,
+    } phase;
+
+    // Arguments replace each {} in order.
+    enum Arg : uint8_t {
+        None,
+        Type,
+        Char,
+        // Text with static storage, such as an operator name.
+        Text,
+        // Signed 64-bit integer.
+        Number,
+        // Unsigned 64-bit integer.
+        Unsigned,
+        Symbol,
+    } args[2];
+
+    std::string_view format;
+};
+
+constexpr DiagInfo DiagTable[] = {
+    {DiagInfo::Lexical, {DiagInfo::Char}, "invalid digit or suffix '{}' in numeric literal"},
+    {DiagInfo::Lexical, {}, "integer literal does not fit in 64 bits"},
+    {DiagInfo::Lexical, {DiagInfo::Char}, "expected digits after 0{}"},
+    {DiagInfo::Lexical, {}, "float literal out of range"},
+    {DiagInfo::Lexical, {}, "IPv4 literal needs four parts"},
+    {DiagInfo::Lexical, {}, "IPv4 literal part out of range"},
+    {DiagInfo::Lexical, {}, "IPv4 literal has more than four parts"},
+    {DiagInfo::Lexical, {}, "newline in string literal."},
+    {DiagInfo::Lexical, {}, "incomplete string literal"},
+    {DiagInfo::Lexical, {}, "string escapes are not supported yet"},
+    {DiagInfo::Lexical, {DiagInfo::Char}, "unexpected character {}"},
+
+    {DiagInfo::Syntax, {}, "Token expected before BOF"},
+    {DiagInfo::Syntax, {}, "EOF bumped"},
+    {DiagInfo::Syntax, {DiagInfo::Type, DiagInfo::Type}, "Expected {} not {}"},
+    {DiagInfo::Syntax, {}, "Expression too complex"},
+    {DiagInfo::Syntax, {}, "Expression nested too deeply"},
+    {DiagInfo::Syntax, {}, "Statement, list or type nested too deeply"},
+    {DiagInfo::Syntax, {}, "Expected ] before )"},
+    {DiagInfo::Syntax, {}, "Expected ) before ]"},
+    {DiagInfo::Syntax, {DiagInfo::Type}, "Expected expression before {}"},
+    {DiagInfo::Syntax, {DiagInfo::Text}, "Unclosed {}"},
+    {DiagInfo::Syntax, {DiagInfo::Type}, "Expected type not {}"},
+    {DiagInfo::Syntax, {}, "Unclosed block"},
+    {DiagInfo::Syntax, {DiagInfo::Type}, "Expected declaration not {}"},
+
+    {DiagInfo::Semantic, {DiagInfo::Symbol}, "{} is not known at compile time"},
+    {DiagInfo::Semantic, {DiagInfo::Text}, "{} cannot be evaluated at compile time"},
+    {DiagInfo::Semantic, {DiagInfo::Number}, "compile-time evaluation took more than {} steps"},
+    {DiagInfo::Semantic, {DiagInfo::Number}, "compile-time evaluation used more than {} bytes"},
+    {DiagInfo::Semantic, {DiagInfo::Number}, "compile-time calls nested deeper than {}"},
+    {DiagInfo::Semantic, {}, "division by zero"},
+    {DiagInfo::Semantic, {DiagInfo::Number, DiagInfo::Number}, "index {} out of range for {} elements"},
+    {DiagInfo::Semantic, {}, "comp data is read-only"},
+    {DiagInfo::Semantic, {DiagInfo::Symbol}, "{} depends on its own value"},
+    {DiagInfo::Semantic, {DiagInfo::Text, DiagInfo::Type}, "cannot convert {} to {}"},
+    {DiagInfo::Semantic, {DiagInfo::Number, DiagInfo::Type}, "{} does not fit in {}"},
+    {DiagInfo::Semantic, {DiagInfo::Unsigned, DiagInfo::Type}, "{} does not fit in {}"},
+    {DiagInfo::Semantic, {DiagInfo::Symbol}, "wrong number of arguments to {}"},
+    {DiagInfo::Semantic, {DiagInfo::Number, DiagInfo::Number}, "{} initializers for {} elements"},
+    {DiagInfo::Semantic, {}, "array size must be a positive integer"},
+    {DiagInfo::Semantic, {DiagInfo::Symbol}, "{} ended without returning a value"},
+    {DiagInfo::Semantic, {DiagInfo::Number, DiagInfo::Number}, "enum entry has {} values where the first has {}"},
+    {DiagInfo::Semantic, {DiagInfo::Symbol}, "cannot find module {}"},
+    {DiagInfo::Semantic, {DiagInfo::Text}, "{} cannot be written as C"},
+};
+
+static_assert(std::size(DiagTable) == static_cast<std::size_t>(Diag::Count));
+
+// Packs a diagnostic argument into a word.
+constexpr uint64_t diag_arg (Token::Type type) { return type; }
+constexpr uint64_t diag_arg (char c) { return static_cast<unsigned char>(c); }
+constexpr uint64_t diag_arg (int64_t n) { return static_cast<uint64_t>(n); }
+constexpr uint64_t diag_arg (uint64_t n) { return n; }
+constexpr uint64_t diag_arg (Symbol sym) { return static_cast<uint64_t>(sym); }
+inline uint64_t diag_arg (const char *text) { return reinterpret_cast<uintptr_t>(text); }
+
+// Errors of one source, kept as fixed-size records and only turned into text
+// by render, once the unit is done. Each record holds its location already
+// resolved and a copy of its source line, since a stream has dropped the
+// text long before then.
+class Diagnostics {
+    struct Record {
+        Diag id;
+        uint32_t row, col, len;
+        uint32_t line, line_len;
+        std::size_t pos;
+        uint64_t args[2];
+    };
+
+    tagged_vector<Record, Subsystem::Diagnostics> records;
+    tagged_vector<char, Subsystem::Diagnostics> lines;
+    std::string path;
+    std::size_t dropped = 0;
+
+    static std::string message (const Record &record);
+
+    static std::string render (const Record &record, std::string_view path, std::string_view line);
+
+public:
+    // Records kept per source; the rest are only counted.
+    static constexpr std::size_t Limit = 100;
+
+    // Adds `id` at `where`, which is `pos` located, over `len` bytes.
+    void add (Diag id, const Location &where, std::size_t pos, uint32_t len, std::span<const uint64_t> args);
+
+    // Appends the records of `other`, a part of the same source.
+    void merge (const Diagnostics &other);
+
+    bool empty () const { return records.empty(); }
+
+    // Whether a lexical error was reported within [from, to].
+    bool lexical (std::size_t from, std::size_t to) const;
+
+    std::size_t size () const { return records.size() + dropped; }
+
+    // Every record, in source order.
+    std::string render () const;
+};
+
+// Where diagnostics raised on this thread are collected. While one is
+// installed the lexer and parser record errors and recover; without one the
+// first error ends the process, as any other fatal error does.
+thread_local Diagnostics *diagnostic_sink = nullptr;
+
+// Reports `id` to the installed sink, or ends the process with it. The
+// caller formats nothing, so this is the only code on an error path.
+[[gnu::cold, gnu::noinline]]
+void raise_diagnostic (Diag id, const Location &where, std::size_t pos, uint32_t len, std::span<const uint64_t> args) {
+    if (diagnostic_sink) {
+        diagnostic_sink->add(id, where, pos, len, args);
+        return;
+    }
+    Diagnostics single;
+    single.add(id, where, pos, len, args);
+    term(single.render());
+}
+
+void Diagnostics::add (Diag id, const Location &where, std::size_t pos, uint32_t len, std::span<const uint64_t> args) {
+    if (records.size() >= Limit) {
+        dropped++;
+        return;
+    }
+    if (path.empty()) {
+        path = where.file;
+    }
+    Record record{id, where.row, where.col, len, static_cast<uint32_t>(lines.size()),
+        static_cast<uint32_t>(where.line.size()), pos, {}};
+    std::copy_n(args.begin(), std::min<std::size_t>(args.size(), 2), record.args);
+    lines.insert(lines.end(), where.line.begin(), where.line.end());
+    records.push_back(record);
+}
+
+void Diagnostics::merge (const Diagnostics &other) {
+    if (path.empty()) {
+        path = other.path;
+    }
+    for (auto record: other.records) {
+        if (records.size() >= Limit) {
+            dropped++;
+            continue;
+        }
+        auto line = other.lines.data() + record.line;
+        record.line = static_cast<uint32_t>(lines.size());
+        lines.insert(lines.end(), line, line + record.line_len);
+        records.push_back(record);
+    }
+    dropped += other.dropped;
+}
+
+bool Diagnostics::lexical (std::size_t from, std::size_t to) const {
+    // Past the limit there is no telling, and nothing more is shown anyway.
+    if (dropped) {
+        return true;
+    }
+    return std::ranges::any_of(records, [&](auto &record) {
+        return record.pos >= from && record.pos <= to &&
+            DiagTable[static_cast<std::size_t>(record.id)].phase == DiagInfo::Lexical;
+    });
+}
+
+std::string Diagnostics::message (const Record &record) {
+    auto &info = DiagTable[static_cast<std::size_t>(record.id)];
+    std::string out;
+    std::size_t arg = 0, from = 0;
+    for (auto at = info.format.find("{}"); at != std::string_view::npos; at = info.format.find("{}", from)) {
+        out += info.format.substr(from, at - from);
+        auto value = record.args[arg];
+        switch (arg < 2 ? info.args[arg++] : DiagInfo::None) {
+        case DiagInfo::Type:
+            out += to_string(static_cast<Token::Type>(value));
+            break;
+        case DiagInfo::Char:
+            out += static_cast<char>(value);
+            break;
+        case DiagInfo::Text:
+            out += reinterpret_cast<const char*>(static_cast<uintptr_t>(value));
+            break;
+        case DiagInfo::Number:
+            out += std::to_string(static_cast<int64_t>(value));
+            break;
+        case DiagInfo::Unsigned:
+            out += std::to_string(value);
+            break;
+        case DiagInfo::Symbol:
+            out += global_interner().name(static_cast<Symbol>(value));
+            break;
+        case DiagInfo::None:
+            break;
+        }
+        from = at + 2;
+    }
+    out += info.format.substr(from);
+    return out;
+}
+
+std::string Diagnostics::render (const Record &record, std::string_view path, std::string_view line) {
+    auto loc = error_location(std::string(path), record.row, record.col);
+    auto msg = message(record);
+
+    if (DiagTable[static_cast<std::size_t>(record.id)].phase == DiagInfo::Lexical) {
+        return std::format(
+            "{} {}error:{} {}\n{}\n{:>{}}{}^{}\n",
+            loc, Ansi::RedFB, Ansi::Reset, msg,
+            line.substr(0, record.col + 1), "", record.col, Ansi::RedFB, Ansi::Reset
+        );
+    }
+
+    auto pre = line.substr(0, std::min<std::size_t>(record.col, line.size()));
+    auto tok = line.substr(pre.size(), record.len);
+    auto post = line.substr(std::min<std::size_t>(pre.size() + record.len, line.size()));
+    return std::format(
+        "{} {}error:{} {}\n{}{}{}{}{}\n{:>{}}{}^{}\n",
+        loc, Ansi::RedFB, Ansi::Reset, msg,
+        pre, Ansi::RedFB, tok, Ansi::Reset, post,
+        "", pre.size(), Ansi::RedFB, Ansi::Reset
+    );
+}
+
+std::string Diagnostics::render () const {
+    // Streams lex ahead of the parser, so records may arrive out of order.
+    tagged_vector<const Record*, Subsystem::Diagnostics> order;
+    for (auto &record: records) {
+        order.push_back(&record);
+    }
+    std::stable_sort(order.begin(), order.end(), [](auto a, auto b) { return a->pos < b->pos; });
+
+    std::string out;
+    for (auto record: order) {
+        out += render(*record, path, {lines.data() + record->line, record->line_len});
+    }
+    if (dropped) {
+        out += std::format("{} more errors in {}\n", dropped, path);
+    }
+    return out;
+}
+
+}
@@ -0,0 +1,449 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "diagnostic.h"
+#include "source.h"
+#include "lexer.h"
+#include "stream.h"
+#include "parser.h"
+
+namespace lain {
+
+// Replacement of `removed` bytes at `offset` with `inserted`.
+struct Edit {
+    std::size_t offset;
+    std::size_t removed;
+    std::string_view inserted;
+};
+
+// Top-level declaration of a Document, covering tokens [first, last),
+// including those skipped to recover from an error in it.
+// `offset` is the byte offset of its first token when it was parsed; nodes
+// of a reused declaration keep the locations they were parsed with, to be
+// shifted by the distance the declaration has since moved. `failed` is set
+// if lexing or parsing it raised an error.
+struct Declaration {
+    uint32_t first, last;
+    uint32_t offset;
+    uint32_t nodes;
+    ExprId root;
+    bool failed;
+};
+
+// Source text kept in memory for an editor, with its tokens and syntax tree
+// brought up to date after each edit. Lexing restarts at the first token
+// on the line of the edit and stops as soon as it produces a token equal
+// to an old one past the edit, and parsing redoes only the declarations
+// those tokens touch, so the work done per edit follows the size of the edit
+// rather than the size of the file. Moving the text and the tokens after
+// the edit is still linear, but is a pass over flat arrays. The token
+// indices of later declarations are shifted lazily, as edits reach them,
+// so an edit near the last one does not go over the rest of the file.
+//
+// Errors never end the process: every edit collects them as diagnostics and
+// the parser recovers. Each declaration remembers whether it had any, so the
+// records are gathered by going over just those declarations again. While
+// the text has errors, the declarations of the last text without any are
+// kept as well, and their nodes with them.
+//
+// The text is not registered with the SourceManager, so its locations only
+// resolve through the document itself.
+class Document {
+    Interner &interner;
+
+    uptr<SourceFile> file;
+    TokenBuffer tokens;
+    Ast tree;
+    tagged_vector<Declaration, Subsystem::Ast> good;
+    Diagnostics errors;
+
+    // Declarations from `shifted` on still hold token indices `shift` short
+    // of their own, modulo 2^32.
+    mutable tagged_vector<Declaration, Subsystem::Ast> decls;
+    mutable std::size_t shifted = 0;
+    mutable uint32_t shift = 0;
+
+    // Indices of the failed declarations, in order, and the nodes of all
+    // declarations.
+    tagged_vector<uint32_t, Subsystem::Ast> failing;
+    std::size_t live = 0;
+
+    // Declarations the last update replaced, from index `replaced_at`.
+    tagged_vector<Declaration, Subsystem::Ast> replaced;
+    std::size_t replaced_at = 0;
+
+    // Tokens lexed and declarations parsed by the last update.
+    std::size_t relexed = 0;
+    std::size_t reparsed = 0;
+
+    void relex (const Edit &edit, std::size_t &first, std::size_t &last, std::size_t &added);
+
+    void reparse (std::size_t first, std::size_t last, std::size_t added, const Diagnostics &lexed);
+
+    void settle (std::size_t to) const;
+
+    static void reindex (std::vector<uint32_t> &lines, const Edit &edit);
+
+    Declaration at (std::size_t index) const;
+
+    std::pair<std::size_t, std::size_t> span (const Declaration &decl) const;
+
+    bool operand (std::size_t index) const;
+
+    void rebuild ();
+
+    void check ();
+
+public:
+    Document (const std::string &path, std::string_view text, Interner &interner = global_interner());
+
+    // Applies `edit`, returning false if it does not fit the text.
+    bool edit (const Edit &edit);
+
+    std::string_view text () const { return file->buffer.view(); }
+
+    const TokenBuffer &token_buffer () const { return tokens; }
+
+    const Ast &ast () const { return tree; }
+
+    std::span<const Declaration> declarations () const {
+        settle(decls.size());
+        return decls;
+    }
+
+    // Errors in the current text, in source order.
+    const Diagnostics &diagnostics () const { return errors; }
+
+    bool clean () const { return errors.empty(); }
+
+    // Declarations of the last text without errors: the current ones while
+    // the text is clean. Their nodes keep the locations they were parsed
+    // with, which need not match the current text.
+    std::span<const Declaration> good_declarations () const { return clean() ? declarations() : good; }
+
+    // Current byte offset of a node of `decl`.
+    std::size_t offset (const Declaration &decl, ExprId id) const {
+        return static_cast<uint32_t>(tree[id].loc) + tokens.offset(decl.first) - decl.offset;
+    }
+
+    Location locate (const Declaration &decl, ExprId id) const {
+        return file->locate(offset(decl, id));
+    }
+
+    std::size_t last_relexed () const { return relexed; }
+    std::size_t last_reparsed () const { return reparsed; }
+};
+
+Document::Document (const std::string &path, std::string_view text, Interner &interner)
+    : interner(interner), tokens({}) {
+    file = uptr<SourceFile>(new SourceFile{path, SourceBuffer::from(text), 0, 0, {}, {}});
+    if (!file->buffer) {
+        panic("Allocation failure");
+    }
+    rebuild();
+}
+
+// Lexes and parses the whole text from scratch.
+void Document::rebuild () {
+    Diagnostics lexed;
+    auto outer = diagnostic_sink;
+    diagnostic_sink = &lexed;
+    Lexer lexer(*file, interner);
+    tokens = lexer.scan();
+    diagnostic_sink = outer;
+
+    tree.clear();
+    decls.clear();
+    good.clear();
+    failing.clear();
+    live = 0;
+    shifted = 0;
+    shift = 0;
+    reparse(0, 0, tokens.size(), lexed);
+    relexed = tokens.size();
+    check();
+}
+
+// Moves the start of the declarations still to be shifted to `to`,
+// shifting those passed over.
+void Document::settle (std::size_t to) const {
+    for (; shifted < to; shifted++) {
+        decls[shifted].first += shift;
+        decls[shifted].last += shift;
+    }
+    for (; shifted > to; shifted--) {
+        decls[shifted - 1].first -= shift;
+        decls[shifted - 1].last -= shift;
+    }
+}
+
+// Declaration `index` with its current token indices.
+Declaration Document::at (std::size_t index) const {
+    auto decl = decls[index];
+    if (index >= shifted) {
+        decl.first += shift;
+        decl.last += shift;
+    }
+    return decl;
+}
+
+// Whether the lexer expects an operand ahead of token `index`. A `{` keeps
+// the state the token before it left, so any run of them is looked past.
+bool Document::operand (std::size_t index) const {
+    while (index > 0 && tokens.type(index - 1) == Token::LBrace) {
+        index--;
+    }
+    return index > 0 && expects_operand(tokens.type(index - 1), false);
+}
+
+// Byte range of `decl`, up to the start of the next declaration, so that
+// the ranges cover the whole text, including bytes the lexer skipped.
+std::pair<std::size_t, std::size_t> Document::span (const Declaration &decl) const {
+    auto begin = decl.first ? tokens.offset(decl.first) : 0;
+    auto end = decl.last < tokens.size() ? tokens.offset(decl.last) : file->buffer.size();
+    return {begin, end};
+}
+
+bool Document::edit (const Edit &edit) {
+    if (!file->buffer.splice(edit.offset, edit.removed, edit.inserted)) {
+        return false;
+    }
+
+    // A fresh SourceFile drops the stale line index. One already built is
+    // moved past the edit and carried over instead of scanned for again.
+    auto lines = std::move(file->lines);
+    file = uptr<SourceFile>(new SourceFile{file->path, std::move(file->buffer), 0, 0, {}, {}});
+    tokens.rebind(file->buffer.view());
+    if (!lines.empty()) {
+        reindex(lines, edit);
+        std::call_once(file->indexed, [&] { file->lines = std::move(lines); });
+    }
+
+    Diagnostics lexed;
+    auto outer = diagnostic_sink;
+    diagnostic_sink = &lexed;
+    std::size_t first, last, added;
+    relex(edit, first, last, added);
+    diagnostic_sink = outer;
+
+    auto was_clean = clean();
+    reparse(first, last, added, lexed);
+    check();
+
+    if (!clean()) {
+        // This edit broke the text: keep the declarations it had before.
+        if (was_clean) {
+            settle(decls.size());
+            good.assign(decls.begin(), decls.begin() + replaced_at);
+            good.insert(good.end(), replaced.begin(), replaced.end());
+            good.insert(good.end(), decls.begin() + replaced_at + reparsed, decls.end());
+        }
+    } else {
+        good.clear();
+        // Replaced declarations leave their nodes behind in the arenas. The
+        // last good declarations still need theirs while there are errors.
+        if (tree.nodes.size() > 2 * live + 4096) {
+            rebuild();
+        }
+    }
+    return true;
+}
+
+// Moves the line starts `lines` past `edit`.
+void Document::reindex (std::vector<uint32_t> &lines, const Edit &edit) {
+    auto shift = static_cast<uint32_t>(edit.inserted.size() - edit.removed);
+    auto lo = std::upper_bound(lines.begin(), lines.end(), edit.offset);
+    auto hi = std::upper_bound(lo, lines.end(), edit.offset + edit.removed);
+    for (auto it = hi; it != lines.end(); it++) {
+        *it += shift;
+    }
+    std::vector<uint32_t> added;
+    for (std::size_t i = 0; i < edit.inserted.size(); i++) {
+        if (edit.inserted[i] == '\n') {
+            added.push_back(static_cast<uint32_t>(edit.offset + i + 1));
+        }
+    }
+    lines.insert(lines.erase(lo, hi), added.begin(), added.end());
+}
+
+// Replaces the tokens the edit may have changed, old tokens [first, last),
+// with the `added` tokens lexed in their place.
+void Document::relex (const Edit &edit, std::size_t &first, std::size_t &last, std::size_t &added) {
+    auto shift = static_cast<int64_t>(edit.inserted.size()) - static_cast<int64_t>(edit.removed);
+    auto end = edit.offset + edit.removed;
+
+    // No token spans a line end or looks past one, so tokens on the lines
+    // before the edit cannot have changed. Anything after them might have.
+    auto text = file->buffer.view();
+    auto line = edit.offset ? text.rfind('\n', edit.offset - 1) : std::string_view::npos;
+    line = line == std::string_view::npos ? 0 : line + 1;
+    std::size_t lo = 0, hi = tokens.size();
+    while (lo < hi) {
+        auto mid = (lo + hi) / 2;
+        if (tokens.offset(mid) < line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    first = lo;
+    std::size_t restart = first ? tokens.offset(first - 1) + tokens.length(first - 1) : 0;
+
+    Lexer lexer(*file, interner, restart, file->buffer.size(), operand(first));
+    tagged_vector<Lexeme, Subsystem::Tokens> lexemes;
+    auto old = first;
+    while (true) {
+        auto lex = lexer.next();
+        while (old < tokens.size() &&
+               (tokens.offset(old) < end || static_cast<int64_t>(tokens.offset(old)) + shift < static_cast<int64_t>(lex.pos))) {
+            old++;
+        }
+        // Past the edit, equal tokens at equal positions mean the rest of
+        // the old stream is still valid. A `{` passes on the state of the
+        // lexer, which may differ, so the streams only join after another.
+        if (old < tokens.size() && tokens.offset(old) >= end && lex.type != Token::LBrace &&
+            static_cast<int64_t>(tokens.offset(old)) + shift == static_cast<int64_t>(lex.pos) &&
+            tokens.type(old) == lex.type && tokens.length(old) == lex.len) {
+            break;
+        }
+        lexemes.push_back(lex);
+        if (lex.type == Token::Eof) {
+            old = tokens.size();
+            break;
+        }
+    }
+
+    last = old;
+    added = lexemes.size();
+    relexed = added;
+    tokens.splice(first, last, lexemes, shift);
+}
+
+// Parses again every declaration touching old tokens [first, last), now
+// the `added` tokens from `first`, until the parser lands on the start of an
+// untouched declaration, and reuses the rest. Errors of the new tokens are
+// in `lexed`.
+void Document::reparse (std::size_t first, std::size_t last, std::size_t added, const Diagnostics &lexed) {
+    auto moved = static_cast<uint32_t>(added - (last - first));
+
+    // Declarations ending before the change survive as they are; one ending
+    // right at it may have been extended by it.
+    std::size_t lo = 0, hi = decls.size();
+    while (lo < hi) {
+        auto mid = (lo + hi) / 2;
+        if (at(mid).last < first) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    auto keep = lo;
+    settle(keep);
+
+    // Errors of untouched tokens are not in `lexed`, so declarations taking
+    // over those of a failed one are checked again.
+    bool stale = false;
+    for (auto i = keep; i < decls.size() && at(i).first < last; i++) {
+        stale |= decls[i].failed;
+    }
+
+    std::size_t start = keep ? decls[keep - 1].last : 0;
+    auto stream = TokenStream(*file, tokens, start, interner);
+    auto parser = Parser(stream, tree);
+
+    tagged_vector<Declaration, Subsystem::Ast> parsed;
+    auto next = keep;
+    auto reuse = decls.size();
+    auto outer = diagnostic_sink;
+    while (!stream.done()) {
+        // Old declarations past the change start at their old index, moved.
+        auto pos = stream.position();
+        while (next < decls.size() && (at(next).first < last || at(next).first + moved < pos)) {
+            next++;
+        }
+        if (next < decls.size() && at(next).first + moved == pos) {
+            reuse = next;
+            break;
+        }
+
+        Diagnostics found;
+        diagnostic_sink = &found;
+        auto nodes = tree.nodes.size();
+        auto root = parser.next();
+        diagnostic_sink = outer;
+        parsed.push_back({
+            static_cast<uint32_t>(pos),
+            static_cast<uint32_t>(stream.position()),
+            tokens.offset(pos),
+            tree.nodes.size() - nodes,
+            root,
+            false,
+        });
+        auto [begin, end] = span(parsed.back());
+        parsed.back().failed = stale || !found.empty() || lexed.lexical(begin, end);
+    }
+
+    // Put the new declarations in place of [keep, reuse).
+    replaced.assign(decls.begin() + keep, decls.begin() + reuse);
+    replaced_at = keep;
+    reparsed = parsed.size();
+    for (auto &decl: replaced) {
+        live -= decl.nodes;
+    }
+    for (auto &decl: parsed) {
+        live += decl.nodes;
+    }
+    auto common = std::min(replaced.size(), parsed.size());
+    std::copy_n(parsed.begin(), common, decls.begin() + keep);
+    if (parsed.size() > common) {
+        decls.insert(decls.begin() + keep + common, parsed.begin() + common, parsed.end());
+    } else {
+        decls.erase(decls.begin() + keep + common, decls.begin() + reuse);
+    }
+    shifted = keep + parsed.size();
+    shift += moved;
+
+    auto from = std::ranges::lower_bound(failing, keep);
+    auto to = std::ranges::lower_bound(from, failing.end(), reuse);
+    for (auto it = to; it != failing.end(); it++) {
+        *it = static_cast<uint32_t>(*it - reuse + shifted);
+    }
+    tagged_vector<uint32_t, Subsystem::Ast> failed;
+    for (std::size_t i = 0; i < parsed.size(); i++) {
+        if (parsed[i].failed) {
+            failed.push_back(static_cast<uint32_t>(keep + i));
+        }
+    }
+    failing.insert(failing.erase(from, to), failed.begin(), failed.end());
+}
+
+// Gathers the errors of the current text by lexing and parsing each failed
+// declaration again, into a scratch tree. Each is checked on its own, so
+// what it reports does not depend on the rest of the text, and one found to
+// have no errors after all is cleared.
+void Document::check () {
+    errors = Diagnostics();
+    if (failing.empty()) {
+        return;
+    }
+    Ast scratch;
+    auto outer = diagnostic_sink;
+    std::erase_if(failing, [&](uint32_t index) {
+        auto decl = at(index);
+        Diagnostics found;
+        diagnostic_sink = &found;
+        auto [begin, end] = span(decl);
+        Lexer(*file, interner, begin, end, operand(decl.first)).scan();
+        auto stream = TokenStream(*file, tokens, decl.first, interner);
+        Parser(stream, scratch).next();
+        decls[index].failed = !found.empty();
+        errors.merge(found);
+        return !decls[index].failed;
+    });
+    diagnostic_sink = outer;
+}
+
+}
@@ -0,0 +1,801 @@
+#pragma once
+
+#include <fcntl.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+#include "source.h"
+#include "stream.h"
+#include "parser.h"
+#include "pool.h"
+#include "stats.h"
+#include "cache.h"
+#include "module.h"
+#include "eval.h"
+#include "output.h"
+#include "emit.h"
+
+namespace lain {
+
+struct Options {
+    std::vector<std::string> inputs;
+
+    uint jobs = 0;
+
+    enum class Dump {
+        None,
+        Tokens,
+        Ast,
+        Comp,
+    } dump = Dump::None;
+
+    // Translate clean inputs to C, in input order, unless something is dumped.
+    bool emit = false;
+
+    // Write the C here rather than to stdout.
+    std::string output;
+
+    // Print phase timings and counters to stderr.
+    bool stats = false;
+
+    // Write a Chrome trace of the phases of every file here.
+    std::string trace;
+
+    // Reuse tokens of unchanged files from this directory.
+    std::string token_cache;
+
+    // Write module interfaces here, and resolve imports against them.
+    std::string module_dir;
+
+    // Stay resident and compile for clients connecting to this socket.
+    std::string serve;
+
+    // Compile through the server listening on this socket, if there is one.
+    std::string connect;
+};
+
+// Appends the inputs listed in a response file, separated by whitespace.
+// Response files may name further response files, but not one that is
+// still being read: `open` holds the real paths of those.
+void read_response (const std::string &path, std::vector<std::string> &inputs, std::vector<std::string> &open) {
+    SourceBuffer buffer(path);
+    auto real = buffer ? ::realpath(path.c_str(), nullptr) : nullptr;
+    if (!real) {
+        panic("could not read response file {}", path);
+    }
+    std::string name = real;
+    std::free(real);
+    if (std::find(open.begin(), open.end(), name) != open.end()) {
+        panic("response file {} includes itself", path);
+    }
+    open.push_back(std::move(name));
+
+    auto text = buffer.view();
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        auto start = text.find_first_not_of(" \t\r\n", pos);
+        if (start == std::string_view::npos) {
+            break;
+        }
+        auto end = std::min(text.find_first_of(" \t\r\n", start), text.size());
+        auto input = std::string(text.substr(start, end - start));
+        if (input[0] == '@') {
+            read_response(input.substr(1), inputs, open);
+        } else {
+            inputs.push_back(std::move(input));
+        }
+        pos = end;
+    }
+    open.pop_back();
+}
+
+void read_response (const std::string &path, std::vector<std::string> &inputs) {
+    std::vector<std::string> open;
+    read_response(path, inputs, open);
+}
+
+// Whether the run measures the heap, in which case the counting allocator
+// must be installed before anything is allocated, options included. Only the
+// command line itself can ask for it, since response files list inputs. A
+// server counts from the start, so that any request may ask for stats.
+bool measures_heap (int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--stats" || arg == "--timings" || arg == "--time-trace" || arg.starts_with("--time-trace=") ||
+            arg == "--serve" || arg.starts_with("--serve=")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Options parse_options (int argc, char **argv) {
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            options.jobs = static_cast<uint>(std::atoi(argv[++i]));
+        } else if (arg.starts_with("-j") && arg.size() > 2) {
+            options.jobs = static_cast<uint>(std::atoi(arg.c_str() + 2));
+        } else if (arg == "--dump-tokens") {
+            options.dump = Options::Dump::Tokens;
+        } else if (arg == "--dump-ast") {
+            options.dump = Options::Dump::Ast;
+        } else if (arg == "--dump-comp") {
+            options.dump = Options::Dump::Comp;
+        } else if (arg == "--emit-c") {
+            options.emit = true;
+        } else if (arg == "-o" && i + 1 < argc) {
+            options.output = argv[++i];
+        } else if (arg == "--stats" || arg == "--timings") {
+            options.stats = true;
+        } else if (arg == "--time-trace" && i + 1 < argc) {
+            options.trace = argv[++i];
+        } else if (arg.starts_with("--time-trace=")) {
+            options.trace = arg.substr(13);
+        } else if (arg == "--token-cache" && i + 1 < argc) {
+            options.token_cache = argv[++i];
+        } else if (arg.starts_with("--token-cache=")) {
+            options.token_cache = arg.substr(14);
+        } else if (arg == "--module-dir" && i + 1 < argc) {
+            options.module_dir = argv[++i];
+        } else if (arg.starts_with("--module-dir=")) {
+            options.module_dir = arg.substr(13);
+        } else if (arg == "--serve" && i + 1 < argc) {
+            options.serve = argv[++i];
+        } else if (arg.starts_with("--serve=")) {
+            options.serve = arg.substr(8);
+        } else if (arg == "--connect" && i + 1 < argc) {
+            options.connect = argv[++i];
+        } else if (arg.starts_with("--connect=")) {
+            options.connect = arg.substr(10);
+        } else if (arg[0] == '@') {
+            read_response(arg.substr(1), options.inputs);
+        } else if (arg[0] == '-' && arg != "-") {
+            panic("unknown option {}", arg);
+        } else {
+            options.inputs.push_back(std::move(arg));
+        }
+    }
+
+    if (options.inputs.empty() && options.serve.empty()) {
+        panic("usage: {} [-j N] [--dump-tokens|--dump-ast|--dump-comp] [--emit-c [-o file]] [--stats] [--time-trace file] [--token-cache dir] "
+            "[--module-dir dir] [--connect socket] [path|@file]...\n       {} --serve socket", argv[0], argv[0]);
+    }
+    if (options.jobs == 0) {
+        options.jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    return options;
+}
+
+// Token and module caches by directory, kept by a compile server across runs
+// so that every run after the first starts warm.
+struct Caches {
+    std::unordered_map<std::string, uptr<TokenCache>> tokens;
+    std::unordered_map<std::string, uptr<ModuleCache>> modules;
+
+    TokenCache *token_cache (const std::string &dir) {
+        auto &cache = tokens[dir];
+        if (!cache) {
+            cache = uptr<TokenCache>(new TokenCache(dir));
+        }
+        return cache.get();
+    }
+
+    ModuleCache *module_cache (const std::string &dir) {
+        auto &cache = modules[dir];
+        if (!cache) {
+            cache = uptr<ModuleCache>(new ModuleCache(dir));
+        }
+        return cache.get();
+    }
+
+    // Catches up with interfaces written since the last run.
+    void refresh () {
+        for (auto &[dir, cache]: tokens) {
+            cache->refresh();
+        }
+        for (auto &[dir, cache]: modules) {
+            cache->refresh();
+        }
+    }
+};
+
+// Everything a run prints, held back so it can be printed elsewhere. `code`
+// is the generated C, when it is not written straight from the buffers.
+struct Output {
+    std::string out;
+    std::string err;
+    std::string trace;
+    std::string code;
+    bool failed = false;
+};
+
+// Result of compiling one input.
+struct CompileUnit {
+    std::string path;
+    std::string output;
+    std::string error;
+
+    uint worker = 0;
+    // Milliseconds per phase, and for the whole input.
+    double load = 0, lex = 0, parse = 0, modules = 0, comp = 0, emit = 0, total = 0;
+    std::size_t tokens = 0, nodes = 0, bytes = 0, lines = 0, imported = 0;
+
+    // Evaluated comp declarations, for the backend.
+    ConstData data;
+
+    // Where the generated C sits in the worker's OutputBuffer.
+    std::size_t code_begin = 0, code_end = 0;
+};
+
+// Compiles every input on a WorkPool. Each worker keeps its own Ast, reused
+// from one input to the next, and every input writes its output to its own
+// CompileUnit, so results are printed in input order however the work was
+// spread. Syntax errors are collected per input and every input is compiled,
+// so one run reports all of them, in input order; an input with errors
+// prints nothing else. An input that cannot be read is reported the same
+// way. Fatal errors are left for compiler bugs and exhausted resources, and
+// end the process once the input's errors so far are printed.
+// Generated C is likewise kept in a per-worker OutputBuffer and written in
+// input order, straight from the buffers, once every input is done.
+class Driver {
+    struct Job {
+        Driver *driver = nullptr;
+        uint32_t index = 0;
+    };
+
+    static thread_local Job active;
+
+    const Options &options;
+
+    std::vector<CompileUnit> units;
+    std::vector<uptr<Ast>> asts;
+    std::vector<uptr<OutputBuffer>> buffers;
+    // Spare workers, in a pool per worker, for lexing its input in chunks.
+    std::vector<uptr<WorkPool>> lexers;
+    TokenCache *cache = nullptr;
+    ModuleCache *modules = nullptr;
+    WorkPool pool;
+
+    static void fatal (const std::string &msg);
+
+    void compile (uint worker, uint32_t index);
+
+    bool translate (uint worker, CompileUnit &unit, Ast &ast, const SourceFile *&file);
+
+    void process (TokenStream &stream, CompileUnit &unit, Ast &ast, std::string_view source);
+
+    std::vector<std::vector<uint32_t>> waves ();
+
+    std::string report (double wall) const;
+
+    std::string trace () const;
+
+    void write_code () const;
+
+public:
+    Driver (const Options &options, Caches &caches);
+
+    // Compiles every input and returns what `run` would print, and the C it
+    // would write if `code`.
+    Output collect (bool code = false);
+
+    // Compiles every input, printing the output to stdout and the report or
+    // errors to stderr. Returns 1 if any input failed.
+    int run ();
+};
+
+thread_local Driver::Job Driver::active;
+
+// Workers beyond one per input are spent lexing large inputs in chunks.
+Driver::Driver (const Options &options, Caches &caches)
+    : options(options),
+      pool(static_cast<uint>(std::min<std::size_t>(options.jobs, options.inputs.size()))) {
+    for (auto &path: options.inputs) {
+        units.emplace_back().path = path;
+    }
+    auto spare = options.jobs / std::max<std::size_t>(units.size(), 1);
+    for (uint i = 0; i < pool.size(); i++) {
+        asts.push_back(uptr<Ast>(new Ast));
+        buffers.push_back(uptr<OutputBuffer>(new OutputBuffer));
+        if (spare > 1) {
+            lexers.push_back(uptr<WorkPool>(new WorkPool(static_cast<uint>(spare))));
+        }
+    }
+    if (!options.token_cache.empty()) {
+        cache = caches.token_cache(options.token_cache);
+    }
+    if (!options.module_dir.empty()) {
+        modules = caches.module_cache(options.module_dir);
+    }
+}
+
+// Errors found before a fatal one are still worth reporting, ahead of it.
+void Driver::fatal (const std::string &) {
+    auto out = std::format("lain: fatal error compiling {}\n", active.driver->units[active.index].path);
+    if (diagnostic_sink) {
+        out = diagnostic_sink->render() + out;
+    }
+    std::fputs(out.c_str(), stderr);
+}
+
+void Driver::compile (uint worker, uint32_t index) {
+    auto &unit = units[index];
+    auto &ast = *asts[worker];
+    unit.worker = worker;
+    ast.clear();
+
+    Diagnostics diagnostics;
+    active = {this, index};
+    fatal_handler = &Driver::fatal;
+    diagnostic_sink = &diagnostics;
+
+    ScopedTimer timer("compile", unit.total, unit.path, worker);
+    const SourceFile *file = nullptr;
+    if (!translate(worker, unit, ast, file)) {
+        unit.error = std::format("lain: could not read source file {}\n", unit.path);
+    }
+    timer.stop();
+
+    if (!diagnostics.empty()) {
+        unit.output.clear();
+        unit.error = diagnostics.render();
+    }
+    // Diagnostics point into the text until rendered. After that nothing
+    // locates anything in it, so a build of any size only holds the address
+    // space of the inputs in flight.
+    if (file) {
+        global_sources().release(file);
+    }
+    diagnostic_sink = nullptr;
+    fatal_handler = nullptr;
+}
+
+// Loads, lexes and processes one input, setting `file` to the file loaded.
+// Returns false if it cannot be read.
+bool Driver::translate (uint worker, CompileUnit &unit, Ast &ast, const SourceFile *&file) {
+    if (is_regular_file(unit.path)) {
+        ScopedTimer load("load", unit.load, unit.path, worker);
+        file = global_sources().load(unit.path);
+        if (!file) {
+            return false;
+        }
+        load.stop();
+        if (options.stats) {
+            unit.lines = file->line_starts().size();
+        }
+
+        ScopedTimer lex("lex", unit.lex, unit.path, worker);
+        auto cached = cache ? cache->load(*file, global_interner()) : nullptr;
+        if (cached) {
+            auto stream = TokenStream(*file, cached->columns());
+            lex.stop();
+
+            process(stream, unit, ast, file->buffer.view());
+        } else {
+            auto lexer = Lexer(*file, global_interner());
+            auto &tokens = lexers.empty() ? lexer.scan() : lexer.scan(*lexers[worker]);
+            if (cache && diagnostic_sink->empty()) {
+                cache->store(*file, tokens, global_interner());
+            }
+            auto stream = TokenStream(*file, tokens, 0);
+            lex.stop();
+
+            process(stream, unit, ast, file->buffer.view());
+        }
+    } else {
+        ScopedTimer load("load", unit.load, unit.path, worker);
+        auto reader = StreamReader(unit.path);
+        if (!reader) {
+            return false;
+        }
+        auto stream = TokenStream(reader);
+        load.stop();
+
+        process(stream, unit, ast, {});
+    }
+    return true;
+}
+
+// Streams are lexed on demand, so their lexing is counted as parsing. Only
+// files, whose whole `source` is known, write module interfaces, and only
+// once they parsed cleanly. Comp declarations are evaluated with the
+// declarations they import, unless only tokens or the tree are dumped, and an
+// import that finds no interface is then an error. C is emitted last, only
+// for inputs with no errors at all.
+void Driver::process (TokenStream &stream, CompileUnit &unit, Ast &ast, std::string_view source) {
+    ScopedTimer timer("parse", unit.parse, unit.path, unit.worker);
+
+    if (options.dump == Options::Dump::Tokens) {
+        while (!stream.done()) {
+            unit.output += to_string(stream.bump().type);
+            unit.output += '\n';
+        }
+        timer.stop();
+    } else {
+        auto parser = Parser(stream, ast);
+        auto root = parser.parse();
+        std::vector<ExprId> imported;
+        if (options.dump == Options::Dump::Ast) {
+            for (auto decl: ast.children(root)) {
+                print(ast, decl, unit.output);
+                unit.output += '\n';
+            }
+        }
+        timer.stop();
+        unit.nodes = ast.nodes.size();
+
+        bool semantic = options.dump == Options::Dump::None || options.dump == Options::Dump::Comp;
+        if (modules && diagnostic_sink->empty()) {
+            ScopedTimer interfaces("modules", unit.modules, unit.path, unit.worker);
+            if (source.data()) {
+                modules->emit(ast, root, unit.path, source, global_interner());
+            }
+            if (semantic) {
+                unit.imported = modules->import(ast, root, unit.path, global_interner(), &imported);
+            }
+        } else if (semantic && diagnostic_sink->empty()) {
+            // Nothing can be imported without a module directory.
+            for (auto decl: ast.children(root)) {
+                if (ast[decl].type == Expression::Import) {
+                    auto name = module_name(ast, ast.children(decl)[0], global_interner());
+                    import_error(ast, decl, unit.path, global_interner().intern(name));
+                }
+            }
+        }
+
+        if (semantic && diagnostic_sink->empty()) {
+            ScopedTimer comp("comp", unit.comp, unit.path, unit.worker);
+            unit.data = Evaluator(ast, unit.path).run(root, imported);
+            if (options.dump == Options::Dump::Comp) {
+                for (auto &table: unit.data.tables) {
+                    print(unit.data, table, unit.output);
+                    unit.output += ";\n";
+                }
+                for (auto &e: unit.data.enums) {
+                    print(unit.data, e, unit.output);
+                }
+            }
+        }
+
+        if (options.emit && options.dump == Options::Dump::None && diagnostic_sink->empty()) {
+            ScopedTimer emit("emit", unit.emit, unit.path, unit.worker);
+            auto &buffer = *buffers[unit.worker];
+            unit.code_begin = buffer.size();
+            CEmitter(ast, unit.data, buffer, unit.path).unit(root, imported);
+            unit.code_end = buffer.size();
+        }
+    }
+
+    unit.tokens = stream.position();
+    unit.bytes = stream.bytes();
+}
+
+// Inputs grouped so that a module is compiled, and its interface written,
+// before the inputs of the run that import it: each wave holds the inputs
+// whose imports are declared by earlier waves or by no input at all. Only the
+// `module` and `import` declarations at the head of a file count. Streams,
+// whose head cannot be read ahead, and inputs importing each other in a cycle
+// go last, together.
+std::vector<std::vector<uint32_t>> Driver::waves () {
+    auto count = static_cast<uint32_t>(units.size());
+    std::vector<std::vector<uint32_t>> order(1);
+    if (!modules) {
+        for (uint32_t i = 0; i < count; i++) {
+            order[0].push_back(i);
+        }
+        return order;
+    }
+
+    std::vector<ModuleHead> heads(count);
+    std::vector<char> streams(count);
+    pool.run(count, [this, &heads, &streams](uint, uint32_t index) {
+        auto &path = units[index].path;
+        if (is_regular_file(path)) {
+            heads[index] = read_head(path);
+        } else {
+            streams[index] = 1;
+        }
+    });
+
+    std::unordered_map<std::string, std::vector<uint32_t>> declared;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!heads[i].module.empty()) {
+            declared[heads[i].module].push_back(i);
+        }
+    }
+    std::vector<uint32_t> pending(count);
+    std::vector<std::vector<uint32_t>> dependents(count);
+    for (uint32_t i = 0; i < count; i++) {
+        for (auto &module: heads[i].imports) {
+            auto it = declared.find(module);
+            if (it == declared.end()) {
+                continue;
+            }
+            for (auto j: it->second) {
+                if (j != i) {
+                    pending[i]++;
+                    dependents[j].push_back(i);
+                }
+            }
+        }
+    }
+
+    std::vector<char> placed(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!pending[i] && !streams[i]) {
+            order.back().push_back(i);
+        }
+    }
+    while (!order.back().empty()) {
+        std::vector<uint32_t> next;
+        for (auto i: order.back()) {
+            placed[i] = 1;
+            for (auto d: dependents[i]) {
+                if (--pending[d] == 0 && !streams[d]) {
+                    next.push_back(d);
+                }
+            }
+        }
+        std::sort(next.begin(), next.end());
+        order.push_back(std::move(next));
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!placed[i]) {
+            order.back().push_back(i);
+        }
+    }
+    return order;
+}
+
+Output Driver::collect (bool code) {
+    auto &trace = global_trace();
+    trace.clear();
+    trace.enabled = !options.trace.empty();
+
+    for (auto &buffer: buffers) {
+        buffer->clear();
+    }
+
+    double wall = 0;
+    {
+        ScopedTimer timer("run", wall, {}, pool.size());
+        for (auto &wave: waves()) {
+            pool.run(static_cast<uint32_t>(wave.size()), [this, &wave](uint worker, uint32_t index) {
+                compile(worker, wave[index]);
+            });
+        }
+    }
+
+    Output output;
+    for (auto &unit: units) {
+        output.out += unit.output;
+        output.err += unit.error;
+        output.failed |= !unit.error.empty();
+    }
+    if (trace.enabled) {
+        output.trace = this->trace();
+    }
+    if (options.stats && !output.failed) {
+        output.err = report(wall);
+    }
+    if (code) {
+        for (auto &unit: units) {
+            if (unit.error.empty()) {
+                buffers[unit.worker]->copy(unit.code_begin, unit.code_end, output.code);
+            }
+        }
+    }
+    return output;
+}
+
+// Writes the trace where the options ask for it.
+void write_trace (const Options &options, const std::string &json) {
+    if (options.trace.empty()) {
+        return;
+    }
+    auto out = std::fopen(options.trace.c_str(), "wb");
+    if (!out) {
+        panic("could not write trace {}", options.trace);
+    }
+    std::fwrite(json.data(), 1, json.size(), out);
+    std::fclose(out);
+}
+
+// Prints `output` as a command-line run does.
+int print_output (const Options &options, const Output &output) {
+    std::fwrite(output.out.data(), 1, output.out.size(), stdout);
+    std::fflush(stdout);
+    write_trace(options, output.trace);
+    std::fputs(output.err.c_str(), stderr);
+    return output.failed ? 1 : 0;
+}
+
+// Writes generated C where the options ask for it.
+void write_code (const Options &options, std::span<iovec> parts) {
+    int fd = STDOUT_FILENO;
+    if (!options.output.empty()) {
+        fd = ::open(options.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            panic("could not write output {}", options.output);
+        }
+    }
+    bool written = write_all(fd, parts);
+    if (fd != STDOUT_FILENO) {
+        written &= ::close(fd) == 0;
+    }
+    if (!written) {
+        panic("could not write output {}", options.output.empty() ? "to stdout" : options.output);
+    }
+}
+
+// Writes the C of every clean input, in input order, with one writev per
+// IOV_MAX chunks.
+void Driver::write_code () const {
+    tagged_vector<iovec, Subsystem::Backend> parts;
+    for (auto &unit: units) {
+        if (unit.error.empty()) {
+            buffers[unit.worker]->gather(unit.code_begin, unit.code_end, parts);
+        }
+    }
+    lain::write_code(options, parts);
+}
+
+int Driver::run () {
+    auto output = collect();
+    if (options.emit && options.dump == Options::Dump::None) {
+        write_code();
+    }
+    return print_output(options, output);
+}
+
+std::string Driver::report (double wall) const {
+    std::string out = std::format("{:<40} {:>6} {:>9} {:>9} {:>9} {:>9} {:>10} {:>10}\n",
+        "file", "worker", "load ms", "lex ms", "parse ms", "total ms", "tokens", "nodes");
+    for (auto &unit: units) {
+        out += std::format("{:<40} {:>6} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f} {:>10} {:>10}\n",
+            unit.path, unit.worker, unit.load, unit.lex, unit.parse, unit.total, unit.tokens, unit.nodes);
+    }
+
+    out += std::format("\n{:<6} {:>6} {:>6} {:>10} {:>6}\n", "worker", "files", "steals", "busy ms", "util");
+    for (uint w = 0; w < pool.size(); w++) {
+        std::size_t files = 0;
+        double busy = 0;
+        for (auto &unit: units) {
+            if (unit.worker == w) {
+                files++;
+                busy += unit.total;
+            }
+        }
+        out += std::format("{:<6} {:>6} {:>6} {:>10.3f} {:>5.0f}%\n",
+            w, files, pool.steals(w), busy, wall > 0 ? 100 * busy / wall : 0.0);
+    }
+    out += std::format("\n{} files on {} workers in {:.3f} ms\n", units.size(), pool.size(), wall);
+
+    std::size_t tokens = 0, nodes = 0, token_bytes = 0, ast_bytes = 0;
+    for (auto &unit: units) {
+        tokens += unit.tokens;
+        nodes += unit.nodes;
+        token_bytes += unit.bytes;
+    }
+    for (auto &ast: asts) {
+        ast_bytes += ast->bytes();
+    }
+    auto &interner = global_interner();
+    out += std::format("\n{:<16} {:>12}\n", "counter", "value");
+    out += std::format("{:<16} {:>12}\n", "tokens", tokens);
+    out += std::format("{:<16} {:>12}\n", "nodes", nodes);
+    out += std::format("{:<16} {:>12}\n", "symbols", interner.size());
+    out += std::format("{:<16} {:>12}\n", "token bytes", token_bytes);
+    out += std::format("{:<16} {:>12}\n", "ast bytes", ast_bytes);
+    out += std::format("{:<16} {:>12}\n", "symbol bytes", interner.bytes());
+    out += std::format("{:<16} {:>12}\n", "peak rss KiB", peak_rss());
+
+    std::size_t lines = 0;
+    for (auto &unit: units) {
+        lines += unit.lines;
+    }
+    out += std::format("\n{:<12} {:>12} {:>12} {:>14} {:>10}\n", "heap", "live", "peak", "allocated", "calls");
+    for (std::size_t tag = 0; tag <= static_cast<std::size_t>(Subsystem::Count); tag++) {
+        auto subsystem = static_cast<Subsystem>(tag);
+        auto use = CountingAllocator::usage(subsystem);
+        out += std::format("{:<12} {:>12} {:>12} {:>14} {:>10}\n",
+            subsystem == Subsystem::Count ? "all" : to_string(subsystem),
+            use.live, use.peak, use.total, use.calls);
+    }
+    if (lines) {
+        auto peak = CountingAllocator::usage(Subsystem::Count).peak;
+        out += std::format("\n{} lines, {:.1f} KiB heap peak per kLOC\n",
+            lines, static_cast<double>(peak) / 1024.0 / (static_cast<double>(lines) / 1000.0));
+    }
+    if (cache) {
+        out += std::format("\ntoken cache: {} hits, {} misses, {} stored\n",
+            cache->hits(), cache->misses(), cache->stores());
+    }
+    if (modules) {
+        double time = 0;
+        for (auto &unit: units) {
+            time += unit.modules;
+        }
+        out += std::format("modules: {} interfaces written, {} imports found, {} missing, "
+            "{} declarations imported in {:.3f} ms\n",
+            modules->writes(), modules->found(), modules->missing(), modules->imported(), time);
+    }
+
+    std::size_t tables = 0, table_bytes = 0, hashes = 0;
+    uint64_t steps = 0, calls = 0, memoized = 0;
+    double comp = 0;
+    for (auto &unit: units) {
+        tables += unit.data.tables.size() + unit.data.columns.size();
+        for (auto &hash: unit.data.hashes) {
+            hashes += !hash.empty();
+        }
+        table_bytes += unit.data.bytes.size();
+        steps += unit.data.steps;
+        calls += unit.data.calls;
+        memoized += unit.data.memoized;
+        comp += unit.comp;
+    }
+    if (tables || steps) {
+        out += std::format("comp: {} tables of {} bytes, {} hashed, {} steps, {} calls, {} memoized in {:.3f} ms\n",
+            tables, table_bytes, hashes, steps, calls, memoized, comp);
+    }
+
+    std::size_t code = 0;
+    double emit = 0;
+    for (auto &unit: units) {
+        code += unit.code_end - unit.code_begin;
+        emit += unit.emit;
+    }
+    if (options.emit) {
+        out += std::format("emit: {} bytes of C in {:.3f} ms ({:.1f} MB/s)\n",
+            code, emit, emit > 0 ? static_cast<double>(code) / emit / 1000.0 : 0.0);
+    }
+    return out;
+}
+
+// Ends the trace with the run's counters, so a viewer shows them alongside
+// the phases.
+std::string Driver::trace () const {
+    auto &trace = global_trace();
+    std::size_t tokens = 0, nodes = 0;
+    for (auto &unit: units) {
+        tokens += unit.tokens;
+        nodes += unit.nodes;
+    }
+    trace.count("tokens", static_cast<double>(tokens));
+    trace.count("nodes", static_cast<double>(nodes));
+    trace.count("symbols", static_cast<double>(global_interner().size()));
+    trace.count("peak rss KiB", static_cast<double>(peak_rss()));
+    trace.count("heap peak", static_cast<double>(CountingAllocator::usage(Subsystem::Count).peak));
+    if (cache) {
+        trace.count("token cache hits", cache->hits());
+        trace.count("token cache misses", cache->misses());
+    }
+    uint64_t steps = 0, calls = 0;
+    for (auto &unit: units) {
+        steps += unit.data.steps;
+        calls += unit.data.calls;
+    }
+    if (steps) {
+        trace.count("comp steps", static_cast<double>(steps));
+        trace.count("comp calls", static_cast<double>(calls));
+    }
+    if (options.emit) {
+        std::size_t code = 0;
+        for (auto &unit: units) {
+            code += unit.code_end - unit.code_begin;
+        }
+        trace.count("C bytes", static_cast<double>(code));
+    }
+    return trace.json();
+}
+
+}
@@ -0,0 +1,926 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <unordered_map>
+
+#include "eval.h"
+#include "output.h"
+
+namespace lain {
+
+// C keywords and reserved names that lain accepts as identifiers. Any of them
+// used as a name gets a trailing underscore in the generated code.
+static constexpr auto CReservedNames = make_perfect_map(array_make<std::pair<std::string_view, bool>>({
+    {"auto", true},     {"case", true},     {"char", true},     {"default", true},
+    {"do", true},       {"double", true},   {"extern", true},   {"float", true},
+    {"goto", true},     {"inline", true},   {"long", true},     {"register", true},
+    {"restrict", true}, {"short", true},    {"signed", true},   {"switch", true},
+    {"typedef", true},  {"union", true},    {"unsigned", true}, {"volatile", true},
+    {"while", true},    {"bool", true},     {"true", true},     {"false", true},
+    {"_Bool", true},    {"uint8_t", true},  {"uint16_t", true}, {"uint32_t", true},
+    {"uint64_t", true}, {"int8_t", true},   {"int16_t", true},  {"int32_t", true},
+    {"int64_t", true},
+}));
+static_assert(CReservedNames.ok, "No perfect hash found for reserved C names");
+
+// Fixed text at the top of every generated file. lain's integer types are
+// typedefs of the stdint ones, so builtin types are written as spelled, and
+// so are f32 and f64, which lain reads as plain names. The guard lets the
+// output of several units be compiled as one file.
+constexpr std::string_view CPreamble =
+    "#ifndef LAIN_PREAMBLE\n"
+    "#define LAIN_PREAMBLE\n"
+    "#include <stdint.h>\n"
+    "\n"
+    "typedef uint8_t u8;\ntypedef uint16_t u16;\ntypedef uint32_t u32;\ntypedef uint64_t u64;\n"
+    "typedef int8_t i8;\ntypedef int16_t i16;\ntypedef int32_t i32;\ntypedef int64_t i64;\n"
+    "typedef unsigned uint;\n"
+    "typedef float f32;\ntypedef double f64;\n"
+    "#endif\n";
+
+// Runtime side of PerfectHash, written once into files that convert enum
+// values back into entries.
+constexpr std::string_view CHashHelpers =
+    "\n"
+    "#ifndef LAIN_HASH_HELPERS\n"
+    "#define LAIN_HASH_HELPERS\n"
+    "static inline uint64_t lain_hash_mix (uint64_t x) {\n"
+    "    x ^= x >> 33;\n"
+    "    x *= 0xff51afd7ed558ccdull;\n"
+    "    x ^= x >> 33;\n"
+    "    return x;\n"
+    "}\n"
+    "\n"
+    "static inline uint64_t lain_hash_bytes (const u8 *s) {\n"
+    "    uint64_t h = 0xcbf29ce484222325ull;\n"
+    "    while (*s) {\n"
+    "        h = (h ^ *s++) * 0x100000001b3ull;\n"
+    "    }\n"
+    "    return h;\n"
+    "}\n"
+    "\n"
+    "static inline uint64_t lain_double_bits (double d) {\n"
+    "    union { double d; uint64_t u; } bits = {d};\n"
+    "    return bits.u;\n"
+    "}\n"
+    "\n"
+    "static inline int lain_equal (const u8 *a, const u8 *b) {\n"
+    "    while (*a && *a == *b) {\n"
+    "        a++;\n"
+    "        b++;\n"
+    "    }\n"
+    "    return *a == *b;\n"
+    "}\n"
+    "#endif\n";
+
+// Translates one unit to C. Everything is appended to an OutputBuffer: names
+// come straight from the interner and numbers are formatted on the stack, so
+// emitting allocates nothing but the emitter's own lookup maps.
+//
+// Declarations are written in the order C needs: struct typedefs, enums with
+// their tables, struct bodies after the structs they hold, then prototypes of every function so that
+// definitions may come in any order, then globals and then function bodies,
+// each in source order. Comp declarations and enum columns come from ConstData as
+// constant tables. Imported declarations are only declared, as their own
+// unit defines them. Expressions are fully parenthesized, so lain precedence
+// carries over whatever C's is.
+class CEmitter {
+    const Ast &ast;
+    const ConstData &data;
+    const Interner &interner;
+    OutputBuffer &out;
+    std::string_view path;
+
+    uint32_t depth = 0;
+    // Function whose body is being written.
+    ExprId function;
+
+    // Enum names, to turn `Enum.Entry` into `Enum_Entry`.
+    std::unordered_map<uint32_t, bool> enums;
+    // Comp declarations evaluated into a table, by name.
+    std::unordered_map<uint32_t, uint32_t> tables;
+    // Whether the last variable, parameter or field declared under a name is
+    // a pointer. lain has one member operator where C has `.` and `->`, and
+    // without types this is what tells them apart. `shadowed` holds what each
+    // declaration replaced, -1 for nothing, to restore on leaving its scope.
+    std::unordered_map<uint32_t, bool> pointers;
+    std::vector<std::pair<uint32_t, int8_t>> shadowed;
+
+    template<typename... Args>
+    [[gnu::cold]] void error (Diag id, ExprId at, Args... args);
+
+    void indent ();
+    void name (Symbol sym);
+    void name (ExprId id) { name(ast.symbol(id)); }
+
+    void element_type (Token::Type type);
+    void constant_type (Token::Type type);
+    void number (uint64_t bits, Token::Type type);
+    void string (Symbol sym);
+
+    void base_type (ExprId type);
+    void dimensions (ExprId type);
+    void declarator (ExprId type, ExprId id);
+    void leave (std::size_t scope);
+
+    void literal (ExprId id);
+    void expression (ExprId id, bool bare = false);
+
+    void body (ExprId id);
+    void statement (ExprId id);
+    void variable (ExprId decl, bool global, bool external);
+    void prototype (ExprId decl, bool external);
+
+    void structure (ExprId decl, bool forward);
+    void structures (std::span<const ExprId> imported, std::span<const ExprId> decls);
+    void enumeration (ExprId decl, const ConstEnum *evaluated);
+    void table (const ConstTable &table, bool local);
+    void conversion (const ConstEnum &e, uint32_t column, std::string_view suffix);
+
+    bool is_main (ExprId decl) const;
+    bool is_pointer (ExprId id) const;
+    bool is_constant (ExprId id) const;
+
+public:
+    CEmitter (const Ast &ast, const ConstData &data, OutputBuffer &out, std::string_view path,
+              const Interner &interner = global_interner())
+        : ast(ast), data(data), interner(interner), out(out), path(path) {}
+
+    // Writes `unit` as one C file, declaring the `imported` roots. A node C
+    // has no counterpart for is reported as a diagnostic, and what was
+    // written for the unit must then be dropped.
+    void unit (ExprId unit, std::span<const ExprId> imported = {});
+};
+
+// Reports `id` at `at`, which has no location in a stream.
+template<typename... Args>
+void CEmitter::error (Diag id, ExprId at, Args... args) {
+    const uint64_t packed[] = {diag_arg(args)..., 0};
+    auto loc = ast[at].loc;
+    if (loc == Loc::None) {
+        raise_diagnostic(id, {path, {}, 0, 0}, 0, 0, packed);
+        return;
+    }
+    auto &file = global_sources().file(loc);
+    auto pos = static_cast<uint32_t>(loc) - file.base;
+    raise_diagnostic(id, file.locate(pos), pos, 0, packed);
+}
+
+void CEmitter::indent () {
+    for (uint32_t i = 0; i < depth; i++) {
+        out << "    ";
+    }
+}
+
+void CEmitter::name (Symbol sym) {
+    auto text = interner.name(sym);
+    out << text;
+    if (CReservedNames.find(text)) {
+        out << '_';
+    }
+}
+
+void CEmitter::element_type (Token::Type type) {
+    switch (type) {
+    case Token::String: out << "const u8 *";  break;
+    // Float types have no keyword, so only comp tables reach here with them.
+    case Token::F32:    out << "f32";         break;
+    case Token::F64:    out << "f64";         break;
+    default:            out << to_string(type); break;
+    }
+}
+
+// The type of a read-only table element, up to the name.
+void CEmitter::constant_type (Token::Type type) {
+    if (type == Token::String) {
+        out << "const u8 *const ";
+        return;
+    }
+    out << "const ";
+    element_type(type);
+    out << ' ';
+}
+
+// Writes an element as ConstData::element widens it.
+void CEmitter::number (uint64_t bits, Token::Type type) {
+    if (type == Token::String) {
+        string(static_cast<Symbol>(bits));
+        return;
+    }
+    if (is_float(type)) {
+        auto d = std::bit_cast<double>(bits);
+        if (std::isnan(d)) {
+            out << "(0.0 / 0.0)";
+        } else if (std::isinf(d)) {
+            out << (d < 0 ? "(-1.0 / 0.0)" : "(1.0 / 0.0)");
+        } else {
+            char buf[32];
+            auto end = std::to_chars(buf, buf + sizeof(buf), d).ptr;
+            std::string_view text(buf, static_cast<std::size_t>(end - buf));
+            out << text;
+            if (text.find_first_of(".e") == std::string_view::npos) {
+                out << ".0";
+            }
+        }
+        return;
+    }
+    if (is_signed(type)) {
+        auto n = static_cast<int64_t>(bits);
+        // The smallest value has no literal, its negation overflowing.
+        if (n == INT64_MIN) {
+            out << "(-9223372036854775807ll - 1)";
+        } else {
+            out << n;
+        }
+        return;
+    }
+    out << bits;
+    if (bits > INT64_MAX) {
+        out << "ull";
+    }
+}
+
+// Strings keep their source text, whose escapes C reads alike. They are
+// `u8 *` as in lain, which C turns const wherever a const one is wanted.
+void CEmitter::string (Symbol sym) {
+    out << "(u8 *)\"" << interner.name(sym) << '"';
+}
+
+void CEmitter::base_type (ExprId type) {
+    auto &expr = ast[type];
+    switch (expr.type) {
+    case Expression::Builtin:
+        element_type(static_cast<Token::Type>(expr.data));
+        return;
+    case Expression::Pointer:
+        base_type(ast.children(type)[0]);
+        out << " *";
+        return;
+    case Expression::Array:
+        base_type(ast.children(type)[0]);
+        return;
+    case Expression::Identifier:
+        name(type);
+        return;
+    default:
+        // `var` leaves the type to the initializer.
+        out << "__auto_type";
+        return;
+    }
+}
+
+// Array sizes in source order, the innermost node holding the first.
+void CEmitter::dimensions (ExprId type) {
+    if (ast[type].type != Expression::Array) {
+        return;
+    }
+    auto parts = ast.children(type);
+    dimensions(parts[0]);
+    out << '[';
+    if (parts.size() > 1) {
+        expression(parts[1], true);
+    }
+    out << ']';
+}
+
+// Pointer types already end in `*`, which the name follows directly.
+void CEmitter::declarator (ExprId type, ExprId id) {
+    bool pointer = ast[type].type == Expression::Pointer;
+    base_type(type);
+    if (!pointer) {
+        out << ' ';
+    }
+    name(id);
+    dimensions(type);
+    auto [it, fresh] = pointers.try_emplace(static_cast<uint32_t>(ast.symbol(id)), pointer);
+    shadowed.emplace_back(it->first, fresh ? -1 : it->second);
+    it->second = pointer;
+}
+
+// Forgets what was declared since `shadowed` held `scope` entries.
+void CEmitter::leave (std::size_t scope) {
+    while (shadowed.size() > scope) {
+        auto [key, old] = shadowed.back();
+        shadowed.pop_back();
+        if (old < 0) {
+            pointers.erase(key);
+        } else {
+            pointers[key] = old;
+        }
+    }
+}
+
+// Whether `id` names a pointer, as far as declarations tell.
+bool CEmitter::is_pointer (ExprId id) const {
+    auto &expr = ast[id];
+    if (expr.type == Expression::Binary && expr.op == Operator::Member) {
+        id = ast.children(id)[1];
+    } else if (expr.type != Expression::Identifier) {
+        return false;
+    }
+    auto it = pointers.find(static_cast<uint32_t>(ast.symbol(id)));
+    return it != pointers.end() && it->second;
+}
+
+// Whether C takes `id` as a constant expression, as a global initializer
+// must be.
+bool CEmitter::is_constant (ExprId id) const {
+    auto &expr = ast[id];
+    auto parts = ast.children(id);
+    switch (expr.type) {
+    case Expression::Integer:
+    case Expression::Character:
+    case Expression::Float:
+    case Expression::Ipv4:
+    case Expression::Color:
+    case Expression::String:
+        return true;
+    case Expression::List:
+        return std::ranges::all_of(parts, [this](ExprId part) { return is_constant(part); });
+    case Expression::Unary:
+        switch (expr.op) {
+        case Operator::Address:
+            return ast[parts[0]].type == Expression::Identifier;
+        case Operator::Negate:
+        case Operator::LogicalNot:
+        case Operator::BitwiseNot:
+            return is_constant(parts[0]);
+        default:
+            return false;
+        }
+    case Expression::Binary:
+        if (expr.op == Operator::Member) {
+            return ast[parts[0]].type == Expression::Identifier && enums.contains(static_cast<uint32_t>(ast.symbol(parts[0])));
+        }
+        return expr.op >= Operator::Multiply && expr.op <= Operator::LogicalOr && is_constant(parts[0]) && is_constant(parts[1]);
+    default:
+        return false;
+    }
+}
+
+void CEmitter::literal (ExprId id) {
+    auto value = ast.literal(id);
+    switch (ast[id].type) {
+    case Expression::Float:
+        number(value, Token::F64);
+        return;
+    case Expression::Ipv4:
+    case Expression::Color: {
+        char buf[24];
+        auto end = std::to_chars(buf, buf + sizeof(buf), value, 16).ptr;
+        out << "0x" << std::string_view(buf, static_cast<std::size_t>(end - buf)) << 'u';
+        return;
+    }
+    default:
+        number(value, Token::U64);
+        return;
+    }
+}
+
+void CEmitter::expression (ExprId id, bool bare) {
+    auto &expr = ast[id];
+    auto parts = ast.children(id);
+    switch (expr.type) {
+    case Expression::Integer:
+    case Expression::Character:
+    case Expression::Float:
+    case Expression::Ipv4:
+    case Expression::Color:
+        literal(id);
+        return;
+    case Expression::String:
+        string(ast.symbol(id));
+        return;
+    case Expression::Identifier:
+        name(id);
+        return;
+    case Expression::List:
+        out << '{';
+        for (std::size_t i = 0; i < parts.size(); i++) {
+            out << (i ? ", " : "");
+            expression(parts[i], true);
+        }
+        out << '}';
+        return;
+    case Expression::Call:
+        expression(parts[0]);
+        out << '(';
+        for (std::size_t i = 1; i < parts.size(); i++) {
+            out << (i > 1 ? ", " : "");
+            expression(parts[i], true);
+        }
+        out << ')';
+        return;
+    case Expression::Unary:
+        out << (bare ? "" : "(");
+        if (expr.op == Operator::PostIncrement) {
+            expression(parts[0]);
+            out << "++";
+        } else {
+            out << to_string(OperatorTable[expr.op].token);
+            expression(parts[0]);
+        }
+        out << (bare ? "" : ")");
+        return;
+    case Expression::Binary:
+        break;
+    default:
+        error(Diag::EmitUnsupported, id, to_string(expr.type).data());
+        return;
+    }
+
+    switch (expr.op) {
+    case Operator::Index:
+        expression(parts[0]);
+        out << '[';
+        expression(parts[1], true);
+        out << ']';
+        return;
+    case Operator::Member:
+        if (ast[parts[0]].type == Expression::Identifier && enums.contains(static_cast<uint32_t>(ast.symbol(parts[0])))) {
+            out << interner.name(ast.symbol(parts[0])) << '_' << interner.name(ast.symbol(parts[1]));
+            return;
+        }
+        expression(parts[0]);
+        out << (is_pointer(parts[0]) ? "->" : ".");
+        expression(parts[1]);
+        return;
+    default:
+        out << (bare ? "" : "(");
+        expression(parts[0]);
+        out << (expr.op == Operator::Comma ? "" : " ") << to_string(OperatorTable[expr.op].token) << ' ';
+        expression(parts[1]);
+        out << (bare ? "" : ")");
+        return;
+    }
+}
+
+// A statement that C wants braced, braced.
+void CEmitter::body (ExprId id) {
+    if (ast[id].type == Expression::Block) {
+        statement(id);
+        return;
+    }
+    out << "{\n";
+    depth++;
+    indent();
+    statement(id);
+    out << '\n';
+    depth--;
+    indent();
+    out << '}';
+}
+
+// Writes a statement from the current column, leaving the line open.
+void CEmitter::statement (ExprId id) {
+    auto &expr = ast[id];
+    auto parts = ast.children(id);
+    auto scope = shadowed.size();
+    switch (expr.type) {
+    case Expression::Block:
+        out << "{\n";
+        depth++;
+        for (auto child: parts) {
+            indent();
+            statement(child);
+            out << '\n';
+        }
+        depth--;
+        indent();
+        out << '}';
+        leave(scope);
+        return;
+    case Expression::Variable:
+        variable(id, false, false);
+        return;
+    case Expression::If:
+        out << "if (";
+        expression(parts[0], true);
+        out << ") ";
+        body(parts[1]);
+        if (ast[parts[2]].type != Expression::Null) {
+            out << " else ";
+            if (ast[parts[2]].type == Expression::If) {
+                statement(parts[2]);
+            } else {
+                body(parts[2]);
+            }
+        }
+        return;
+    case Expression::For:
+        out << "for (";
+        if (ast[parts[0]].type == Expression::Variable) {
+            variable(parts[0], false, false);
+        } else {
+            if (ast[parts[0]].type != Expression::Null) {
+                expression(parts[0], true);
+            }
+            out << ';';
+        }
+        out << ' ';
+        if (ast[parts[1]].type != Expression::Null) {
+            expression(parts[1], true);
+        }
+        out << "; ";
+        if (ast[parts[2]].type != Expression::Null) {
+            expression(parts[2], true);
+        }
+        out << ") ";
+        body(parts[3]);
+        leave(scope);
+        return;
+    case Expression::Return:
+        // lain drops the value, where C rejects the return.
+        if (!parts.empty() && ast[ast.children(function)[1]].type == Expression::Null && !is_main(function)) {
+            error(Diag::EmitUnsupported, id, "value returned from a function with no return type");
+        }
+        out << "return";
+        if (!parts.empty()) {
+            out << ' ';
+            expression(parts[0], true);
+        }
+        out << ';';
+        return;
+    case Expression::Break:
+        out << "break;";
+        return;
+    case Expression::Continue:
+        out << "continue;";
+        return;
+    case Expression::Null:
+        out << ';';
+        return;
+    default:
+        expression(id, true);
+        out << ';';
+        return;
+    }
+}
+
+// Writes a declaration, ending in its semicolon. Comp declarations at the
+// top level are written from their table when they have one.
+void CEmitter::variable (ExprId decl, bool global, bool external) {
+    auto &expr = ast[decl];
+    auto parts = ast.children(decl);
+    bool comp = expr.flags & Modifier::Comp;
+
+    if (global && comp && !external) {
+        if (auto it = tables.find(static_cast<uint32_t>(ast.symbol(parts[1]))); it != tables.end()) {
+            table(data.tables[it->second], expr.flags & Modifier::Private);
+            return;
+        }
+    }
+    if (external) {
+        out << "extern ";
+    } else if ((global && (expr.flags & Modifier::Private)) || (expr.flags & Modifier::Static)) {
+        out << "static ";
+    }
+    if (comp || (expr.flags & Modifier::Const)) {
+        out << "const ";
+    }
+    // C infers no type from a braced list.
+    auto element = parts[0];
+    while (ast[element].type == Expression::Array) {
+        element = ast.children(element)[0];
+    }
+    if (ast[element].type == Expression::Null && ast[parts[2]].type == Expression::List) {
+        error(Diag::EmitUnsupported, parts[2], "untyped list");
+    }
+    declarator(parts[0], parts[1]);
+    if (!external && ast[parts[2]].type != Expression::Null) {
+        if (global && !is_constant(parts[2])) {
+            error(Diag::EmitUnsupported, parts[2], "global initializer that is not constant");
+        }
+        out << " = ";
+        expression(parts[2], true);
+    }
+    out << ';';
+}
+
+// `main` returns int whether or not its declaration says so.
+bool CEmitter::is_main (ExprId decl) const {
+    auto parts = ast.children(decl);
+    return ast[parts[0]].type == Expression::Identifier && interner.name(ast.symbol(parts[0])) == "main";
+}
+
+// Writes the signature of a function, with no terminator.
+void CEmitter::prototype (ExprId decl, bool external) {
+    auto parts = ast.children(decl);
+    if (external) {
+        out << "extern ";
+    } else if (ast[decl].flags & Modifier::Private) {
+        out << "static ";
+    }
+    if (ast[parts[1]].type != Expression::Null) {
+        base_type(parts[1]);
+    } else {
+        out << (is_main(decl) ? "int" : "void");
+    }
+    out << ' ';
+    name(parts[0]);
+    out << " (";
+    if (parts.size() == 3) {
+        out << "void";
+    }
+    for (std::size_t i = 3; i < parts.size(); i++) {
+        auto param = ast.children(parts[i]);
+        out << (i > 3 ? ", " : "");
+        declarator(param[0], param[1]);
+    }
+    out << ')';
+}
+
+void CEmitter::structure (ExprId decl, bool forward) {
+    auto parts = ast.children(decl);
+    if (forward) {
+        out << "typedef struct ";
+        name(parts[0]);
+        out << ' ';
+        name(parts[0]);
+        out << ";\n";
+        return;
+    }
+    out << "\nstruct ";
+    name(parts[0]);
+    out << " {\n";
+    depth++;
+    for (auto field: parts.subspan(1)) {
+        indent();
+        variable(field, false, false);
+        out << '\n';
+    }
+    depth--;
+    out << "};\n";
+}
+
+// Struct bodies, each after those it holds by value, which C needs complete
+// first. A struct that holds itself has no layout.
+void CEmitter::structures (std::span<const ExprId> imported, std::span<const ExprId> decls) {
+    std::vector<ExprId> structs;
+    std::unordered_map<uint32_t, uint32_t> index;
+    for (auto list: {imported, decls}) {
+        for (auto decl: list) {
+            if (ast[decl].type == Expression::Struct) {
+                index.try_emplace(static_cast<uint32_t>(ast.symbol(ast.children(decl)[0])), static_cast<uint32_t>(structs.size()));
+                structs.push_back(decl);
+            }
+        }
+    }
+
+    // Depth first without recursion: each open struct with the next field to
+    // look at. 0 is unseen, 1 open and 2 written.
+    std::vector<uint8_t> state(structs.size());
+    std::vector<std::pair<uint32_t, uint32_t>> stack;
+    for (uint32_t i = 0; i < structs.size(); i++) {
+        if (state[i]) {
+            continue;
+        }
+        state[i] = 1;
+        stack.emplace_back(i, 1);
+        while (!stack.empty()) {
+            auto &[at, field] = stack.back();
+            auto fields = ast.children(structs[at]);
+            if (field == fields.size()) {
+                state[at] = 2;
+                structure(structs[at], false);
+                stack.pop_back();
+                continue;
+            }
+            auto type = ast.children(fields[field++])[0];
+            while (ast[type].type == Expression::Array) {
+                type = ast.children(type)[0];
+            }
+            if (ast[type].type != Expression::Identifier) {
+                continue;
+            }
+            auto it = index.find(static_cast<uint32_t>(ast.symbol(type)));
+            if (it == index.end() || state[it->second] == 2) {
+                continue;
+            }
+            if (state[it->second] == 1) {
+                error(Diag::EmitUnsupported, structs[it->second], "struct that holds itself");
+                continue;
+            }
+            state[it->second] = 1;
+            stack.emplace_back(it->second, 1);
+        }
+    }
+}
+
+// Entries are named `Enum_Entry`. An enum of this unit also gets its columns
+// as tables indexed by entry, `Enum_name` and `Enum_value1`..., linked as a
+// comp table would be, and a conversion back from each hashed column.
+void CEmitter::enumeration (ExprId decl, const ConstEnum *evaluated) {
+    auto parts = ast.children(decl);
+    auto enum_name = interner.name(ast.symbol(parts[0]));
+    out << "\ntypedef enum ";
+    name(parts[0]);
+    out << " {\n";
+    for (auto entry: parts.subspan(2)) {
+        out << "    " << enum_name << '_' << interner.name(ast.symbol(ast.children(entry)[1])) << ",\n";
+    }
+    out << "} ";
+    name(parts[0]);
+    out << ";\n";
+
+    if (!evaluated) {
+        return;
+    }
+    char suffix[16] = "value";
+    for (uint32_t c = 0; c < evaluated->columns; c++) {
+        std::string_view column_suffix = "name";
+        if (c) {
+            auto end = std::to_chars(suffix + 5, suffix + sizeof(suffix), c).ptr;
+            column_suffix = {suffix, static_cast<std::size_t>(end - suffix)};
+        }
+        auto &column = data.columns[evaluated->column + c];
+        out << (ast[decl].flags & Modifier::Private ? "\nstatic " : "\n");
+        constant_type(column.element);
+        out << enum_name << '_' << column_suffix
+            << '[' << column.count << "] = {";
+        for (uint32_t i = 0; i < column.count; i++) {
+            out << (i ? ", " : "");
+            number(data.element(column, i), column.element);
+        }
+        out << "};\n";
+        conversion(*evaluated, evaluated->column + c, column_suffix);
+    }
+}
+
+// Writes `Enum_from_<suffix>`, which returns the entry holding a value or -1,
+// when the column is hashed. A string column holding escapes is left out,
+// since its hash was taken over the text as written.
+void CEmitter::conversion (const ConstEnum &e, uint32_t column, std::string_view suffix) {
+    auto &hash = data.hashes[column];
+    auto &table = data.columns[column];
+    if (hash.empty()) {
+        return;
+    }
+    if (table.element == Token::String) {
+        for (uint32_t i = 0; i < table.count; i++) {
+            if (interner.name(static_cast<Symbol>(data.element(table, i))).find('\\') != std::string_view::npos) {
+                return;
+            }
+        }
+    }
+    auto enum_name = interner.name(e.name);
+
+    out << "static const u16 " << enum_name << '_' << suffix << "_pilots[" << hash.pilots.size() << "] = {";
+    for (std::size_t i = 0; i < hash.pilots.size(); i++) {
+        out << (i ? ", " : "") << hash.pilots[i];
+    }
+    out << "};\nstatic const u32 " << enum_name << '_' << suffix << "_order[" << hash.order.size() << "] = {";
+    for (std::size_t i = 0; i < hash.order.size(); i++) {
+        out << (i ? ", " : "") << hash.order[i];
+    }
+    out << "};\n\nstatic inline int " << enum_name << "_from_" << suffix << " (";
+    element_type(table.element);
+    out << (table.element == Token::String ? "key) {\n" : " key) {\n") << "    uint64_t h = lain_hash_mix(";
+    if (table.element == Token::String) {
+        out << "lain_hash_bytes(key)";
+    } else if (is_float(table.element)) {
+        out << "lain_hash_mix(lain_double_bits(key))";
+    } else {
+        out << "lain_hash_mix((uint64_t)key)";
+    }
+    out << " ^ " << hash.seed << "ull);\n"
+        << "    uint64_t high = h >> 32;\n"
+        << "    uint64_t b = high < " << PerfectHash::Split << "ull ? high % " << hash.dense << "u : "
+        << hash.dense << "u + high % " << hash.buckets - hash.dense << "u;\n"
+        << "    u32 i = " << enum_name << '_' << suffix << "_order[(h ^ lain_hash_mix(" << enum_name << '_' << suffix
+        << "_pilots[b] + 1ull)) % " << hash.slots << "u];\n"
+        << "    return ";
+    if (table.element == Token::String) {
+        out << "lain_equal(" << enum_name << '_' << suffix << "[i], key)";
+    } else {
+        out << enum_name << '_' << suffix << "[i] == key";
+    }
+    out << " ? (int)i : -1;\n}\n";
+}
+
+void CEmitter::table (const ConstTable &table, bool local) {
+    out << (local ? "static " : "");
+    constant_type(table.element);
+    name(table.name);
+    auto dims = data.shape(table);
+    for (auto dim: dims) {
+        out << '[' << dim << ']';
+    }
+    out << " = ";
+
+    uint32_t i = 0;
+    auto nest = [&](auto &self, std::size_t level) -> void {
+        if (level == dims.size()) {
+            number(data.element(table, i++), table.element);
+            return;
+        }
+        out << '{';
+        for (uint32_t n = 0; n < dims[level]; n++) {
+            out << (n ? ", " : "");
+            self(self, level + 1);
+        }
+        out << '}';
+    };
+    nest(nest, 0);
+    out << ';';
+}
+
+void CEmitter::unit (ExprId unit, std::span<const ExprId> imported) {
+    auto decls = ast.children(unit);
+    for (std::size_t i = 0; i < data.tables.size(); i++) {
+        tables[static_cast<uint32_t>(data.tables[i].name)] = static_cast<uint32_t>(i);
+    }
+    for (auto list: {imported, decls}) {
+        for (auto decl: list) {
+            if (ast[decl].type == Expression::Enum) {
+                enums[static_cast<uint32_t>(ast.symbol(ast.children(decl)[0]))] = true;
+            }
+        }
+    }
+
+    out << CPreamble;
+    for (auto &hash: data.hashes) {
+        if (!hash.empty()) {
+            out << CHashHelpers;
+            break;
+        }
+    }
+
+    bool any = false;
+    for (auto list: {imported, decls}) {
+        for (auto decl: list) {
+            if (ast[decl].type == Expression::Struct) {
+                out << (any ? "" : "\n");
+                any = true;
+                structure(decl, true);
+            }
+        }
+    }
+
+    // Enums were evaluated in declaration order, so the n-th of the unit is
+    // the n-th in ConstData.
+    for (auto decl: imported) {
+        if (ast[decl].type == Expression::Enum) {
+            enumeration(decl, nullptr);
+        }
+    }
+    std::size_t evaluated = 0;
+    for (auto decl: decls) {
+        if (ast[decl].type == Expression::Enum) {
+            enumeration(decl, evaluated < data.enums.size() ? &data.enums[evaluated++] : nullptr);
+        }
+    }
+
+    structures(imported, decls);
+
+    out << '\n';
+    for (auto decl: imported) {
+        // Private ones are static where they are defined, and only here for
+        // the comp code that calls them.
+        if (ast[decl].flags & Modifier::Private) {
+            continue;
+        }
+        if (ast[decl].type == Expression::Variable) {
+            variable(decl, true, true);
+            out << '\n';
+        } else if (ast[decl].type == Expression::Function) {
+            auto scope = shadowed.size();
+            prototype(decl, true);
+            out << ";\n";
+            leave(scope);
+        }
+    }
+    for (auto decl: decls) {
+        if (ast[decl].type == Expression::Function) {
+            auto scope = shadowed.size();
+            prototype(decl, false);
+            out << ";\n";
+            leave(scope);
+        }
+    }
+
+    for (auto decl: decls) {
+        if (ast[decl].type == Expression::Variable) {
+            out << '\n';
+            variable(decl, true, false);
+            out << '\n';
+        }
+    }
+    for (auto decl: decls) {
+        if (ast[decl].type == Expression::Function && ast[ast.children(decl)[2]].type == Expression::Block) {
+            auto scope = shadowed.size();
+            function = decl;
+            out << '\n';
+            prototype(decl, false);
+            out << ' ';
+            statement(ast.children(decl)[2]);
+            out << '\n';
+            leave(scope);
+        }
+    }
+}
+
+}
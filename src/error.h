@@ -8,7 +8,16 @@
 
 namespace lain {
 
+// Sees fatal errors raised on the current thread just before the process
+// ends, letting a driver report what it knows about them. Errors a user can
+// cause are reported as diagnostics instead, so a fatal error is a compiler
+// bug or an exhausted resource.
+thread_local void (*fatal_handler)(const std::string &msg) = nullptr;
+
 [[noreturn]] void term(const std::string& msg) {
+    if (fatal_handler) {
+        fatal_handler(msg);
+    }
     std::fputs(msg.c_str(), stderr);
     std::abort();
 }
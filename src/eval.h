@@ -0,0 +1,1382 @@
+#pragma once
+
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "diagnostic.h"
+#include "expression.h"
+#include "module.h"
+#include "perfect.h"
+
+namespace lain {
+
+// Value computed at compile time, in 16 bytes. Integers are kept as 64-bit
+// two's complement and narrowed when stored to a typed variable, floats are
+// the bits of a double and strings a Symbol. An array is `count` values from
+// `data` in the evaluator's heap, all converted to `element`. An integer
+// stored as u64, or a literal past INT64_MAX, has `element` U64 and divides
+// and compares unsigned, as in C; narrower types all fit in the signed range.
+struct Value {
+    enum Kind : uint8_t {
+        Void,
+        Int,
+        Float,
+        String,
+        Array,
+    } kind = Void;
+
+    // Set on the arrays of comp declarations, which nothing may write.
+    bool readonly = false;
+
+    Token::Type element = Token::Unknown;
+
+    uint32_t count = 0;
+    uint64_t data = 0;
+
+    static Value integer (int64_t n) { return {Int, false, Token::Unknown, 0, static_cast<uint64_t>(n)}; }
+
+    static Value unsigned_integer (uint64_t n) { return {Int, false, Token::U64, 0, n}; }
+
+    static Value real (double d) { return {Float, false, Token::Unknown, 0, std::bit_cast<uint64_t>(d)}; }
+
+    int64_t as_int () const { return static_cast<int64_t>(data); }
+
+    double as_real () const {
+        if (kind == Float) {
+            return std::bit_cast<double>(data);
+        }
+        return is_unsigned() ? static_cast<double>(data) : static_cast<double>(as_int());
+    }
+
+    bool is_unsigned () const { return kind == Int && element == Token::U64; }
+
+    bool numeric () const { return kind == Int || kind == Float; }
+};
+
+static_assert(sizeof(Value) == 16);
+
+constexpr const char *ValueNames[] = {"void", "integer", "float", "string", "array"};
+
+// Bytes of one element of `type` on the target. Strings are pointers.
+constexpr uint32_t element_size (Token::Type type) {
+    switch (type) {
+    case Token::U8: case Token::I8:
+        return 1;
+    case Token::U16: case Token::I16:
+        return 2;
+    case Token::U32: case Token::I32: case Token::UInt: case Token::Int: case Token::F32:
+        return 4;
+    case Token::U64: case Token::I64: case Token::F64: case Token::String:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+constexpr bool is_signed (Token::Type type) {
+    return type == Token::I8 || type == Token::I16 || type == Token::I32 || type == Token::I64 || type == Token::Int;
+}
+
+constexpr bool is_float (Token::Type type) {
+    return type == Token::F32 || type == Token::F64;
+}
+
+// Element type and dimensions of a declaration, in source order. A dimension
+// of 0 is taken from the initializer.
+struct Shape {
+    static constexpr uint32_t MaxRank = 8;
+
+    Token::Type element = Token::Unknown;
+    uint32_t rank = 0;
+    uint32_t dims[MaxRank] = {};
+
+    uint64_t elements () const {
+        uint64_t n = 1;
+        for (uint32_t i = 0; i < rank; i++) {
+            n *= dims[i];
+        }
+        return n;
+    }
+};
+
+// One evaluated comp declaration. Its elements sit in ConstData::bytes,
+// flattened in row-major order and laid out as the target stores them, little
+// endian with strings as their Symbol, so a backend writes them out as
+// read-only data and nothing runs at startup.
+struct ConstTable {
+    Symbol name;
+    Token::Type element;
+    // Array dimensions are `rank` entries of ConstData::dims from `dims`; a
+    // scalar has none.
+    uint32_t rank;
+    uint32_t dims;
+    uint32_t count;
+    uint32_t offset;
+};
+
+// One evaluated enum. Entry `i` has ordinal `i`, and each column is a table
+// of ConstData::columns indexed by ordinal, from `column`: first the names of
+// the entries, then one per value their initializers give. A column whose
+// values are distinct also has a perfect hash in ConstData::hashes, at the
+// same index, turning a value back into its ordinal.
+struct ConstEnum {
+    Symbol name;
+    uint32_t count;
+    uint32_t column;
+    uint32_t columns;
+};
+
+// The comp declarations of one unit, evaluated.
+struct ConstData {
+    tagged_vector<ConstTable, Subsystem::Comp> tables;
+    tagged_vector<uint32_t, Subsystem::Comp> dims;
+    tagged_vector<uint8_t, Subsystem::Comp> bytes;
+
+    tagged_vector<ConstEnum, Subsystem::Comp> enums;
+    tagged_vector<ConstTable, Subsystem::Comp> columns;
+    tagged_vector<PerfectHash, Subsystem::Comp> hashes;
+
+    uint64_t steps = 0;
+    uint64_t calls = 0;
+    uint64_t memoized = 0;
+
+    std::span<const uint32_t> shape (const ConstTable &table) const {
+        return {dims.data() + table.dims, table.rank};
+    }
+
+    // Element `i` of `table` widened to 64 bits: integers sign or zero
+    // extended, floats as the bits of a double and strings as their Symbol.
+    uint64_t element (const ConstTable &table, std::size_t i) const;
+
+    // The key PerfectHash takes for element `i` of `table`.
+    uint64_t key (const ConstTable &table, std::size_t i, const Interner &interner = global_interner()) const {
+        auto bits = element(table, i);
+        return table.element == Token::String ? hash_bytes(interner.name(static_cast<Symbol>(bits))) : hash_mix(bits);
+    }
+};
+
+uint64_t ConstData::element (const ConstTable &table, std::size_t i) const {
+    auto size = element_size(table.element);
+    auto at = bytes.data() + table.offset + i * size;
+    uint64_t bits = 0;
+    for (uint32_t b = 0; b < size; b++) {
+        bits |= static_cast<uint64_t>(at[b]) << (8 * b);
+    }
+    if (table.element == Token::F32) {
+        return std::bit_cast<uint64_t>(static_cast<double>(std::bit_cast<float>(static_cast<uint32_t>(bits))));
+    }
+    if (is_signed(table.element) && size < 8) {
+        auto shift = 64 - 8 * size;
+        return static_cast<uint64_t>(static_cast<int64_t>(bits << shift) >> shift);
+    }
+    return bits;
+}
+
+// Interpreter for comp declarations over the parsed Ast. Every comp variable
+// of a unit is evaluated in declaration order, pulling in those it refers to
+// first, and may call any function of the unit or its imports. A function
+// only reads its arguments, its locals and comp data, so every call is pure:
+// calls with scalar arguments are memoized, which also turns naive recursion
+// such as fib into a linear walk. Step, memory and call depth limits stop a
+// runaway evaluation with an error on the declaration that started it.
+class Evaluator {
+public:
+    struct Limits {
+        uint64_t steps = 1 << 24;
+        std::size_t memory = 64 << 20;
+        uint32_t depth = 512;
+    };
+
+private:
+    enum class Flow {
+        Next,
+        Return,
+        Break,
+        Continue,
+    };
+
+    struct Global {
+        ExprId decl;
+        enum State : uint8_t {
+            Pending,
+            Running,
+            Done,
+            Failed,
+        } state = Pending;
+        Shape shape;
+        Value value;
+    };
+
+    struct Local {
+        Symbol name;
+        Value value;
+        Shape shape;
+    };
+
+    const Ast &ast;
+    std::string_view path;
+    Limits limits;
+    Interner &interner;
+    Symbol sizeof_name;
+    // What a missing string element holds.
+    Symbol empty_name;
+
+    std::unordered_map<uint32_t, Global> globals;
+    std::unordered_map<uint32_t, ExprId> functions;
+    std::unordered_map<std::string, Value> memo;
+
+    tagged_vector<Value, Subsystem::Comp> heap;
+    tagged_vector<Value, Subsystem::Comp> args;
+    tagged_vector<Local, Subsystem::Comp> locals;
+
+    // First local of the running call, and the value it returned.
+    std::size_t frame = 0;
+    Value returned;
+
+    uint32_t depth = 0;
+    uint64_t steps = 0;
+    // Globals finished so far. Their arrays live on the heap for good, so a
+    // call that finished one keeps everything it allocated.
+    std::size_t finished = 0;
+    // Heap in use when the running declaration started. Only what it
+    // allocates since counts against the memory limit.
+    std::size_t charged = 0;
+    bool failed = false;
+
+    ConstData data;
+
+    template<typename... Args>
+    [[gnu::cold]] void error (Diag id, ExprId at, Args... args);
+
+    bool tick (ExprId at);
+
+    uint64_t allocate (uint64_t count, ExprId at);
+
+    Value narrow (Value v, Token::Type type, ExprId at);
+
+    Value convert (Value v, Token::Type type, ExprId at);
+    Value store (Value v, Shape &shape, uint32_t level, ExprId at);
+    Value zero (const Shape &shape, uint32_t level, ExprId at);
+    void infer (Value v, Shape &shape) const;
+    void freeze (Value &v);
+
+    bool resolve (ExprId type, Shape &shape);
+    Local *local (Symbol name);
+    const Global *global (Symbol name, ExprId at);
+
+    bool truth (ExprId id);
+    Value *place (ExprId id, Token::Type &type);
+    Value arithmetic (Operator op, Value l, Value r, ExprId at);
+    Value unary (ExprId id);
+    Value binary (ExprId id);
+    Value assign (ExprId id);
+    Value call (ExprId id);
+    Value size_of (ExprId id);
+    Value eval (ExprId id);
+
+    void declare (ExprId decl);
+    Flow exec (ExprId id);
+
+    void index (ExprId decl);
+    void emit (Symbol name, const Global &global);
+    void column (Symbol name, Token::Type element, std::span<const Value> values, std::size_t stride);
+    void enumerate (ExprId decl);
+    void flatten (Value v, const Shape &shape, uint32_t level, uint8_t *&out);
+
+public:
+    Evaluator (const Ast &ast, std::string_view path, Limits limits, Interner &interner = global_interner())
+        : ast(ast), path(path), limits(limits), interner(interner),
+          sizeof_name(interner.intern("sizeof")), empty_name(interner.intern("")) {}
+
+    Evaluator (const Ast &ast, std::string_view path, Interner &interner = global_interner())
+        : Evaluator(ast, path, Limits{}, interner) {}
+
+    // Evaluates the comp declarations and enums of `unit`. Declarations in
+    // `imported` are only evaluated as far as the unit uses them.
+    ConstData run (ExprId unit, std::span<const ExprId> imported = {});
+};
+
+// Reports `id` at the node `at`, once per failed evaluation. Imported and
+// streamed nodes have no location, so their errors point at the unit.
+template<typename... Args>
+void Evaluator::error (Diag id, ExprId at, Args... args) {
+    if (failed) {
+        return;
+    }
+    failed = true;
+    const uint64_t packed[] = {diag_arg(args)..., 0};
+    auto loc = ast[at].loc;
+    if (loc == Loc::None) {
+        raise_diagnostic(id, {path, {}, 0, 0}, 0, 0, packed);
+        return;
+    }
+    auto &file = global_sources().file(loc);
+    auto pos = static_cast<uint32_t>(loc) - file.base;
+    raise_diagnostic(id, file.locate(pos), pos, 0, packed);
+}
+
+bool Evaluator::tick (ExprId at) {
+    if (++steps > limits.steps) [[unlikely]] {
+        error(Diag::CompSteps, at, static_cast<int64_t>(limits.steps));
+    }
+    return !failed;
+}
+
+uint64_t Evaluator::allocate (uint64_t count, ExprId at) {
+    auto room = limits.memory / sizeof(Value);
+    if (count > room || heap.size() - charged > room - count) {
+        error(Diag::CompMemory, at, static_cast<int64_t>(limits.memory));
+        return 0;
+    }
+    auto base = heap.size();
+    heap.resize(base + count);
+    return base;
+}
+
+// Whether the truncated float `d` converts to integer `type` without
+// overflow: u64 takes [0, 2^64), the rest go through int64 first.
+static bool fits (double d, Token::Type type) {
+    return type == Token::U64 ? d >= 0 && d < 0x1p64 : d >= -0x1p63 && d < 0x1p63;
+}
+
+// Wraps `v` to `type` as an assignment does. Integers wrap, but a float
+// beyond the range of `type`, or NaN stored to an integer, cannot be stored.
+Value Evaluator::narrow (Value v, Token::Type type, ExprId at) {
+    if (is_float(type) && v.numeric()) {
+        auto d = v.as_real();
+        if (type == Token::F32) {
+            if (std::isfinite(d) && std::fabs(d) > std::numeric_limits<float>::max()) {
+                error(Diag::CompConvert, at, ValueNames[v.kind], type);
+                return {};
+            }
+            d = static_cast<double>(static_cast<float>(d));
+        }
+        return Value::real(d);
+    }
+    auto size = element_size(type);
+    if (!size || type == Token::String || !v.numeric()) {
+        return v;
+    }
+    auto n = v.data;
+    if (v.kind == Value::Float) {
+        auto d = std::trunc(v.as_real());
+        if (!fits(d, type)) {
+            error(Diag::CompConvert, at, ValueNames[v.kind], type);
+            return {};
+        }
+        n = type == Token::U64 ? static_cast<uint64_t>(d) : static_cast<uint64_t>(static_cast<int64_t>(d));
+    }
+    if (size < 8) {
+        auto shift = 64 - 8 * size;
+        n = is_signed(type) ? static_cast<uint64_t>(static_cast<int64_t>(n << shift) >> shift) : (n << shift) >> shift;
+    }
+    return type == Token::U64 ? Value::unsigned_integer(n) : Value::integer(static_cast<int64_t>(n));
+}
+
+// Converts an initializer to `type`, rejecting integers that do not fit
+// rather than wrapping them.
+Value Evaluator::convert (Value v, Token::Type type, ExprId at) {
+    if (type == Token::Unknown) {
+        return v;
+    }
+    if (type == Token::String ? v.kind != Value::String : !v.numeric()) {
+        error(Diag::CompConvert, at, ValueNames[v.kind], type);
+        return {};
+    }
+    if (type == Token::String || is_float(type)) {
+        return narrow(v, type, at);
+    }
+    if (v.kind == Value::Float) {
+        auto d = std::trunc(v.as_real());
+        if (!fits(d, type)) {
+            error(Diag::CompConvert, at, ValueNames[v.kind], type);
+            return {};
+        }
+        v = type == Token::U64 ? Value::unsigned_integer(static_cast<uint64_t>(d)) : Value::integer(static_cast<int64_t>(d));
+    }
+    auto size = element_size(type);
+    auto n = v.as_int();
+    if (size < 8) {
+        auto bits = 8 * size;
+        bool fits = is_signed(type) ? n >= -(int64_t{1} << (bits - 1)) && n < (int64_t{1} << (bits - 1))
+                                    : n >= 0 && n < (int64_t{1} << bits);
+        if (v.is_unsigned() && n < 0) {
+            error(Diag::CompRangeUnsigned, at, v.data, type);
+            return {};
+        }
+        if (!fits) {
+            error(Diag::CompRange, at, n, type);
+            return {};
+        }
+    }
+    return type == Token::U64 ? Value::unsigned_integer(v.data) : Value::integer(n);
+}
+
+// Converts `v` to dimension `level` of `shape` onwards, into a fresh array.
+// Missing elements are zero, and an unsized dimension takes the length of the
+// first initializer it sees.
+Value Evaluator::store (Value v, Shape &shape, uint32_t level, ExprId at) {
+    if (level == shape.rank) {
+        return convert(v, shape.element, at);
+    }
+    if (v.kind != Value::Array) {
+        error(Diag::CompConvert, at, ValueNames[v.kind], shape.element);
+        return {};
+    }
+    if (!shape.dims[level]) {
+        shape.dims[level] = v.count;
+    }
+    auto count = shape.dims[level];
+    if (v.count > count) {
+        error(Diag::CompInitializers, at, static_cast<int64_t>(v.count), static_cast<int64_t>(count));
+        return {};
+    }
+    auto base = allocate(count, at);
+    for (uint32_t i = 0; i < count && !failed; i++) {
+        // Storing may grow the heap, so the slot is only taken afterwards.
+        auto item = i < v.count ? store(heap[v.data + i], shape, level + 1, at) : zero(shape, level + 1, at);
+        heap[base + i] = item;
+    }
+    return {Value::Array, false, shape.element, count, base};
+}
+
+// An element no initializer gave: zero, or the empty string.
+Value Evaluator::zero (const Shape &shape, uint32_t level, ExprId at) {
+    if (level == shape.rank) {
+        if (shape.element == Token::String) {
+            return {Value::String, false, Token::Unknown, 0, static_cast<uint64_t>(empty_name)};
+        }
+        return is_float(shape.element) ? Value::real(0) : Value::integer(0);
+    }
+    auto count = shape.dims[level];
+    auto base = allocate(count, at);
+    for (uint32_t i = 0; i < count && !failed; i++) {
+        auto item = zero(shape, level + 1, at);
+        heap[base + i] = item;
+    }
+    return {Value::Array, false, shape.element, count, base};
+}
+
+// Completes the shape of a `var` declaration from its initializer: each level
+// of nesting past the declared ones becomes a dimension as long as the first
+// list at that level, and the first scalar gives the element type.
+void Evaluator::infer (Value v, Shape &shape) const {
+    for (uint32_t level = 0; v.kind == Value::Array && level < Shape::MaxRank; level++) {
+        if (level == shape.rank) {
+            shape.dims[shape.rank++] = v.count;
+        }
+        if (!v.count) {
+            break;
+        }
+        v = heap[v.data];
+    }
+    switch (v.kind) {
+    case Value::Float:  shape.element = Token::F64;     break;
+    case Value::String: shape.element = Token::String;  break;
+    default:            shape.element = Token::I64;     break;
+    }
+}
+
+void Evaluator::freeze (Value &v) {
+    if (v.kind != Value::Array || v.readonly) {
+        return;
+    }
+    v.readonly = true;
+    for (uint32_t i = 0; i < v.count; i++) {
+        freeze(heap[v.data + i]);
+    }
+}
+
+// Reads a declared type into `shape`. Array sizes are evaluated here, so a
+// size may itself be a comp expression.
+bool Evaluator::resolve (ExprId type, Shape &shape) {
+    auto &expr = ast[type];
+    switch (expr.type) {
+    case Expression::Null:
+        shape.element = Token::Unknown;
+        return true;
+    case Expression::Builtin:
+        shape.element = static_cast<Token::Type>(expr.data);
+        if (!element_size(shape.element)) {
+            error(Diag::CompUnsupported, type, to_string(shape.element).data());
+            return false;
+        }
+        return true;
+    case Expression::Pointer: {
+        auto pointee = ast.children(type)[0];
+        if (ast[pointee].type != Expression::Builtin || ast[pointee].data != Token::U8) {
+            error(Diag::CompUnsupported, type, to_string(expr.type).data());
+            return false;
+        }
+        shape.element = Token::String;
+        return true;
+    }
+    case Expression::Array: {
+        auto parts = ast.children(type);
+        if (!resolve(parts[0], shape)) {
+            return false;
+        }
+        if (shape.rank == Shape::MaxRank) {
+            error(Diag::CompUnsupported, type, to_string(expr.type).data());
+            return false;
+        }
+        uint32_t dim = 0;
+        if (parts.size() > 1) {
+            auto size = eval(parts[1]);
+            if (failed) {
+                return false;
+            }
+            if (size.kind != Value::Int || size.as_int() <= 0 || size.as_int() > UINT32_MAX) {
+                error(Diag::CompSize, parts[1]);
+                return false;
+            }
+            dim = static_cast<uint32_t>(size.as_int());
+        }
+        shape.dims[shape.rank++] = dim;
+        return true;
+    }
+    default:
+        error(Diag::CompUnsupported, type, to_string(expr.type).data());
+        return false;
+    }
+}
+
+Evaluator::Local *Evaluator::local (Symbol name) {
+    for (auto i = locals.size(); i > frame; i--) {
+        if (locals[i - 1].name == name) {
+            return &locals[i - 1];
+        }
+    }
+    return nullptr;
+}
+
+// The comp variable `name`, evaluated on first use.
+const Evaluator::Global *Evaluator::global (Symbol name, ExprId at) {
+    auto it = globals.find(static_cast<uint32_t>(name));
+    if (it == globals.end()) {
+        return nullptr;
+    }
+    auto &slot = it->second;
+    if (slot.state == Global::Done) {
+        return &slot;
+    }
+    if (slot.state == Global::Failed) {
+        // Already reported where it failed.
+        failed = true;
+        return nullptr;
+    }
+    if (slot.state == Global::Running) {
+        error(Diag::CompCycle, at, name);
+        return nullptr;
+    }
+
+    slot.state = Global::Running;
+    // Evaluated as if at the top level, whatever call needed it first.
+    auto saved = frame;
+    frame = locals.size();
+    auto parts = ast.children(slot.decl);
+    Shape shape;
+    Value value;
+    if (resolve(parts[0], shape)) {
+        value = eval(parts[2]);
+        if (!failed && shape.element == Token::Unknown) {
+            infer(value, shape);
+        }
+        if (!failed) {
+            value = store(value, shape, 0, parts[2]);
+        }
+    }
+    frame = saved;
+
+    // The map may have grown while evaluating, so the slot is found again.
+    auto &done = globals[static_cast<uint32_t>(name)];
+    if (failed) {
+        done.state = Global::Failed;
+        return nullptr;
+    }
+    freeze(value);
+    done.state = Global::Done;
+    done.shape = shape;
+    done.value = value;
+    finished++;
+    return &done;
+}
+
+bool Evaluator::truth (ExprId id) {
+    auto v = eval(id);
+    if (failed) {
+        return false;
+    }
+    if (!v.numeric()) {
+        error(Diag::CompConvert, id, ValueNames[v.kind], Token::Int);
+        return false;
+    }
+    return v.kind == Value::Float ? v.as_real() != 0 : v.data != 0;
+}
+
+// The slot an assignment writes and the type it holds, or null. Comp data
+// and the arrays it holds are read-only.
+Value *Evaluator::place (ExprId id, Token::Type &type) {
+    auto &expr = ast[id];
+    if (expr.type == Expression::Identifier) {
+        auto name = ast.symbol(id);
+        if (auto slot = local(name)) {
+            type = slot->shape.rank ? Token::Unknown : slot->shape.element;
+            return &slot->value;
+        }
+        if (global(name, id)) {
+            error(Diag::CompReadOnly, id);
+        } else {
+            error(Diag::CompConstant, id, name);
+        }
+        return nullptr;
+    }
+    if (expr.type == Expression::Binary && expr.op == Operator::Index) {
+        auto parts = ast.children(id);
+        auto array = eval(parts[0]);
+        auto at = eval(parts[1]);
+        if (failed) {
+            return nullptr;
+        }
+        if (array.kind != Value::Array || at.kind != Value::Int) {
+            error(Diag::CompConvert, id, ValueNames[array.kind == Value::Array ? at.kind : array.kind], Token::Int);
+            return nullptr;
+        }
+        if (at.data >= array.count) {
+            error(Diag::CompIndex, parts[1], at.as_int(), static_cast<int64_t>(array.count));
+            return nullptr;
+        }
+        if (array.readonly) {
+            error(Diag::CompReadOnly, id);
+            return nullptr;
+        }
+        auto &slot = heap[array.data + at.data];
+        type = slot.kind == Value::Array ? Token::Unknown : array.element;
+        return &slot;
+    }
+    error(Diag::CompUnsupported, id, to_string(expr.type).data());
+    return nullptr;
+}
+
+// Integers wrap as in two's complement, and are unsigned if either is; a
+// float operand makes both floats.
+Value Evaluator::arithmetic (Operator op, Value l, Value r, ExprId at) {
+    if (op == Operator::Equal && l.kind == Value::String && r.kind == Value::String) {
+        // Interned, so equal text is an equal symbol.
+        return Value::integer(l.data == r.data);
+    }
+    if (!l.numeric() || !r.numeric()) {
+        error(Diag::CompConvert, at, ValueNames[l.numeric() ? r.kind : l.kind], Token::Int);
+        return {};
+    }
+
+    if (l.kind == Value::Float || r.kind == Value::Float) {
+        auto a = l.as_real(), b = r.as_real();
+        switch (op) {
+        case Operator::Add:             return Value::real(a + b);
+        case Operator::Subtract:        return Value::real(a - b);
+        case Operator::Multiply:        return Value::real(a * b);
+        case Operator::Divide:          return Value::real(a / b);
+        case Operator::Lesser:          return Value::integer(a < b);
+        case Operator::Greater:         return Value::integer(a > b);
+        case Operator::LessEqual:       return Value::integer(a <= b);
+        case Operator::GreaterEqual:    return Value::integer(a >= b);
+        case Operator::Equal:           return Value::integer(a == b);
+        default:
+            error(Diag::CompConvert, at, ValueNames[Value::Float], Token::Int);
+            return {};
+        }
+    }
+
+    auto a = l.data, b = r.data;
+    bool wide = l.is_unsigned() || r.is_unsigned();
+    auto result = [&](uint64_t n) { return wide ? Value::unsigned_integer(n) : Value::integer(static_cast<int64_t>(n)); };
+    switch (op) {
+    case Operator::Add:             return result(a + b);
+    case Operator::Subtract:        return result(a - b);
+    case Operator::Multiply:        return result(a * b);
+    case Operator::Divide:
+        if (b == 0) {
+            error(Diag::CompDivide, at);
+            return {};
+        }
+        if (wide) {
+            return result(a / b);
+        }
+        // The one quotient that overflows wraps like the rest.
+        if (r.as_int() == -1) {
+            return Value::integer(static_cast<int64_t>(0 - a));
+        }
+        return Value::integer(l.as_int() / r.as_int());
+    case Operator::Lesser:          return Value::integer(wide ? a < b : l.as_int() < r.as_int());
+    case Operator::Greater:         return Value::integer(wide ? a > b : l.as_int() > r.as_int());
+    case Operator::LessEqual:       return Value::integer(wide ? a <= b : l.as_int() <= r.as_int());
+    case Operator::GreaterEqual:    return Value::integer(wide ? a >= b : l.as_int() >= r.as_int());
+    case Operator::Equal:           return Value::integer(a == b);
+    case Operator::BitwiseAnd:      return result(a & b);
+    case Operator::BitwiseXor:      return result(a ^ b);
+    case Operator::BitwiseOr:       return result(a | b);
+    default:
+        error(Diag::CompUnsupported, at, OperatorTable[op].name.data());
+        return {};
+    }
+}
+
+Value Evaluator::unary (ExprId id) {
+    auto op = ast[id].op;
+    auto operand = ast.children(id)[0];
+
+    if (op == Operator::PreIncrement || op == Operator::PostIncrement) {
+        Token::Type type;
+        auto slot = place(operand, type);
+        if (!slot) {
+            return {};
+        }
+        if (slot->kind != Value::Int) {
+            error(Diag::CompConvert, operand, ValueNames[slot->kind], Token::Int);
+            return {};
+        }
+        auto old = *slot;
+        *slot = narrow(Value::integer(static_cast<int64_t>(old.data + 1)), type, operand);
+        return op == Operator::PreIncrement ? *slot : old;
+    }
+    if (op == Operator::LogicalNot) {
+        auto t = truth(operand);
+        return Value::integer(!t);
+    }
+
+    auto v = eval(operand);
+    if (failed) {
+        return {};
+    }
+    switch (op) {
+    case Operator::Negate:
+        if (v.kind == Value::Float) {
+            return Value::real(-v.as_real());
+        }
+        if (v.kind == Value::Int) {
+            return {Value::Int, false, v.element, 0, 0 - v.data};
+        }
+        break;
+    case Operator::BitwiseNot:
+        if (v.kind == Value::Int) {
+            return {Value::Int, false, v.element, 0, ~v.data};
+        }
+        break;
+    default:
+        error(Diag::CompUnsupported, id, OperatorTable[op].name.data());
+        return {};
+    }
+    error(Diag::CompConvert, operand, ValueNames[v.kind], Token::Int);
+    return {};
+}
+
+Value Evaluator::binary (ExprId id) {
+    auto op = ast[id].op;
+    auto parts = ast.children(id);
+
+    switch (op) {
+    case Operator::LogicalAnd: {
+        auto t = truth(parts[0]) && truth(parts[1]);
+        return Value::integer(t);
+    }
+    case Operator::LogicalOr: {
+        auto t = truth(parts[0]) || truth(parts[1]);
+        return Value::integer(t);
+    }
+    case Operator::Comma:
+        eval(parts[0]);
+        return eval(parts[1]);
+    case Operator::Assign:
+    case Operator::AddAssign:
+    case Operator::SubtractAssign:
+    case Operator::MultiplyAssign:
+    case Operator::DivideAssign:
+        return assign(id);
+    case Operator::Index: {
+        auto array = eval(parts[0]);
+        auto at = eval(parts[1]);
+        if (failed) {
+            return {};
+        }
+        if (array.kind != Value::Array || at.kind != Value::Int) {
+            error(Diag::CompConvert, id, ValueNames[array.kind == Value::Array ? at.kind : array.kind], Token::Int);
+            return {};
+        }
+        if (at.data >= array.count) {
+            error(Diag::CompIndex, parts[1], at.as_int(), static_cast<int64_t>(array.count));
+            return {};
+        }
+        return heap[array.data + at.data];
+    }
+    case Operator::Member:
+        error(Diag::CompUnsupported, id, OperatorTable[op].name.data());
+        return {};
+    default:
+        break;
+    }
+
+    auto l = eval(parts[0]);
+    auto r = eval(parts[1]);
+    if (failed) {
+        return {};
+    }
+    return arithmetic(op, l, r, id);
+}
+
+// The value is worked out before the slot is looked up, since evaluating it
+// may move the heap and the locals.
+Value Evaluator::assign (ExprId id) {
+    auto op = ast[id].op;
+    auto parts = ast.children(id);
+
+    auto v = eval(parts[1]);
+    if (failed) {
+        return {};
+    }
+    Token::Type type;
+    auto slot = place(parts[0], type);
+    if (!slot) {
+        return {};
+    }
+
+    switch (op) {
+    case Operator::AddAssign:       v = arithmetic(Operator::Add, *slot, v, id);       break;
+    case Operator::SubtractAssign:  v = arithmetic(Operator::Subtract, *slot, v, id);  break;
+    case Operator::MultiplyAssign:  v = arithmetic(Operator::Multiply, *slot, v, id);  break;
+    case Operator::DivideAssign:    v = arithmetic(Operator::Divide, *slot, v, id);    break;
+    default:
+        break;
+    }
+    if (failed) {
+        return {};
+    }
+    if (slot->kind != Value::Void && (slot->kind == Value::String) != (v.kind == Value::String)) {
+        error(Diag::CompConvert, parts[1], ValueNames[v.kind], type == Token::Unknown ? Token::Int : type);
+        return {};
+    }
+    *slot = narrow(v, type, parts[1]);
+    return *slot;
+}
+
+// `sizeof` of a local or comp variable, in bytes on the target.
+Value Evaluator::size_of (ExprId id) {
+    auto parts = ast.children(id);
+    if (parts.size() != 2 || ast[parts[1]].type != Expression::Identifier) {
+        error(Diag::CompArguments, id, sizeof_name);
+        return {};
+    }
+    auto name = ast.symbol(parts[1]);
+    const Shape *shape = nullptr;
+    if (auto slot = local(name)) {
+        shape = &slot->shape;
+    } else if (auto slot = global(name, parts[1])) {
+        shape = &slot->shape;
+    }
+    if (failed) {
+        return {};
+    }
+    if (!shape || shape->element == Token::Unknown) {
+        error(Diag::CompConstant, parts[1], name);
+        return {};
+    }
+    return Value::integer(static_cast<int64_t>(element_size(shape->element) * shape->elements()));
+}
+
+Value Evaluator::call (ExprId id) {
+    auto parts = ast.children(id);
+    if (ast[parts[0]].type != Expression::Identifier) {
+        error(Diag::CompUnsupported, id, to_string(ast[id].type).data());
+        return {};
+    }
+    auto name = ast.symbol(parts[0]);
+    auto it = functions.find(static_cast<uint32_t>(name));
+    if (it == functions.end()) {
+        if (name == sizeof_name) {
+            return size_of(id);
+        }
+        error(Diag::CompConstant, parts[0], name);
+        return {};
+    }
+    auto fn = it->second;
+    auto decl = ast.children(fn);
+    if (decl.size() - 3 != parts.size() - 1) {
+        error(Diag::CompArguments, id, name);
+        return {};
+    }
+    if (ast[decl[2]].type != Expression::Block) {
+        error(Diag::CompConstant, parts[0], name);
+        return {};
+    }
+
+    auto base = args.size();
+    bool pure = true;
+    for (std::size_t i = 1; i < parts.size() && !failed; i++) {
+        auto v = eval(parts[i]);
+        pure &= v.kind != Value::Array;
+        args.push_back(v);
+    }
+    if (failed) {
+        args.resize(base);
+        return {};
+    }
+
+    // Arrays may be written through, so only calls on scalars are memoized.
+    std::string key;
+    if (pure) {
+        key.resize(sizeof(uint32_t) + (args.size() - base) * 9);
+        auto out = key.data();
+        std::memcpy(out, &fn.id, sizeof(uint32_t));
+        out += sizeof(uint32_t);
+        for (auto i = base; i < args.size(); i++) {
+            *out++ = static_cast<char>(args[i].kind);
+            std::memcpy(out, &args[i].data, 8);
+            out += 8;
+        }
+        if (auto hit = memo.find(key); hit != memo.end()) {
+            data.memoized++;
+            args.resize(base);
+            return hit->second;
+        }
+    }
+    if (depth >= limits.depth) {
+        error(Diag::CompDepth, id, static_cast<int64_t>(limits.depth));
+        args.resize(base);
+        return {};
+    }
+    data.calls++;
+
+    auto saved = frame;
+    auto mark = heap.size();
+    auto done = finished;
+    frame = locals.size();
+    depth++;
+    for (std::size_t i = 0; i < decl.size() - 3 && !failed; i++) {
+        auto param = ast.children(decl[3 + i]);
+        Local slot{ast.symbol(param[1]), args[base + i], {}};
+        if (resolve(param[0], slot.shape)) {
+            if (slot.shape.rank == 0) {
+                slot.value = convert(slot.value, slot.shape.element, parts[1 + i]);
+                slot.value = narrow(slot.value, slot.shape.element, parts[1 + i]);
+            } else if (slot.value.kind != Value::Array) {
+                error(Diag::CompConvert, parts[1 + i], ValueNames[slot.value.kind], slot.shape.element);
+            }
+        }
+        locals.push_back(slot);
+    }
+    args.resize(base);
+
+    Value result;
+    if (!failed) {
+        auto flow = exec(decl[2]);
+        Shape type;
+        if (!failed && resolve(decl[1], type)) {
+            if (ast[decl[1]].type == Expression::Null) {
+                result = {};
+            } else if (flow != Flow::Return || returned.kind == Value::Void) {
+                error(Diag::CompReturn, id, name);
+            } else {
+                result = narrow(convert(returned, type.element, id), type.element, id);
+            }
+        }
+    }
+
+    locals.resize(frame);
+    frame = saved;
+    depth--;
+    // Nothing a scalar result refers to survives the call.
+    if (result.kind != Value::Array && finished == done) {
+        heap.resize(mark);
+    }
+    if (pure && !failed && result.kind != Value::Array) {
+        memo.emplace(std::move(key), result);
+    }
+    return result;
+}
+
+Value Evaluator::eval (ExprId id) {
+    if (!tick(id)) {
+        return {};
+    }
+    auto &expr = ast[id];
+    switch (expr.type) {
+    case Expression::Integer:
+        // Past INT64_MAX only u64 holds it, as C types such a literal.
+        if (ast.literal(id) > INT64_MAX) {
+            return Value::unsigned_integer(ast.literal(id));
+        }
+        return Value::integer(static_cast<int64_t>(ast.literal(id)));
+    case Expression::Character:
+    case Expression::Ipv4:
+    case Expression::Color:
+        return Value::integer(static_cast<int64_t>(ast.literal(id)));
+    case Expression::Float:
+        return {Value::Float, false, Token::Unknown, 0, ast.literal(id)};
+    case Expression::String:
+        return {Value::String, false, Token::Unknown, 0, static_cast<uint64_t>(ast.symbol(id))};
+    case Expression::Identifier: {
+        auto name = ast.symbol(id);
+        if (auto slot = local(name)) {
+            return slot->value;
+        }
+        if (auto slot = global(name, id)) {
+            return slot->value;
+        }
+        error(Diag::CompConstant, id, name);
+        return {};
+    }
+    case Expression::List: {
+        auto items = ast.children(id);
+        auto base = allocate(items.size(), id);
+        for (std::size_t i = 0; i < items.size() && !failed; i++) {
+            auto item = eval(items[i]);
+            heap[base + i] = item;
+        }
+        return {Value::Array, false, Token::Unknown, static_cast<uint32_t>(items.size()), base};
+    }
+    case Expression::Unary:
+        return unary(id);
+    case Expression::Binary:
+        return binary(id);
+    case Expression::Call:
+        return call(id);
+    default:
+        error(Diag::CompUnsupported, id, to_string(expr.type).data());
+        return {};
+    }
+}
+
+void Evaluator::declare (ExprId decl) {
+    auto parts = ast.children(decl);
+    Local slot{ast.symbol(parts[1]), {}, {}};
+    if (!resolve(parts[0], slot.shape)) {
+        return;
+    }
+    if (ast[parts[2]].type == Expression::Null) {
+        if (slot.shape.element == Token::Unknown) {
+            error(Diag::CompConstant, parts[1], slot.name);
+            return;
+        }
+        for (uint32_t i = 0; i < slot.shape.rank; i++) {
+            if (!slot.shape.dims[i]) {
+                error(Diag::CompSize, parts[0]);
+                return;
+            }
+        }
+        slot.value = zero(slot.shape, 0, decl);
+    } else {
+        auto v = eval(parts[2]);
+        if (failed) {
+            return;
+        }
+        // Scalar `var` locals keep whatever is assigned to them.
+        if (slot.shape.element == Token::Unknown && (slot.shape.rank || v.kind == Value::Array)) {
+            infer(v, slot.shape);
+        }
+        slot.value = store(v, slot.shape, 0, parts[2]);
+    }
+    locals.push_back(slot);
+}
+
+// Runs a statement. A failure unwinds as a return.
+Evaluator::Flow Evaluator::exec (ExprId id) {
+    if (!tick(id)) {
+        return Flow::Return;
+    }
+    auto &expr = ast[id];
+    auto parts = ast.children(id);
+    switch (expr.type) {
+    case Expression::Block: {
+        auto mark = locals.size();
+        auto flow = Flow::Next;
+        for (auto statement: parts) {
+            flow = exec(statement);
+            if (flow != Flow::Next) {
+                break;
+            }
+        }
+        locals.resize(mark);
+        return flow;
+    }
+    case Expression::Variable:
+        declare(id);
+        return failed ? Flow::Return : Flow::Next;
+    case Expression::If: {
+        auto t = truth(parts[0]);
+        if (failed) {
+            return Flow::Return;
+        }
+        return exec(t ? parts[1] : parts[2]);
+    }
+    case Expression::For: {
+        auto mark = locals.size();
+        auto flow = Flow::Next;
+        if (ast[parts[0]].type == Expression::Variable) {
+            declare(parts[0]);
+        } else if (ast[parts[0]].type != Expression::Null) {
+            eval(parts[0]);
+        }
+        while (!failed && (ast[parts[1]].type == Expression::Null || truth(parts[1]))) {
+            flow = exec(parts[3]);
+            if (flow == Flow::Break || flow == Flow::Return) {
+                break;
+            }
+            flow = Flow::Next;
+            if (ast[parts[2]].type != Expression::Null) {
+                eval(parts[2]);
+            }
+        }
+        locals.resize(mark);
+        return failed || flow == Flow::Return ? Flow::Return : Flow::Next;
+    }
+    case Expression::Return:
+        returned = parts.empty() ? Value{} : eval(parts[0]);
+        return Flow::Return;
+    case Expression::Break:
+        return Flow::Break;
+    case Expression::Continue:
+        return Flow::Continue;
+    case Expression::Null:
+        return Flow::Next;
+    default:
+        eval(id);
+        return failed ? Flow::Return : Flow::Next;
+    }
+}
+
+void Evaluator::index (ExprId decl) {
+    auto &expr = ast[decl];
+    auto name = declared_name(ast, decl);
+    if (!name || ast[name].type != Expression::Identifier) {
+        return;
+    }
+    auto key = static_cast<uint32_t>(ast.symbol(name));
+    if (expr.type == Expression::Function) {
+        functions[key] = decl;
+    } else if (expr.type == Expression::Variable && (expr.flags & Modifier::Comp)) {
+        globals[key] = {decl, Global::Pending, {}, {}};
+    }
+}
+
+void Evaluator::flatten (Value v, const Shape &shape, uint32_t level, uint8_t *&out) {
+    if (level < shape.rank) {
+        for (uint32_t i = 0; i < v.count; i++) {
+            flatten(heap[v.data + i], shape, level + 1, out);
+        }
+        return;
+    }
+    auto bits = v.data;
+    if (shape.element == Token::F32) {
+        bits = std::bit_cast<uint32_t>(static_cast<float>(v.as_real()));
+    }
+    auto size = element_size(shape.element);
+    for (uint32_t b = 0; b < size; b++) {
+        *out++ = static_cast<uint8_t>(bits >> (8 * b));
+    }
+}
+
+void Evaluator::emit (Symbol name, const Global &global) {
+    auto size = element_size(global.shape.element);
+    auto count = global.shape.elements();
+    auto offset = (data.bytes.size() + size - 1) / size * size;
+
+    ConstTable table{name, global.shape.element, global.shape.rank, static_cast<uint32_t>(data.dims.size()),
+        static_cast<uint32_t>(count), static_cast<uint32_t>(offset)};
+    data.dims.insert(data.dims.end(), global.shape.dims, global.shape.dims + global.shape.rank);
+    data.bytes.resize(offset + count * size);
+    auto out = data.bytes.data() + offset;
+    flatten(global.value, global.shape, 0, out);
+    data.tables.push_back(table);
+}
+
+// Appends the scalars `values[0]`, `values[stride]`... as one column.
+void Evaluator::column (Symbol name, Token::Type element, std::span<const Value> values, std::size_t stride) {
+    auto size = element_size(element);
+    auto count = (values.size() + stride - 1) / stride;
+    auto offset = (data.bytes.size() + size - 1) / size * size;
+
+    ConstTable table{name, element, 1, static_cast<uint32_t>(data.dims.size()),
+        static_cast<uint32_t>(count), static_cast<uint32_t>(offset)};
+    data.dims.push_back(static_cast<uint32_t>(count));
+    data.bytes.resize(offset + count * size);
+    auto out = data.bytes.data() + offset;
+    Shape scalar{element, 0, {}};
+    for (std::size_t i = 0; i < count; i++) {
+        flatten(values[i * stride], scalar, 0, out);
+    }
+    data.columns.push_back(table);
+
+    // Hashed when no two values are alike.
+    tagged_vector<uint64_t, Subsystem::Comp> keys(count);
+    for (std::size_t i = 0; i < count; i++) {
+        keys[i] = data.key(table, i, interner);
+    }
+    auto &hash = data.hashes.emplace_back();
+    if (count) {
+        hash.build(keys);
+    }
+}
+
+// Evaluates the initializers of every entry, which must all give the same
+// number of values. A column takes the type of its first value.
+void Evaluator::enumerate (ExprId decl) {
+    auto parts = ast.children(decl);
+    auto name = ast.symbol(parts[0]);
+    auto entries = parts.subspan(2);
+
+    std::size_t width = 0;
+    tagged_vector<Value, Subsystem::Comp> values;
+    tagged_vector<Token::Type, Subsystem::Comp> types;
+    for (std::size_t e = 0; e < entries.size() && !failed; e++) {
+        auto entry = ast.children(entries[e]);
+        values.push_back({Value::String, false, Token::Unknown, 0, static_cast<uint64_t>(ast.symbol(entry[1]))});
+
+        auto init = entry[2];
+        auto row = values.size();
+        if (ast[init].type == Expression::List) {
+            for (auto item: ast.children(init)) {
+                auto v = eval(item);
+                values.push_back(v);
+            }
+        } else if (ast[init].type != Expression::Null) {
+            auto v = eval(init);
+            values.push_back(v);
+        }
+        if (failed) {
+            break;
+        }
+
+        auto given = values.size() - row;
+        if (e == 0) {
+            width = given;
+            for (auto i = row; i < values.size(); i++) {
+                Shape shape;
+                infer(values[i], shape);
+                if (shape.rank) {
+                    error(Diag::CompUnsupported, init, ValueNames[Value::Array]);
+                }
+                types.push_back(shape.element);
+            }
+        } else if (given != width) {
+            error(Diag::EnumValues, ast[init].type == Expression::Null ? entries[e] : init,
+                static_cast<int64_t>(given), static_cast<int64_t>(width));
+        }
+        for (std::size_t i = 0; i < given && !failed; i++) {
+            values[row + i] = convert(values[row + i], types[i], init);
+        }
+    }
+    if (failed) {
+        return;
+    }
+
+    auto stride = width + 1;
+    data.enums.push_back({name, static_cast<uint32_t>(entries.size()),
+        static_cast<uint32_t>(data.columns.size()), static_cast<uint32_t>(stride)});
+    column(name, Token::String, values, stride);
+    for (std::size_t i = 0; i < width; i++) {
+        column(name, types[i], std::span(values).subspan(i + 1), stride);
+    }
+}
+
+ConstData Evaluator::run (ExprId unit, std::span<const ExprId> imported) {
+    for (auto decl: imported) {
+        index(decl);
+    }
+    auto decls = ast.children(unit);
+    for (auto decl: decls) {
+        index(decl);
+    }
+
+    for (auto decl: decls) {
+        auto &expr = ast[decl];
+        bool comp = expr.type == Expression::Variable && (expr.flags & Modifier::Comp);
+        if (!comp && expr.type != Expression::Enum) {
+            continue;
+        }
+        auto name = ast.symbol(declared_name(ast, decl));
+        // Each declaration gets the whole step and memory budget, but the
+        // ones it pulls in count against it.
+        data.steps += steps;
+        steps = 0;
+        charged = heap.size();
+        failed = false;
+        if (!comp) {
+            enumerate(decl);
+        } else if (auto slot = global(name, decl)) {
+            emit(name, *slot);
+        }
+        locals.clear();
+        args.clear();
+        depth = 0;
+    }
+    data.steps += steps;
+    return std::move(data);
+}
+
+// Renders `table` as a declaration, for dumps and tests.
+void print (const ConstData &data, const ConstTable &table, std::string &out,
+            const Interner &interner = global_interner()) {
+    // Floats have no keyword yet, so they are only named here.
+    switch (table.element) {
+    case Token::String: out += "u8* ";                           break;
+    case Token::F32:    out += "f32 ";                           break;
+    case Token::F64:    out += "f64 ";                           break;
+    default:            out += to_string(table.element); out += ' '; break;
+    }
+    out += interner.name(table.name);
+    for (auto dim: data.shape(table)) {
+        out += std::format("[{}]", dim);
+    }
+    out += " = ";
+
+    auto dims = data.shape(table);
+    std::size_t i = 0;
+    auto element = [&] {
+        auto bits = data.element(table, i++);
+        if (table.element == Token::String) {
+            out += '"';
+            out += interner.name(static_cast<Symbol>(bits));
+            out += '"';
+        } else if (is_float(table.element)) {
+            char buf[32];
+            auto end = std::to_chars(buf, buf + sizeof(buf), std::bit_cast<double>(bits)).ptr;
+            out.append(buf, end);
+        } else if (is_signed(table.element)) {
+            out += std::to_string(static_cast<int64_t>(bits));
+        } else {
+            out += std::to_string(bits);
+        }
+    };
+    auto nest = [&](auto &self, uint32_t level) -> void {
+        if (level == dims.size()) {
+            element();
+            return;
+        }
+        out += '{';
+        for (uint32_t n = 0; n < dims[level]; n++) {
+            out += n ? ", " : "";
+            self(self, level + 1);
+        }
+        out += '}';
+    };
+    nest(nest, 0);
+}
+
+// Renders the columns of `e` as declarations, one per line, each noting the
+// size of its hash table if it has one.
+void print (const ConstData &data, const ConstEnum &e, std::string &out,
+            const Interner &interner = global_interner()) {
+    for (auto c = e.column; c < e.column + e.columns; c++) {
+        print(data, data.columns[c], out, interner);
+        auto &hash = data.hashes[c];
+        out += hash.empty() ? ";  # not hashed\n" : std::format(";  # hashed into {} slots\n", hash.slots);
+    }
+}
+
+}
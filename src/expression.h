@@ -1,23 +1,54 @@
 #pragma once
 
-#include <unordered_map>
-#include <variant>
-#include <vector>
+#include <span>
 #include <string_view>
 
 #include "memory.h"
+#include "arena.h"
 #include "stream.h"
 #include "utils.h"
 
 namespace lain {
 
-enum Operator {
+enum Operator : uint8_t {
+    // Prefix
     Address,
     Dereference,
-    BinaryAdd,
+    Negate,
+    LogicalNot,
+    BitwiseNot,
+    PreIncrement,
+
+    // Postfix
+    PostIncrement,
+    Call,
+    Index,
+    Member,
+
+    // Binary
+    Multiply,
+    Divide,
+    Add,
+    Subtract,
+    Lesser,
+    Greater,
+    LessEqual,
+    GreaterEqual,
+    Equal,
+    BitwiseAnd,
+    BitwiseXor,
+    BitwiseOr,
+    LogicalAnd,
+    LogicalOr,
+    Assign,
+    AddAssign,
+    SubtractAssign,
+    MultiplyAssign,
+    DivideAssign,
+    Comma,
+
+    // Grouping parenthesis, only ever held on the parser stack.
     OpenParen,
-    CloseParen,
-    Comma
 };
 
 struct OperatorInfo {
@@ -38,150 +69,478 @@ struct OperatorInfo {
     uint precedence;
 };
 
-constexpr OperatorInfo OperatorTable[] = {
-    {Operator::Address,        Token::Ampersand,     "address",      OperatorInfo::Prefix, 10},
-    {Operator::Dereference,    Token::Mul,           "dereference",  OperatorInfo::Prefix, 10},
-    {Operator::BinaryAdd,      Token::Add,           "binary add",   OperatorInfo::LBinary, 1},
-    {Operator::Comma,          Token::Comma,         "comma",        OperatorInfo::LBinary, 1},
-};
+// Indexed by Operator. Higher precedence binds tighter.
+constexpr auto OperatorTable = array_make<OperatorInfo>({
+    {Operator::Address,         Token::Ampersand,   "address",          OperatorInfo::Prefix,   13},
+    {Operator::Dereference,     Token::Mul,         "dereference",      OperatorInfo::Prefix,   13},
+    {Operator::Negate,          Token::Sub,         "negate",           OperatorInfo::Prefix,   13},
+    {Operator::LogicalNot,      Token::LogNot,      "logical not",      OperatorInfo::Prefix,   13},
+    {Operator::BitwiseNot,      Token::Tilde,       "bitwise not",      OperatorInfo::Prefix,   13},
+    {Operator::PreIncrement,    Token::Increment,   "pre increment",    OperatorInfo::Prefix,   13},
 
-const OperatorInfo *get_unary_mode_op (const Token::Type type) {
-    static const auto map = []{
-        std::unordered_map<Token::Type, const OperatorInfo*> m;
-        for (const auto &entry: OperatorTable) {
-            if (entry.type == OperatorInfo::Category::Prefix) {
-                m.emplace(entry.token, &entry);
-            }
+    {Operator::PostIncrement,   Token::Increment,   "post increment",   OperatorInfo::Postfix,  14},
+    {Operator::Call,            Token::LParen,      "call",             OperatorInfo::Postfix,  14},
+    {Operator::Index,           Token::LBracket,    "index",            OperatorInfo::Postfix,  14},
+    {Operator::Member,          Token::Dot,         "member",           OperatorInfo::Postfix,  14},
+
+    {Operator::Multiply,        Token::Mul,         "multiply",         OperatorInfo::LBinary,  12},
+    {Operator::Divide,          Token::Div,         "divide",           OperatorInfo::LBinary,  12},
+    {Operator::Add,             Token::Add,         "add",              OperatorInfo::LBinary,  11},
+    {Operator::Subtract,        Token::Sub,         "subtract",         OperatorInfo::LBinary,  11},
+    {Operator::Lesser,          Token::Lesser,      "lesser",           OperatorInfo::LBinary,  10},
+    {Operator::Greater,         Token::Greater,     "greater",          OperatorInfo::LBinary,  10},
+    {Operator::LessEqual,       Token::LessEq,      "less equal",       OperatorInfo::LBinary,  10},
+    {Operator::GreaterEqual,    Token::GreatEq,     "greater equal",    OperatorInfo::LBinary,  10},
+    {Operator::Equal,           Token::Equals,      "equal",            OperatorInfo::LBinary,  9},
+    {Operator::BitwiseAnd,      Token::Ampersand,   "bitwise and",      OperatorInfo::LBinary,  8},
+    {Operator::BitwiseXor,      Token::Caret,       "bitwise xor",      OperatorInfo::LBinary,  7},
+    {Operator::BitwiseOr,       Token::VBar,        "bitwise or",       OperatorInfo::LBinary,  6},
+    {Operator::LogicalAnd,      Token::LogAnd,      "logical and",      OperatorInfo::LBinary,  5},
+    {Operator::LogicalOr,       Token::LogOr,       "logical or",       OperatorInfo::LBinary,  4},
+    {Operator::Assign,          Token::Assign,      "assign",           OperatorInfo::RBinary,  2},
+    {Operator::AddAssign,       Token::AddEq,       "add assign",       OperatorInfo::RBinary,  2},
+    {Operator::SubtractAssign,  Token::SubEq,       "subtract assign",  OperatorInfo::RBinary,  2},
+    {Operator::MultiplyAssign,  Token::MulEq,       "multiply assign",  OperatorInfo::RBinary,  2},
+    {Operator::DivideAssign,    Token::DivEq,       "divide assign",    OperatorInfo::RBinary,  2},
+    {Operator::Comma,           Token::Comma,       "comma",            OperatorInfo::LBinary,  1},
+
+    {Operator::OpenParen,       Token::LParen,      "group",            OperatorInfo::Atom,     0},
+});
+
+// Maps each token type to the OperatorTable entry it starts in one parser
+// mode, before an operand (prefix) or after one (binary and postfix).
+consteval auto index_operators (bool prefix) {
+    std::array<int8_t, TypeSpan> index{};
+    index.fill(-1);
+    for (std::size_t i = 0; i < OperatorTable.size(); i++) {
+        auto &info = OperatorTable[i];
+        if (info.type != OperatorInfo::Atom && (info.type == OperatorInfo::Prefix) == prefix) {
+            index[info.token] = static_cast<int8_t>(i);
         }
-        return m;
-    }();
-    auto it = map.find(type);
-    if (it == map.end()) {
-        return nullptr;
     }
-    return it->second;
+    return index;
+}
+
+static constexpr auto PrefixOperators = index_operators(true);
+static constexpr auto InfixOperators = index_operators(false);
+
+consteval bool valid_operator_table () {
+    for (std::size_t i = 0; i < OperatorTable.size(); i++) {
+        if (OperatorTable[i].op != i) {
+            return false;
+        }
+    }
+    for (auto &info: reserved) {
+        if ((info.categories & Category::Operator) &&
+            PrefixOperators[info.type] < 0 && InfixOperators[info.type] < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(valid_operator_table(), "OperatorTable must be ordered and cover every operator token");
+
+constexpr const OperatorInfo *get_unary_mode_op (const Token::Type type) {
+    auto i = PrefixOperators[type];
+    return i < 0 ? nullptr : &OperatorTable[i];
+}
+
+constexpr const OperatorInfo *get_binary_mode_op (const Token::Type type) {
+    auto i = InfixOperators[type];
+    return i < 0 ? nullptr : &OperatorTable[i];
 }
 
 struct Expression;
 
-using Binary = std::pair<uptr<Expression>, uptr<Expression>>;
-using List = std::vector<uptr<Expression>>;
+using ExprId = Handle<Expression>;
 
-using Value = std::variant <
-    Binary,
-    List,
-    uptr<Expression>,
-    std::size_t,
-    std::string,
-    std::nullptr_t
->;
+namespace Modifier {
+    enum Modifier : uint16_t {
+        None        = 0,
+        Protected   = 1 << 0,
+        Private     = 1 << 1,
+        Static      = 1 << 2,
+        Const       = 1 << 3,
+        Comp        = 1 << 4,
+        Unsafe      = 1 << 5,
+        Unique      = 1 << 6,
+        Debug       = 1 << 7,
+    };
+}
 
+// Fixed 16 byte node. What `data` holds depends on the type: nodes with
+// operands own `count` handles starting at `data` in the edge array of their
+// Ast, numeric literals index its literal table, and names and strings carry their
+// Symbol inline. Only the header is ever touched to dispatch on a node.
 struct Expression {
-    enum Type {
+    enum Type : uint8_t {
         String,
         Integer,
         Character,
+        Float,
+        Ipv4,
+        Color,
         Identifier,
         List,
         Null,
         Call,
+        Unary,
+        Binary,
+
+        // Types
+        Builtin,
+        Pointer,
+        Array,
+
+        // Statements and declarations
+        Block,
+        If,
+        For,
+        Return,
+        Break,
+        Continue,
+        Variable,
+        Function,
+        Struct,
+        Enum,
+        Module,
+        Import,
+        Unit,
     } type;
 
-    Value value;
+    Operator op;
+
+    // Declaration modifiers, see Modifier.
+    uint16_t flags;
+
+    Loc loc;
 
-    Expression (const Token &token);
+    uint32_t data;
+    uint32_t count;
+};
 
-    Expression (lain::List list) : type(List), value(std::move(list)) {}
+static_assert(sizeof(Expression) == 16);
 
-    Expression (Type type, Expression *lhs, Expression *rhs) : type(type), value(Binary{lhs, rhs}) {}
+constexpr std::string_view ExpressionNames[] = {
+    "string", "integer", "character", "float", "ipv4", "color", "identifier", "list", "null", "call", "unary", "binary",
+    "builtin", "pointer", "array",
+    "block", "if", "for", "return", "break", "continue", "variable", "function", "struct", "enum",
+    "module", "import", "unit",
 };
 
-Expression::Expression (const Token &token) {
+static_assert(std::size(ExpressionNames) == Expression::Unit + 1);
+
+constexpr std::string_view to_string (Expression::Type type) {
+    return ExpressionNames[type];
+}
+
+// Storage for the expressions of one compilation unit. Nodes are appended in
+// the order the parser completes them and the operands of each node sit next
+// to each other, so a walk over the tree reads all three arrays front to back.
+// The whole tree is released at once with the Ast.
+struct Ast {
+    Arena<Expression> nodes{Subsystem::Ast};
+    Arena<ExprId> edges{Subsystem::Ast};
+    Arena<uint64_t> literals{Subsystem::Ast};
+
+    ExprId leaf (const Token &token, Loc loc);
+
+    ExprId node (Expression::Type type, Operator op, Loc loc, std::span<const ExprId> operands);
+
+    Expression &operator[] (ExprId id) { return nodes[id]; }
+    const Expression &operator[] (ExprId id) const { return nodes[id]; }
+
+    std::span<const ExprId> children (ExprId id) const {
+        auto &expr = nodes[id];
+        return edges.span({expr.data}, expr.count);
+    }
+
+    uint64_t literal (ExprId id) const { return literals[{nodes[id].data}]; }
+
+    Symbol symbol (ExprId id) const { return static_cast<Symbol>(nodes[id].data); }
+
+    std::size_t bytes () const { return nodes.bytes() + edges.bytes() + literals.bytes(); }
+
+    // Drops the whole tree, keeping the arenas for the next unit.
+    void clear () {
+        nodes.clear();
+        edges.clear();
+        literals.clear();
+    }
+};
+
+ExprId Ast::leaf (const Token &token, Loc loc) {
     switch (token.type) {
     case Token::String:
-        type = Expression::String;
-        value = token.str;
-        break;
+        return nodes.make(Expression::String, Operator{}, uint16_t{0}, loc, static_cast<uint32_t>(token.sym), 0u);
     case Token::Integer:
-        type = Expression::Integer;
-        value = token.num;
-        break;
+        return nodes.make(Expression::Integer, Operator{}, uint16_t{0}, loc, literals.make(token.num).id, 0u);
+    case Token::Character:
+        return nodes.make(Expression::Character, Operator{}, uint16_t{0}, loc, literals.make(token.num).id, 0u);
+    case Token::Float:
+        return nodes.make(Expression::Float, Operator{}, uint16_t{0}, loc, literals.make(token.num).id, 0u);
+    case Token::Ipv4:
+        return nodes.make(Expression::Ipv4, Operator{}, uint16_t{0}, loc, literals.make(token.num).id, 0u);
+    case Token::Color:
+        return nodes.make(Expression::Color, Operator{}, uint16_t{0}, loc, literals.make(token.num).id, 0u);
     case Token::Identifier:
-        type = Expression::Identifier;
-        value = token.str;
-        break;
+        return nodes.make(Expression::Identifier, Operator{}, uint16_t{0}, loc, static_cast<uint32_t>(token.sym), 0u);
     default:
         panic("Cannot express value type {}", to_string(token.type));
-        break;
+        return {};
     }
 }
 
+ExprId Ast::node (Expression::Type type, Operator op, Loc loc, std::span<const ExprId> operands) {
+    auto first = edges.append(operands);
+    return nodes.make(type, op, uint16_t{0}, loc, first.id, static_cast<uint32_t>(operands.size()));
+}
+
+// Operator precedence parser over OperatorTable. Operands and pending
+// operators wait on fixed-size stacks, and an operator is applied as soon as
+// one of lower precedence arrives, so each node is built exactly once, after
+// its operands. The expression ends at the first token that cannot continue
+// it, which is left in the stream.
 class ExpressionParser {
+    static constexpr std::size_t Depth = 256;
+
+    struct Pending {
+        Operator op;
+        Loc loc;
+    };
+
     TokenStream &stream;
+    Ast &ast;
 
-    std::vector<Expression*> operands;
-    std::vector<Operator> operators;
+    // Whether a comma outside any bracket is the comma operator, rather than
+    // the end of the expression as in argument and initializer lists.
+    bool commas;
+
+    Stack<ExprId, Depth> operands;
+    Stack<Pending, Depth> operators;
+    // Arguments seen so far by each open call, innermost last.
+    Stack<uint32_t, Depth> arity;
 
     enum class State {
         Binary,
         Unary,
     } state = State::Unary;
 
-    void pop_and_push_bin (Expression::Type type, Expression *rhs) {
-        // TODO: Child expr order could impact left-right associative, investigate.
-        if (operands.empty()) {
+    static bool is_bracket (Operator op) {
+        return op == Operator::OpenParen || op == Operator::Call || op == Operator::Index;
+    }
+
+    void push_operand (ExprId expr) {
+        if (operands.full()) {
+            stream.syntax_error(Diag::ExpressionComplex);
+            return;
+        }
+        operands.push(expr);
+    }
+
+    void push_operator (Operator op, Loc loc) {
+        if (operators.full()) {
+            stream.syntax_error(Diag::ExpressionDeep);
+            return;
+        }
+        operators.push({op, loc});
+    }
+
+    // Replaces the top `count` operands with one node over them.
+    void fold (Expression::Type type, Operator op, Loc loc, std::size_t count) {
+        if (operands.len < count) {
             panic("Invalid expression reduction");
         }
-        auto bin = alloc<Expression>(type, operands.back(), rhs);
-        operands.pop_back();
-        operands.push_back(bin);
+        operands.len -= count;
+        auto expr = ast.node(type, op, loc, {operands.data + operands.len, count});
+        operands.push(expr);
     }
-    
+
+    void reduce () {
+        auto [op, loc] = operators.pop();
+        if (OperatorTable[op].type == OperatorInfo::Prefix) {
+            fold(Expression::Unary, op, loc, 1);
+        } else {
+            fold(Expression::Binary, op, loc, 2);
+        }
+    }
+
+    // Applies pending operators back to the innermost open bracket. Returns
+    // that bracket, or nullptr if none is open.
+    Pending *unwind () {
+        while (!operators.empty()) {
+            if (is_bracket(operators.top().op)) {
+                return &operators.top();
+            }
+            reduce();
+        }
+        return nullptr;
+    }
+
+    void binary (const OperatorInfo &info, Loc loc);
+
+    bool postfix (const Token &token);
+
 public:
 
-    ExpressionParser(TokenStream& stream) : stream(stream) {}
+    ExpressionParser(TokenStream& stream, Ast &ast, bool commas = true)
+        : stream(stream), ast(ast), commas(commas) {}
 
-    Expression *parse ();
+    ExprId parse ();
 };
 
-Expression *ExpressionParser::parse () {
-    while (!stream.done()) {
-        auto &token = stream.peek();
+void ExpressionParser::binary (const OperatorInfo &info, Loc loc) {
+    while (!operators.empty()) {
+        auto &top = OperatorTable[operators.top().op];
+        if (is_bracket(top.op) || top.precedence < info.precedence ||
+            (top.precedence == info.precedence && info.type == OperatorInfo::RBinary)) {
+            break;
+        }
+        reduce();
+    }
+    push_operator(info.op, loc);
+    state = State::Unary;
+}
 
-        auto cat = categorize(token.type);
+// Handles a token following an operand. Returns false if the token does not
+// continue the expression, or on a syntax error.
+bool ExpressionParser::postfix (const Token &token) {
+    auto loc = stream.loc(token);
 
-        if (cat & Category::Operand) {
-            auto expr = alloc<Expression>(token);
-            operands.push_back(expr);
-            state = State::Binary;
-        } else if (cat & Category::Operator) {
-            if (state == State::Unary) {
-                if (token.type == Token::LParen) {
-                    operators.push_back(Operator::OpenParen);
-                } else if (token.type == Token::RParen) {
-                    if (stream.peek(-1).type != Token::Identifier) {
-                        stream.syntax_error("Unexpected ) in unary state");
-                    }
-                    pop_and_push_bin(Expression::Call, alloc<Expression>(List()));
-                } else {
-                    auto opinfo = get_unary_mode_op(token.type);
-                    if (!opinfo) {
-                        stream.syntax_error("Unexpected non-prefix operator");
-                    }
-                    operators.push_back(opinfo->op);
-                    state = State::Binary;
-                }
-            } else {
-                todo("Binary state");
+    switch (token.type) {
+    case Token::RParen: {
+        auto open = unwind();
+        if (!open) {
+            return false;
+        }
+        if (open->op == Operator::Index) {
+            stream.syntax_error(Diag::ExpectedBracket);
+            return false;
+        }
+        auto [op, at] = operators.pop();
+        if (op == Operator::Call) {
+            fold(Expression::Call, op, at, arity.pop() + 1);
+        }
+        stream.bump();
+        return true;
+    }
+    case Token::RBracket: {
+        auto open = unwind();
+        if (!open) {
+            return false;
+        }
+        if (open->op != Operator::Index) {
+            stream.syntax_error(Diag::ExpectedParen);
+            return false;
+        }
+        auto [op, at] = operators.pop();
+        fold(Expression::Binary, op, at, 2);
+        stream.bump();
+        return true;
+    }
+    case Token::Comma: {
+        auto open = unwind();
+        if (!open && !commas) {
+            return false;
+        }
+        stream.bump();
+        if (open && open->op == Operator::Call) {
+            arity.top()++;
+            state = State::Unary;
+        } else {
+            binary(OperatorTable[Operator::Comma], loc);
+        }
+        return true;
+    }
+    case Token::LParen:
+        stream.bump();
+        if (stream.peek().type == Token::RParen) {
+            stream.bump();
+            fold(Expression::Call, Operator::Call, loc, 1);
+        } else {
+            push_operator(Operator::Call, loc);
+            if (arity.full()) {
+                stream.syntax_error(Diag::ExpressionDeep);
+                return false;
+            }
+            arity.push(1);
+            state = State::Unary;
+        }
+        return true;
+    case Token::LBracket:
+        stream.bump();
+        push_operator(Operator::Index, loc);
+        state = State::Unary;
+        return true;
+    case Token::Dot: {
+        stream.bump();
+        auto name = stream.consume(Token::Identifier);
+        if (stream.failed()) {
+            return false;
+        }
+        push_operand(ast.leaf(name, stream.loc(name)));
+        fold(Expression::Binary, Operator::Member, loc, 2);
+        return true;
+    }
+    case Token::Increment:
+        stream.bump();
+        fold(Expression::Unary, Operator::PostIncrement, loc, 1);
+        return true;
+    default:
+        break;
+    }
+
+    auto info = get_binary_mode_op(token.type);
+    if (!info) {
+        return false;
+    }
+    stream.bump();
+    binary(*info, loc);
+    return true;
+}
+
+ExprId ExpressionParser::parse () {
+    while (!stream.done()) {
+        auto token = stream.peek();
+
+        if (state == State::Binary) {
+            if (!postfix(token)) {
+                break;
             }
+            continue;
+        }
 
-        } else if (cat & Category::Separator) {
-            todo("Non-operator separator {} encountered in expression", to_string(token.type));
+        if (categorize(token.type) & Category::Operand) {
+            push_operand(ast.leaf(token, stream.loc(token)));
+            state = State::Binary;
+        } else if (token.type == Token::LParen) {
+            push_operator(Operator::OpenParen, stream.loc(token));
+        } else if (auto info = get_unary_mode_op(token.type)) {
+            push_operator(info->op, stream.loc(token));
         } else {
-            stream.syntax_error("Unexpected token {} in expression.", to_string(token.type));
+            stream.syntax_error(Diag::ExpectedExpression, token.type);
         }
+        stream.bump();
     }
-    return nullptr;
+
+    if (!stream.failed() && state == State::Unary) {
+        stream.syntax_error(Diag::ExpectedExpression, stream.peek().type);
+    }
+    if (!stream.failed() && unwind()) {
+        stream.syntax_error(Diag::Unclosed, OperatorTable[operators.top().op].name.data());
+    }
+    // The stacks are left half built; the statement is dropped by recovery.
+    if (stream.failed()) {
+        return ast.node(Expression::Null, Operator{}, Loc::None, {});
+    }
+
+    auto expr = operands.pop();
+    if (!operands.empty()) {
+        panic("Unbalanced expression");
+    }
+    state = State::Unary;
+    return expr;
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <string_view>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+
+#include "table.h"
+#include "error.h"
+#include "allocator.h"
+
+namespace lain {
+
+enum class Symbol : uint32_t {
+    None = UINT32_MAX,
+};
+
+// Concurrent string interner. Names hash into one of 64 shards, each an open
+// addressing table of entry pointers claimed with a single compare-exchange,
+// and entry text is bump allocated from per-shard chunks the same way. A
+// Symbol is the (shard, slot) pair of its entry, so ids are stable as soon as
+// they are returned and resolving one is a few loads. No insert ever blocks.
+//
+// A shard grows without moving a slot: its table is a chain of levels, each
+// twice the size of the one before, numbered on from where the last ended. A
+// name probes a window of each level in turn and goes on to the next only
+// once the window is full, which never changes, so every thread sees one
+// name in one slot.
+class Interner {
+    static constexpr uint32_t ShardBits = 6;
+    static constexpr uint32_t SlotBits = 32 - ShardBits;
+    static constexpr uint32_t Levels = SlotBits;
+    static constexpr uint32_t Window = 32;
+    static constexpr std::size_t ChunkSize = 1 << 16;
+
+    struct Entry {
+        uint64_t hash;
+        uint32_t len;
+
+        const char *text () const {
+            return reinterpret_cast<const char*>(this + 1);
+        }
+    };
+
+    struct Chunk {
+        Chunk *next;
+        std::size_t cap;
+        std::atomic<std::size_t> used;
+
+        char *data () {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    using Slot = std::atomic<const Entry*>;
+
+    struct alignas(64) Shard {
+        std::atomic<Slot*> levels[Levels] = {};
+        std::atomic<Chunk*> chunks = nullptr;
+        std::atomic<uint32_t> count = 0;
+    };
+
+    Shard shards[1 << ShardBits];
+    // Level 0 has 1 << `bits` slots.
+    uint32_t bits;
+
+    std::size_t level_size (uint32_t level) const { return std::size_t{1} << (bits + level); }
+    // First slot number of `level`.
+    uint32_t level_base (uint32_t level) const { return static_cast<uint32_t>(level_size(level) - level_size(0)); }
+
+    Slot *level (Shard &shard, uint32_t level);
+
+    const Entry *make_entry (Shard &shard, std::string_view str, uint64_t hash);
+
+public:
+    explicit Interner (std::size_t capacity = 1 << 20);
+
+    Interner (const Interner&) = delete;
+    Interner& operator= (const Interner&) = delete;
+
+    ~Interner ();
+
+    Symbol intern (std::string_view str, uint64_t hash);
+
+    Symbol intern (std::string_view str) {
+        return intern(str, hash_bytes(str));
+    }
+
+    std::string_view name (Symbol sym) const;
+
+    std::size_t size () const;
+
+    // Heap bytes held by the slot tables and name storage.
+    std::size_t bytes () const;
+};
+
+Interner::Interner (std::size_t capacity) {
+    // Keep every shard at most half full for the requested capacity before
+    // it needs a second level.
+    bits = 6;
+    while ((std::size_t{1} << bits) < (capacity >> (ShardBits - 1)) && bits < SlotBits - 1) {
+        bits++;
+    }
+    for (auto &shard: shards) {
+        level(shard, 0);
+    }
+}
+
+// Level `level` of `shard`, made if it is not yet there. Null once the slot
+// numbers run out.
+Interner::Slot *Interner::level (Shard &shard, uint32_t level) {
+    auto table = shard.levels[level].load(std::memory_order_acquire);
+    if (table) {
+        return table;
+    }
+    if (bits + level >= SlotBits) {
+        return nullptr;
+    }
+    // Zeroed blocks come as untouched fresh pages, and a zero atomic pointer
+    // is an empty slot, so large tables cost nothing until they fill.
+    auto fresh = static_cast<Slot*>(heap_zeroed(level_size(level) * sizeof(Slot), Subsystem::Symbols));
+    if (!fresh) {
+        panic("Allocation failure");
+    }
+    if (!shard.levels[level].compare_exchange_strong(table, fresh, std::memory_order_acq_rel)) {
+        heap_free(fresh, level_size(level) * sizeof(Slot), Subsystem::Symbols);
+        return table;
+    }
+    return fresh;
+}
+
+Interner::~Interner () {
+    for (auto &shard: shards) {
+        auto chunk = shard.chunks.load();
+        while (chunk) {
+            auto next = chunk->next;
+            auto size = sizeof(Chunk) + chunk->cap;
+            chunk->~Chunk();
+            heap_free(chunk, size, Subsystem::Symbols);
+            chunk = next;
+        }
+        for (uint32_t l = 0; l < Levels; l++) {
+            if (auto table = shard.levels[l].load()) {
+                heap_free(table, level_size(l) * sizeof(Slot), Subsystem::Symbols);
+            }
+        }
+    }
+}
+
+const Interner::Entry *Interner::make_entry (Shard &shard, std::string_view str, uint64_t hash) {
+    auto size = (sizeof(Entry) + str.size() + alignof(Entry) - 1) & ~(alignof(Entry) - 1);
+    while (true) {
+        auto chunk = shard.chunks.load(std::memory_order_acquire);
+        if (chunk) {
+            auto off = chunk->used.fetch_add(size, std::memory_order_relaxed);
+            if (off + size <= chunk->cap) {
+                auto entry = reinterpret_cast<Entry*>(chunk->data() + off);
+                entry->hash = hash;
+                entry->len = static_cast<uint32_t>(str.size());
+                std::memcpy(chunk->data() + off + sizeof(Entry), str.data(), str.size());
+                return entry;
+            }
+        }
+
+        auto cap = std::max(ChunkSize, size);
+        auto raw = heap_alloc(sizeof(Chunk) + cap, Subsystem::Symbols);
+        if (!raw) {
+            panic("Allocation failure");
+        }
+        auto fresh = new (raw) Chunk{chunk, cap, 0};
+        if (!shard.chunks.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) {
+            fresh->~Chunk();
+            heap_free(fresh, sizeof(Chunk) + cap, Subsystem::Symbols);
+        }
+    }
+}
+
+Symbol Interner::intern (std::string_view str, uint64_t hash) {
+    auto h = hash_mix(hash);
+    auto s = static_cast<uint32_t>(h >> (64 - ShardBits));
+    auto &shard = shards[s];
+
+    const Entry *fresh = nullptr;
+    for (uint32_t l = 0; l < Levels; l++) {
+        auto slots = shard.levels[l].load(std::memory_order_acquire);
+        if (!slots && !(slots = level(shard, l))) {
+            break;
+        }
+        auto mask = static_cast<uint32_t>(level_size(l) - 1);
+        auto i = static_cast<uint32_t>(h) & mask;
+        for (uint32_t probe = 0; probe < Window && probe <= mask; probe++, i = (i + 1) & mask) {
+            auto entry = slots[i].load(std::memory_order_acquire);
+            if (!entry) {
+                if (!fresh) {
+                    fresh = make_entry(shard, str, hash);
+                }
+                if (slots[i].compare_exchange_strong(entry, fresh, std::memory_order_acq_rel)) {
+                    shard.count.fetch_add(1, std::memory_order_relaxed);
+                    return static_cast<Symbol>(s << SlotBits | (level_base(l) + i));
+                }
+                // Lost the race; entry is now whatever the winner stored.
+            }
+            if (entry->hash == hash && std::string_view{entry->text(), entry->len} == str) {
+                return static_cast<Symbol>(s << SlotBits | (level_base(l) + i));
+            }
+        }
+    }
+    panic("Symbol table full");
+    return Symbol::None;
+}
+
+std::string_view Interner::name (Symbol sym) const {
+    auto id = static_cast<uint32_t>(sym);
+    auto slot = id & ((1u << SlotBits) - 1);
+    // Level l starts at slot ((1 << l) - 1) << bits.
+    auto l = static_cast<uint32_t>(std::bit_width((slot >> bits) + 1) - 1);
+    auto table = shards[id >> SlotBits].levels[l].load(std::memory_order_acquire);
+    auto entry = table[slot - level_base(l)].load(std::memory_order_acquire);
+    return {entry->text(), entry->len};
+}
+
+std::size_t Interner::size () const {
+    std::size_t total = 0;
+    for (auto &shard: shards) {
+        total += shard.count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::size_t Interner::bytes () const {
+    std::size_t total = 0;
+    for (auto &shard: shards) {
+        for (uint32_t l = 0; l < Levels; l++) {
+            if (shard.levels[l].load(std::memory_order_acquire)) {
+                total += level_size(l) * sizeof(Slot);
+            }
+        }
+        for (auto chunk = shard.chunks.load(std::memory_order_acquire); chunk; chunk = chunk->next) {
+            total += sizeof(Chunk) + chunk->cap;
+        }
+    }
+    return total;
+}
+
+Interner &global_interner () {
+    static Interner interner;
+    return interner;
+}
+
+}
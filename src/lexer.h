@@ -1,79 +1,144 @@
 #pragma once
 
-#include <sstream>
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <charconv>
 #include <cstdio>
 #include <memory>
 #include <vector>
 
+#include "diagnostic.h"
+#include "source.h"
+#include "simd.h"
 #include "token.h"
 #include "error.h"
+#include "pool.h"
 
 namespace lain {
 
-struct Location {
-    std::string_view file;
-    std::string_view line;
-    uint row, col;
-};
+// Bumped whenever the tokens lexed from some text change, even if the token
+// types stay the same, so that tokens cached by an older lexer are not used.
+constexpr uint32_t LexerVersion = 3;
 
 class Lexer {
-    std::string path;
-    std::unique_ptr<char[]> src;
+    const SourceFile *file = nullptr;
+    StreamReader *reader = nullptr;
+
+    // The bytes being lexed: a whole file, or the complete lines of a stream
+    // read so far, with `origin` the absolute position of `base[0]`.
+    const char *base;
     std::size_t len;
+    std::size_t origin = 0;
+
+    // Earliest absolute position a stream window must still hold.
+    std::size_t keep = 0;
+
+    const ScanKernels &simd = scan_kernels();
 
-    std::vector<std::string_view> rows;
-    std::vector<Token> tokens;
+    Interner &interner;
 
-    uint crs = 0, col = 0, row = 0;
+    TokenBuffer tokens;
+
+    std::size_t crs = 0;
+
+    // Whether the next token stands where an operand is expected, the only
+    // place a color may.
+    bool operand = false;
 
     bool eof () const;
     char peek() const;
+    char peek(std::size_t ahead) const;
     char get();
+    bool refill();
 
     bool skipComment();
     bool skipSpace();
 
-    void scanIdentifier(Token &token);
-    void scanNumeric(Token &token);
-    void scanString(Token &token);
-    void scanSymbol(Token &token);
-    void scanToken();
+    Lexeme scanIdentifier();
+    Lexeme scanNumeric();
+    Lexeme scanRadix(uint shift);
+    Lexeme scanFloat(std::size_t pos);
+    Lexeme scanIpv4(std::size_t pos);
+    Lexeme scanColor();
+    Lexeme scanString();
+
+    bool scanDecimal(uint64_t &num);
+    bool isColor() const;
+    void checkSuffix();
+    Lexeme scanSymbol();
+    Lexeme scanToken();
 
     template<typename... Args>
-    void lexical_error(const std::format_string<Args...> fmt, Args&&... args);
-    
+    [[gnu::cold]] void lexical_error(Diag id, Args... args);
+
 public:
-    explicit Lexer (const std::string &path);
+    // Lexes only [begin, end) of `file`. Both ends must fall between tokens,
+    // at a line end or after a complete token. `operand` is whether the
+    // token before `begin` leaves an operand expected.
+    Lexer (const SourceFile &file, Interner &interner, std::size_t begin, std::size_t end, bool operand = false);
 
-    const std::vector<Token> &scan ();
+    // Smallest piece of a file worth lexing on its own thread.
+    static constexpr std::size_t ChunkSize = 1 << 20;
 
-    const std::string &name () const;
+    explicit Lexer (const SourceFile &file, Interner &interner = global_interner());
 
-    const std::string_view line (std::size_t num) const;
+    explicit Lexer (StreamReader &reader, Interner &interner = global_interner());
+
+    const TokenBuffer &scan ();
+
+    // As above, cutting the file at newlines into up to one chunk per worker
+    // of `pool` and lexing the chunks there. No token spans a newline, and
+    // no chunk opens with a token lexed by the one before it, so joining the
+    // chunks gives the same tokens as a serial scan. Each chunk collects
+    // its errors as diagnostics, merged in file order into the sink once
+    // every chunk is done; without a sink they end the process then, as a
+    // serial scan's first error would.
+    const TokenBuffer &scan (WorkPool &pool);
+
+    Lexeme next ();
+
+    void release (std::size_t pos);
+
+    std::string_view text (std::size_t pos, std::size_t size) const;
+
+    Location locate (std::size_t pos) const;
+
+    // Location of `pos` in the SourceManager space; streams have none.
+    Loc loc (std::size_t pos) const;
 };
 
-Lexer::Lexer (const std::string &path) : path(path) {
-    src = file_read(path, len);
-    if (!src) {
-        panic("could not read source file {}", path);
-    }
-    if (len > UINT32_MAX) {
-        panic("source file {} too large", path);
-    }
+Lexer::Lexer (const SourceFile &file, Interner &interner)
+    : file(&file), base(file.buffer.data()), len(file.buffer.size()),
+      interner(interner), tokens(file.buffer.view()) {}
+
+Lexer::Lexer (const SourceFile &file, Interner &interner, std::size_t begin, std::size_t end, bool operand)
+    : file(&file), base(file.buffer.data()), len(end),
+      interner(interner), tokens(file.buffer.view()), crs(begin), operand(operand) {}
+
+Lexer::Lexer (StreamReader &reader, Interner &interner)
+    : reader(&reader), base(reader.data()), len(0), origin(reader.begin()),
+      interner(interner), tokens({}) {}
+
+// Lets a stream window drop everything before `pos`.
+void Lexer::release (std::size_t pos) {
+    keep = pos;
 }
 
-const std::string &Lexer::name () const {
-    return path;
+std::string_view Lexer::text (std::size_t pos, std::size_t size) const {
+    return {base + (pos - origin), size};
 }
 
-const std::string_view Lexer::line (std::size_t num) const {
-    if (num >= rows.size()) {
-        panic("Invalid line access {} in {}", num, path);
+Location Lexer::locate (std::size_t pos) const {
+    if (reader) {
+        return reader->locate(pos);
     }
-    return rows[num];
+    return file->locate(pos);
 }
 
+Loc Lexer::loc (std::size_t pos) const {
+    return file ? file->loc(pos) : Loc::None;
+}
 
 bool Lexer::eof() const {
     return crs >= len;
@@ -83,168 +148,477 @@ char Lexer::peek () const {
     if (eof()) {
         return 0;
     }
-    return src[crs];
+    return base[crs];
+}
+
+// The byte `ahead` past the cursor, or NUL beyond the end.
+char Lexer::peek (std::size_t ahead) const {
+    if (crs + ahead >= len) {
+        return 0;
+    }
+    return base[crs + ahead];
 }
 
 char Lexer::get () {
     if (eof()) {
         return 0;
     }
-    char c = src[crs];
-    if (c == '\n') {
-        rows.emplace_back(src.get() + crs - col, col);
-        col = 0;
-        row++;
-    } else {
-        col++;
+    return base[crs++];
+}
+
+// Pulls more complete lines into a stream window. Tokens never span a
+// newline, so lexing can always stop and resume at the end of a line.
+bool Lexer::refill () {
+    if (!reader) {
+        return false;
+    }
+    auto pos = origin + crs;
+    if (!reader->fill(std::min(keep, pos))) {
+        return false;
     }
-    crs++;
-    return c;
+    base = reader->data();
+    origin = reader->begin();
+    len = reader->complete() - origin;
+    crs = pos - origin;
+    return crs < len;
 }
 
 bool Lexer::skipComment() {
-    if (peek() != '#') {
+    if (peek() != '#' || isColor()) {
         return false;
     }
 
-    while (!eof() && get() != '\n');
+    auto end = static_cast<std::size_t>(simd.line(base + crs) - base);
+    // The kernel also stops on NUL, so step over any embedded in the comment.
+    while (end < len && base[end] == '\0') {
+        end = static_cast<std::size_t>(simd.line(base + end + 1) - base);
+    }
+    crs = std::min(end, len);
+    get();
     return true;
 }
 
 bool Lexer::skipSpace() {
-    if (!isspace(peek())) {
+    auto end = static_cast<std::size_t>(simd.space(base + crs) - base);
+    if (end == crs) {
         return false;
     }
-    while (isspace(peek())) {
-        get();
-    }
+    crs = std::min(end, len);
     return true;
 }
 
-void Lexer::scanNumeric(Token &token) {
-    std::stringstream ss;
+// Value of the hex digit `c`, or -1.
+constexpr int hex_value (char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    auto lower = c | 0x20;
+    if (lower >= 'a' && lower <= 'f') {
+        return lower - 'a' + 10;
+    }
+    return -1;
+}
+
+// Reads a run of decimal digits into `num`, up to eight per step. Returns
+// false if the value no longer fits in 64 bits.
+bool Lexer::scanDecimal(uint64_t &num) {
+    static constexpr uint64_t Scale[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+    bool fits = true;
+    while (true) {
+        auto word = swar::load(base + crs);
+        auto n = std::min<std::size_t>(swar::digit_count(word), len - crs);
+        if (n == 0) {
+            return fits;
+        }
+        auto digits = swar::parse_digits(word, static_cast<uint32_t>(n));
+        fits &= !__builtin_mul_overflow(num, Scale[n], &num) && !__builtin_add_overflow(num, digits, &num);
+        crs += n;
+        if (n < 8) {
+            return fits;
+        }
+    }
+}
+
+// A number running straight into a letter or digit it cannot hold is a
+// typo, not two tokens. The rest of the word is dropped with it.
+void Lexer::checkSuffix() {
+    if (scalar::is_alnum(peek())) {
+        lexical_error(Diag::NumericSuffix, peek());
+        while (scalar::is_alnum(peek())) {
+            get();
+        }
+    }
+}
+
+// Numbers are read in one pass straight into their packed value, without
+// copying the text: integers, decimal, hex (0x) or binary (0b), as their
+// 64-bit value, floats as the bits of a double and IPv4 addresses as 32
+// bits in network order.
+Lexeme Lexer::scanNumeric() {
     auto pos = crs;
+    if (peek() == '0' && (peek(1) | 0x20) == 'x') {
+        return scanRadix(4);
+    }
+    if (peek() == '0' && (peek(1) | 0x20) == 'b') {
+        return scanRadix(1);
+    }
 
-    while (isdigit(peek())) {
-        ss << get();
+    uint64_t num = 0;
+    bool fits = scanDecimal(num);
+
+    if (peek() == '.' && scalar::is_digit(peek(1))) {
+        std::size_t end = 2;
+        while (scalar::is_digit(peek(end))) {
+            end++;
+        }
+        if (peek(end) == '.' && scalar::is_digit(peek(end + 1))) {
+            return scanIpv4(pos);
+        }
+        return scanFloat(pos);
+    }
+    if ((peek() | 0x20) == 'e') {
+        std::size_t sign = peek(1) == '+' || peek(1) == '-';
+        if (scalar::is_digit(peek(1 + sign))) {
+            return scanFloat(pos);
+        }
     }
 
-    token.len = crs - pos;
-    token.num = std::stoul(ss.str());
-    token.type = Token::Integer;
+    checkSuffix();
+    if (!fits) {
+        auto end = crs;
+        crs = pos;
+        lexical_error(Diag::IntegerOverflow);
+        crs = end;
+    }
+    return {Token::Integer, origin + pos, static_cast<uint32_t>(crs - pos), num};
 }
 
-void Lexer::scanIdentifier(Token &token) {
-    std::stringstream ss;
+// Integers in a power of two base, `shift` bits per digit.
+Lexeme Lexer::scanRadix(uint shift) {
     auto pos = crs;
+    crs += 2;
+
+    auto start = crs;
+    auto limit = 1 << shift;
+    uint64_t num = 0;
+    bool fits = true;
+    while (true) {
+        auto digit = hex_value(peek());
+        if (digit < 0 || digit >= limit) {
+            break;
+        }
+        fits &= (num >> (64 - shift)) == 0;
+        num = (num << shift) | static_cast<uint64_t>(digit);
+        get();
+    }
+
+    if (crs == start) {
+        lexical_error(Diag::MissingDigits, base[pos + 1]);
+    }
+    checkSuffix();
+    if (!fits) {
+        auto end = crs;
+        crs = pos;
+        lexical_error(Diag::IntegerOverflow);
+        crs = end;
+    }
+    return {Token::Integer, origin + pos, static_cast<uint32_t>(crs - pos), num};
+}
+
+// Floats are converted by from_chars, which is exact and never allocates.
+Lexeme Lexer::scanFloat(std::size_t pos) {
+    // from_chars leaves `value` alone on an error, which is reported.
+    double value = 0;
+    auto [end, error] = std::from_chars(base + pos, base + len, value);
+    crs = static_cast<std::size_t>(end - base);
+    if (error == std::errc::result_out_of_range) {
+        auto end = crs;
+        crs = pos;
+        lexical_error(Diag::FloatRange);
+        crs = end;
+    }
+    checkSuffix();
+    return {Token::Float, origin + pos, static_cast<uint32_t>(crs - pos), std::bit_cast<uint64_t>(value)};
+}
+
+Lexeme Lexer::scanIpv4(std::size_t pos) {
+    crs = pos;
+    uint64_t address = 0;
+    for (int part = 0; part < 4; part++) {
+        if (part) {
+            if (peek() != '.' || !scalar::is_digit(peek(1))) {
+                lexical_error(Diag::Ipv4Parts);
+                return {Token::Ipv4, origin + pos, static_cast<uint32_t>(crs - pos), address};
+            }
+            get();
+        }
+        auto start = crs;
+        uint64_t value = 0;
+        while (scalar::is_digit(peek()) && crs - start < 3) {
+            value = value * 10 + static_cast<uint64_t>(get() - '0');
+        }
+        if (value > 255 || scalar::is_digit(peek())) {
+            crs = start;
+            lexical_error(Diag::Ipv4Range);
+            while (scalar::is_digit(peek())) {
+                get();
+            }
+        }
+        address = (address << 8) | value;
+    }
+    if (peek() == '.' && scalar::is_digit(peek(1))) {
+        lexical_error(Diag::Ipv4Extra);
+        while (peek() == '.' && scalar::is_digit(peek(1))) {
+            get();
+            while (scalar::is_digit(peek())) {
+                get();
+            }
+        }
+    }
+    checkSuffix();
+    return {Token::Ipv4, origin + pos, static_cast<uint32_t>(crs - pos), address};
+}
+
+// A `#` followed by exactly six or eight hex digits, and nothing else an
+// identifier could hold, is a color where an operand is expected: after an
+// operator, `(`, `[`, `,`, `return`, or a `{` that itself stands there. Any
+// other `#` starts a comment, so `#deadbeef` opening a comment line stays one.
+bool Lexer::isColor() const {
+    if (!operand) {
+        return false;
+    }
+    std::size_t n = 0;
+    while (n < 9 && hex_value(peek(n + 1)) >= 0) {
+        n++;
+    }
+    return (n == 6 || n == 8) && !scalar::is_alnum(peek(n + 1));
+}
 
-    while (isalnum(peek())) {
-        ss << get();
+// Colors are packed as 0xRRGGBBAA, opaque when written without alpha.
+Lexeme Lexer::scanColor() {
+    auto pos = crs;
+    get();
+    uint64_t rgba = 0;
+    while (hex_value(peek()) >= 0) {
+        rgba = (rgba << 4) | static_cast<uint64_t>(hex_value(get()));
+    }
+    if (crs - pos == 7) {
+        rgba = (rgba << 8) | 0xff;
     }
+    return {Token::Color, origin + pos, static_cast<uint32_t>(crs - pos), rgba};
+}
+
+Lexeme Lexer::scanIdentifier() {
+    auto start = base + crs;
+    auto end = simd.ident(start);
+    auto pos = crs;
+    auto size = static_cast<uint32_t>(end - start);
+
+    crs += size;
 
-    token.len = crs - pos;
-    token.str = ss.str();
+    std::string_view str = {start, size};
+    auto hash = hash_bytes(str);
 
-    auto type = check_type(token.str);
+    auto type = check_type(str, hash);
     if (type == Token::Unknown) {
-        token.type = Token::Identifier;
-    } else {
-        token.type = type;
+        auto sym = interner.intern(str, hash);
+        return {Token::Identifier, origin + pos, size, static_cast<uint64_t>(sym)};
     }
+    return {type, origin + pos, size, 0};
 }
 
-void Lexer::scanString(Token &token) {
-    std::stringstream ss;
+Lexeme Lexer::scanString() {
     auto pos = crs;
     get();
 
+    // A broken string ends at its line, so the next line lexes as usual.
     while (!eof() && peek() != '"') {
         if (peek() == '\n') {
-            lexical_error("newline in string literal.");
-        } else if (peek() == '\\') {
-            todo("string escapes");
+            lexical_error(Diag::StringNewline);
+            break;
+        }
+        if (peek() == '\\') {
+            lexical_error(Diag::StringEscape);
+            if (peek(1) != '\n') {
+                get();
+            }
         }
-        ss << get();
+        get();
     }
-    get();
 
+    auto size = crs - pos - 1;
     if (eof()) {
-        lexical_error("incomplete string literal");
+        lexical_error(Diag::StringIncomplete);
+    } else if (peek() == '"') {
+        get();
     }
 
-    token.len = crs - pos;
-    token.str = ss.str();
-    token.type = Token::String;
+    auto sym = interner.intern({base + pos + 1, size});
+    return {Token::String, origin + pos, static_cast<uint32_t>(crs - pos), static_cast<uint64_t>(sym)};
 }
 
-void Lexer::scanSymbol(Token &token) {
-    auto res = tokenize(src.get() + crs);
+Lexeme Lexer::scanSymbol() {
+    auto &res = tokenize(base + crs);
 
-    if (res.type == Token::Unknown) {
-        lexical_error("unexpected character {}", peek());
+    if (res.type == Token::Unknown) [[unlikely]] {
+        lexical_error(Diag::UnexpectedCharacter, peek());
+        // Skip the whole of a multibyte character.
+        auto pos = crs++;
+        while ((peek() & 0xc0) == 0x80) {
+            get();
+        }
+        return {Token::Unknown, origin + pos, static_cast<uint32_t>(crs - pos), 0};
     }
 
-    token.len = res.str.size();
-    token.type = res.type;
+    auto pos = crs;
+    auto size = static_cast<uint32_t>(res.str.size());
+    crs += size;
 
-    crs += token.len;
-    col += token.len;
+    return {res.type, origin + pos, size, 0};
 }
 
-void Lexer::scanToken() {
-    Token &token = tokens.emplace_back();
-
-    token.row = row;
-    token.col = col;
-
+Lexeme Lexer::scanToken() {
     char c = peek();
 
     if (isalpha(c)) {
-        scanIdentifier(token);
+        return scanIdentifier();
     } else if (isdigit(c)) {
-        scanNumeric(token);
+        return scanNumeric();
     } else if (c == '"') {
-        scanString(token);
-    } else {
-        scanSymbol(token);
+        return scanString();
+    } else if (c == '#') {
+        return scanColor();
     }
+    return scanSymbol();
 }
 
-const std::vector<Token> &Lexer::scan () {
-    while (!eof()) {
+// Whether an operand is expected after `type`, given whether one was
+// expected before it. A `{` in operand position opens an initializer, and
+// one anywhere else a block.
+constexpr bool expects_operand (Token::Type type, bool operand) {
+    switch (type) {
+    case Token::LBrace:
+        return operand;
+    case Token::LParen:
+    case Token::LBracket:
+    case Token::Comma:
+    case Token::Return:
+        return true;
+    case Token::Increment:
+    case Token::Dot:
+        return false;
+    default:
+        return categorize(type) & Category::Operator;
+    }
+}
+
+// Lexes the next token, pulling more input first when streaming.
+Lexeme Lexer::next () {
+    while (true) {
+        if (eof() && !refill()) {
+            return {Token::Type::Eof, origin + crs, 0, 0};
+        }
         if (skipComment()) {
             continue;
         }
         if (skipSpace()) {
             continue;
         }
-        scanToken();
+        auto lex = scanToken();
+        // Only left by a reported error, so there is nothing to return.
+        if (lex.type == Token::Unknown) [[unlikely]] {
+            continue;
+        }
+        operand = expects_operand(lex.type, operand);
+        return lex;
     }
-    Token &eof = tokens.emplace_back();
-    eof.type = Token::Type::Eof;
-    return tokens;
 }
 
-template<typename... Args>
-void Lexer::lexical_error(const std::format_string<Args...> fmt, Args&&... args) {
-    std::string_view line;
-    auto str = src.get() + crs - col;
-    if (src[crs] == '\n') {
-        line = {str, col};
+const TokenBuffer &Lexer::scan () {
+    while (true) {
+        auto lex = next();
+        tokens.push(lex);
+        if (lex.type == Token::Type::Eof) {
+            return tokens;
+        }
+    }
+}
+
+const TokenBuffer &Lexer::scan (WorkPool &pool) {
+    if (!file || pool.size() <= 1 || len < 2 * ChunkSize) {
+        return scan();
+    }
+
+    std::vector<std::size_t> cuts = {crs};
+    auto count = std::min<std::size_t>(pool.size(), len / ChunkSize);
+    for (std::size_t i = 1; i < count; i++) {
+        auto from = std::max(len / count * i, cuts.back());
+        auto nl = static_cast<const char*>(std::memchr(base + from, '\n', len - from));
+        if (!nl) {
+            break;
+        }
+        auto cut = static_cast<std::size_t>(nl - base) + 1;
+        // `#` and `{` lex by the token before them, so a line starting with
+        // either stays in the chunk holding that token.
+        while (cut < len) {
+            auto first = static_cast<std::size_t>(simd.space(base + cut) - base);
+            if (first >= len || (base[first] != '#' && base[first] != '{')) {
+                break;
+            }
+            auto end = static_cast<const char*>(std::memchr(base + first, '\n', len - first));
+            cut = end ? static_cast<std::size_t>(end - base) + 1 : len;
+        }
+        if (cut > cuts.back() && cut < len) {
+            cuts.push_back(cut);
+        }
+    }
+    cuts.push_back(len);
+
+    auto chunks = cuts.size() - 1;
+    std::vector<uptr<Lexer>> parts;
+    std::vector<Diagnostics> diagnostics(chunks);
+    for (std::size_t i = 0; i < chunks; i++) {
+        parts.push_back(uptr<Lexer>(new Lexer(*file, interner, cuts[i], cuts[i + 1])));
+    }
+
+    pool.run(static_cast<uint32_t>(chunks), [&](uint, uint32_t index) {
+        diagnostic_sink = &diagnostics[index];
+        parts[index]->scan();
+        diagnostic_sink = nullptr;
+    });
+
+    if (diagnostic_sink) {
+        for (auto &part: diagnostics) {
+            diagnostic_sink->merge(part);
+        }
     } else {
-        line = {str, col + 1};
+        for (auto &part: diagnostics) {
+            if (!part.empty()) {
+                term(part.render());
+            }
+        }
+    }
+
+    std::size_t total = 0;
+    for (auto &part: parts) {
+        total += part->tokens.size();
+    }
+    tokens.reserve(total);
+    // Each chunk ends in its own Eof, and only the last one is kept.
+    for (std::size_t i = 0; i < chunks; i++) {
+        auto &part = parts[i]->tokens;
+        tokens.append(part, i + 1 < chunks ? part.size() - 1 : part.size());
     }
+    crs = len;
+    return tokens;
+}
 
-    std::string error_msg = std::format(fmt, std::forward<Args>(args)...);
-    
-    std::string msg = std::format(
-        "{}{}:{}:{}:{} {}error:{} {}\n{}\n{:>{}}{}^{}\n", 
-        Ansi::Bold, path, row + 1, col + 1, Ansi::Reset,
-        Ansi::RedFB, Ansi::Reset, error_msg,
-        line, "", line.size() - 1, Ansi::RedFB, Ansi::Reset
-    );
-    
-    term(msg);
+// Reports `id` at the cursor. Only the location is worked out here; the
+// message is put together once the unit is done, if at all.
+template<typename... Args>
+void Lexer::lexical_error(Diag id, Args... args) {
+    const uint64_t packed[] = {diag_arg(args)..., 0};
+    raise_diagnostic(id, locate(origin + crs), origin + crs, 1, packed);
 }
 
-}
\ No newline at end of file
+}
@@ -1,22 +1,20 @@
-#include <iostream>
-
-#include "stream.h"
-#include "expression.h"
+#include "server.h"
 
 int main (int argc, char **argv) {
-    if (argc != 2) {
-        lain::panic("usage: {} [path]", argv[0]);
+    // Blocks must be freed through the allocator they came from, so the
+    // counting one goes in before anything is allocated.
+    if (lain::measures_heap(argc, argv)) {
+        lain::heap = &lain::CountingAllocator::hooks;
     }
-
-    std::string path = argv[1];
-
-    auto stream = lain::TokenStream(path);
-
-    while (!stream.done()) {
-        std::cout << lain::to_string(stream.bump().type) << std::endl;
+    auto options = lain::parse_options(argc, argv);
+    if (!options.serve.empty()) {
+        return lain::Server(options.serve).run();
     }
-
-    lain::todo("Parsing");
-
-    return 0;
-}
\ No newline at end of file
+    if (!options.connect.empty()) {
+        if (auto status = lain::compile_remote(options)) {
+            return *status;
+        }
+    }
+    lain::Caches caches;
+    return lain::Driver(options, caches).run();
+}
@@ -4,6 +4,7 @@
 #include <span>
 
 #include "error.h"
+#include "allocator.h"
 
 namespace lain {
 
@@ -18,6 +19,7 @@ class cptr {
 
     size_t cnt;
     T* raw;
+    Subsystem tag;
 
 public:
     cptr(const cptr&) = delete;
@@ -53,33 +55,44 @@ public:
     std::span<const T> span() const noexcept { return {raw, cnt}; }
 
     ~cptr() {
-        free(raw);
+        heap_free(raw, sizeof(T) * cnt, tag);
     }
 
 private:
-    explicit cptr(size_t size) : cnt(size) {
-        raw = static_cast<T*>(malloc(sizeof(T) * size));
+    explicit cptr(size_t size, Subsystem tag) : cnt(size), tag(tag) {
+        raw = static_cast<T*>(heap_alloc(sizeof(T) * size, tag));
         if (!raw) {
             panic("Allocation failure");
         }
     }
 
-    friend cptr<T> make_cptr<T>(size_t size);
+    friend cptr<T> make_cptr<T>(size_t size, Subsystem tag);
 };
 
 template <typename T>
-[[nodiscard]] inline cptr<T> make_cptr(size_t size) {
-    return cptr<T>(size);
+[[nodiscard]] inline cptr<T> make_cptr(size_t size, Subsystem tag = Subsystem::General) {
+    return cptr<T>(size, tag);
 }
 
 template <typename T, size_t N>
 struct Stack {
-    static_assert(std::is_integral_v<T> || std::is_pointer_v<T> || std::is_enum_v<T>,
-        "Stack only supports integer or pointer types");
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>,
+        "Stack only supports trivially copyable types");
 
     size_t len = 0;
     T data[N];
 
+    bool empty () const noexcept { return len == 0; }
+
+    bool full () const noexcept { return len == N; }
+
+    T &top () {
+        if (len == 0) {
+            panic("Stack underflow");
+        }
+        return data[len - 1];
+    }
+
     T pop () {
         if (len == 0) {
             panic("Stack underflow");
@@ -95,18 +108,26 @@ struct Stack {
     }
 };
 
-template <typename T, typename... Args>
+// Objects from alloc are charged to `Tag` and must be returned with dealloc.
+template <typename T, Subsystem Tag = Subsystem::General, typename... Args>
 [[nodiscard]] inline T* alloc(Args&&... args) noexcept {
-    T* ptr = nullptr;
+    void* raw = heap_alloc(sizeof(T), Tag);
+    if (!raw) {
+        panic("Failed alloc");
+    }
     if constexpr (std::is_aggregate_v<T>) {
-        ptr = new (std::nothrow) T{std::forward<Args>(args)...}; // brace-init
+        return new (raw) T{std::forward<Args>(args)...}; // brace-init
     } else {
-        ptr = new (std::nothrow) T(std::forward<Args>(args)...); // paren-init
+        return new (raw) T(std::forward<Args>(args)...); // paren-init
     }
-    if (!ptr) {
-        panic("Failed alloc");
+}
+
+template <typename T, Subsystem Tag = Subsystem::General>
+inline void dealloc(T* ptr) noexcept {
+    if (ptr) {
+        ptr->~T();
+        heap_free(ptr, sizeof(T), Tag);
     }
-    return ptr;
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,719 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "expression.h"
+#include "cache.h"
+#include "lexer.h"
+
+namespace lain {
+
+// Bumped whenever the interface layout or the Expression encoding changes.
+constexpr uint32_t ModuleFormat = 4;
+
+consteval uint64_t module_version () {
+    uint64_t h = hash_bytes("lain.mi") ^ ModuleFormat;
+    for (auto name: ExpressionNames) {
+        h = hash_mix(h ^ hash_bytes(name));
+    }
+    for (auto &info: OperatorTable) {
+        h = hash_mix(h ^ hash_bytes(info.name));
+    }
+    return token_cache_version() ^ h;
+}
+
+// A module interface file is this header followed by 8-byte aligned sections:
+//
+//   entries[decls] nodes[nodes] edges[edges] literals[literals]
+//   name_ends[names] text[text] source[source]
+//
+// Entries are sorted by name hash and point at the root of one exported
+// declaration; private ones are there for the bodies that call them. Nodes are
+// stored children first, so every edge points at an earlier node; identifier
+// and string nodes hold a name index, integers and characters a literal
+// index. Functions keep their bodies, for comp code to call. `key` is the
+// hash of the module's source, whose real path ends the file: an unchanged
+// module is never rewritten, and an interface whose source changed since is
+// never read. `check` is the hash of everything after the header.
+struct ModuleHeader {
+    char magic[8];
+    uint64_t version;
+    uint64_t key;
+    uint64_t check;
+    uint32_t decls;
+    uint32_t nodes;
+    uint32_t edges;
+    uint32_t literals;
+    uint32_t names;
+    uint32_t source;
+    uint64_t text;
+};
+
+static_assert(sizeof(ModuleHeader) == 64);
+
+struct ModuleEntry {
+    uint64_t hash;
+    uint32_t name;
+    uint32_t root;
+};
+
+struct ModuleLayout {
+    std::size_t entries, nodes, edges, literals, names, text, source, total;
+
+    explicit ModuleLayout (const ModuleHeader &header) {
+        auto align = [](std::size_t n) { return (n + 7) & ~std::size_t{7}; };
+        entries = align(sizeof(ModuleHeader));
+        nodes = entries + header.decls * sizeof(ModuleEntry);
+        edges = nodes + header.nodes * sizeof(Expression);
+        literals = align(edges + header.edges * sizeof(uint32_t));
+        names = literals + header.literals * sizeof(uint64_t);
+        text = names + header.names * sizeof(uint32_t);
+        source = text + header.text;
+        total = source + header.source;
+    }
+};
+
+// Dotted name of a `module` or `import` path, or empty if it is not one.
+std::string module_name (const Ast &ast, ExprId path, const Interner &interner) {
+    auto &expr = ast[path];
+    if (expr.type == Expression::Identifier) {
+        return std::string(interner.name(ast.symbol(path)));
+    }
+    if (expr.type == Expression::Binary && expr.op == Operator::Member) {
+        auto parts = ast.children(path);
+        auto left = module_name(ast, parts[0], interner);
+        if (left.empty() || ast[parts[1]].type != Expression::Identifier) {
+            return {};
+        }
+        return left + "." + std::string(interner.name(ast.symbol(parts[1])));
+    }
+    return {};
+}
+
+// Name node of a top-level declaration, or an invalid id for anything that
+// declares nothing.
+ExprId declared_name (const Ast &ast, ExprId decl) {
+    switch (ast[decl].type) {
+    case Expression::Function:
+    case Expression::Struct:
+    case Expression::Enum:
+        return ast.children(decl)[0];
+    case Expression::Variable:
+        return ast.children(decl)[1];
+    default:
+        return {};
+    }
+}
+
+// Serializes the public declarations of one parsed module.
+class ModuleWriter {
+    const Ast &ast;
+    const Interner &interner;
+
+    std::vector<ModuleEntry> entries;
+    std::vector<Expression> nodes;
+    std::vector<uint32_t> edges;
+    std::vector<uint64_t> literals;
+    std::vector<uint32_t> ends;
+    std::string text;
+    std::unordered_map<uint32_t, uint32_t> numbers;
+
+    uint32_t name (Symbol sym);
+
+    uint32_t emit (ExprId id);
+
+public:
+    ModuleWriter (const Ast &ast, const Interner &interner) : ast(ast), interner(interner) {}
+
+    // Adds `decl`, private or not. Variables keep their initializer only
+    // when constant.
+    void add (ExprId decl);
+
+    std::size_t size () const { return entries.size(); }
+
+    // The interface file of the source at `source`, keyed by `key`.
+    std::string finish (uint64_t key, std::string_view source);
+};
+
+uint32_t ModuleWriter::name (Symbol sym) {
+    auto [it, fresh] = numbers.try_emplace(static_cast<uint32_t>(sym), static_cast<uint32_t>(ends.size()));
+    if (fresh) {
+        text += interner.name(sym);
+        ends.push_back(static_cast<uint32_t>(text.size()));
+    }
+    return it->second;
+}
+
+uint32_t ModuleWriter::emit (ExprId id) {
+    auto expr = ast[id];
+    expr.loc = Loc::None;
+    switch (expr.type) {
+    case Expression::Identifier:
+    case Expression::String:
+        expr.data = name(ast.symbol(id));
+        break;
+    case Expression::Integer:
+    case Expression::Character:
+    case Expression::Float:
+    case Expression::Ipv4:
+    case Expression::Color:
+        expr.data = static_cast<uint32_t>(literals.size());
+        literals.push_back(ast.literal(id));
+        break;
+    case Expression::Builtin:
+        break;
+    default: {
+        auto children = ast.children(id);
+        std::vector<uint32_t> local;
+        for (auto child: children) {
+            local.push_back(emit(child));
+        }
+        expr.data = static_cast<uint32_t>(edges.size());
+        edges.insert(edges.end(), local.begin(), local.end());
+        break;
+    }
+    }
+    nodes.push_back(expr);
+    return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void ModuleWriter::add (ExprId decl) {
+    auto id = declared_name(ast, decl);
+    if (!id || ast[id].type != Expression::Identifier) {
+        return;
+    }
+
+    uint32_t root;
+    auto &expr = ast[decl];
+    if (expr.type == Expression::Variable && !(expr.flags & (Modifier::Const | Modifier::Comp))) {
+        // Drop the initializer: importers only see the type.
+        auto children = ast.children(decl);
+        uint32_t local[3] = {emit(children[0]), emit(children[1]), 0};
+        local[2] = static_cast<uint32_t>(nodes.size());
+        nodes.push_back({Expression::Null, Operator{}, 0, Loc::None, 0, 0});
+        auto copy = expr;
+        copy.loc = Loc::None;
+        copy.data = static_cast<uint32_t>(edges.size());
+        edges.insert(edges.end(), local, local + 3);
+        nodes.push_back(copy);
+        root = static_cast<uint32_t>(nodes.size() - 1);
+    } else {
+        root = emit(decl);
+    }
+
+    auto sym = ast.symbol(id);
+    entries.push_back({hash_bytes(interner.name(sym)), name(sym), root});
+}
+
+std::string ModuleWriter::finish (uint64_t key, std::string_view source) {
+    std::sort(entries.begin(), entries.end(),
+        [](const ModuleEntry &a, const ModuleEntry &b) { return a.hash < b.hash; });
+
+    ModuleHeader header{};
+    std::memcpy(header.magic, "lain.mi", 8);
+    header.version = module_version();
+    header.key = key;
+    header.decls = static_cast<uint32_t>(entries.size());
+    header.nodes = static_cast<uint32_t>(nodes.size());
+    header.edges = static_cast<uint32_t>(edges.size());
+    header.literals = static_cast<uint32_t>(literals.size());
+    header.names = static_cast<uint32_t>(ends.size());
+    header.text = text.size();
+    header.source = static_cast<uint32_t>(source.size());
+    ModuleLayout layout(header);
+
+    std::string out(layout.total, '\0');
+    // Empty sections may have no storage at all.
+    auto put = [&out](std::size_t at, const void *data, std::size_t size) {
+        if (size) {
+            std::memcpy(out.data() + at, data, size);
+        }
+    };
+    put(0, &header, sizeof(header));
+    put(layout.entries, entries.data(), entries.size() * sizeof(ModuleEntry));
+    put(layout.nodes, nodes.data(), nodes.size() * sizeof(Expression));
+    put(layout.edges, edges.data(), edges.size() * sizeof(uint32_t));
+    put(layout.literals, literals.data(), literals.size() * sizeof(uint64_t));
+    put(layout.names, ends.data(), ends.size() * sizeof(uint32_t));
+    put(layout.text, text.data(), text.size());
+    put(layout.source, source.data(), source.size());
+    header.check = hash_content({out.data() + sizeof(header), out.size() - sizeof(header)});
+    put(0, &header, sizeof(header));
+    return out;
+}
+
+// Interface of one module, mapped read-only. Opening it checks the header
+// and the hash of the rest, as a token file is checked, and a lookup binary
+// searches the entries. Every node is checked as a declaration is copied
+// out: its type, operator, modifiers and number of children, and every index
+// it holds. A bad one fails that import.
+class ModuleInterface {
+    void *map = nullptr;
+    std::size_t len = 0;
+    dev_t device = 0;
+    ino_t inode = 0;
+
+    const ModuleHeader *header = nullptr;
+    const ModuleEntry *entries = nullptr;
+    const Expression *nodes = nullptr;
+    const uint32_t *edges = nullptr;
+    const uint64_t *literals = nullptr;
+    const uint32_t *ends = nullptr;
+    const char *text = nullptr;
+    const char *origin = nullptr;
+
+    std::string_view name (uint32_t index) const;
+
+    // Deepest declaration an import will copy.
+    static constexpr uint32_t Depth = 1 << 12;
+
+    // Fewest and most children of each node type, as the parser builds them.
+    struct Arity {
+        uint32_t min, max;
+    };
+
+    static constexpr uint32_t Any = UINT32_MAX;
+
+    static constexpr Arity Arities[] = {
+        {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},    // string .. identifier
+        {0, Any}, {0, 0}, {1, Any}, {1, 1}, {2, 2},                 // list, null, call, unary, binary
+        {0, 0}, {1, 1}, {1, 2},                                     // builtin, pointer, array
+        {0, Any}, {3, 3}, {4, 4}, {0, 1}, {0, 0}, {0, 0},           // block, if, for, return, break, continue
+        {3, 3}, {3, Any}, {1, Any}, {2, Any},                       // variable, function, struct, enum
+        {1, 1}, {1, 1}, {0, Any},                                   // module, import, unit
+    };
+
+    static_assert(std::size(Arities) == std::size(ExpressionNames));
+
+    static constexpr uint16_t Modifiers = (Modifier::Debug << 1) - 1;
+
+    ExprId copy (uint32_t node, Ast &ast, Interner &interner, std::vector<ExprId> &scratch, uint32_t depth) const;
+
+public:
+    ModuleInterface () = default;
+
+    ModuleInterface (const ModuleInterface&) = delete;
+    ModuleInterface& operator= (const ModuleInterface&) = delete;
+
+    ~ModuleInterface () {
+        if (map) {
+            ::munmap(map, len);
+        }
+    }
+
+    // Maps `path`, or returns null if it is missing or not an interface.
+    static uptr<ModuleInterface> open (const std::string &path);
+
+    uint64_t key () const { return header->key; }
+
+    // Real path of the module's source.
+    std::string_view source () const { return {origin, header->source}; }
+
+    // Whether the source still hashes to the key, so the interface still
+    // describes it. A source that is gone makes it stale too.
+    bool current () const;
+
+    // Whether `st` describes the very file this was mapped from. Interfaces
+    // are replaced by renaming, so a rewritten one is always a new file.
+    bool same (const struct stat &st) const { return st.st_dev == device && st.st_ino == inode; }
+
+    std::size_t size () const { return header->decls; }
+
+    // Copies the declaration named `decl` into `ast`, a private one only if
+    // `hidden`. Returns an invalid id if the module has none.
+    ExprId import (std::string_view decl, Ast &ast, Interner &interner, bool hidden = false) const;
+};
+
+uptr<ModuleInterface> ModuleInterface::open (const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(ModuleHeader))) {
+        ::close(fd);
+        return nullptr;
+    }
+    auto size = static_cast<std::size_t>(st.st_size);
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto module = uptr<ModuleInterface>(new ModuleInterface);
+    module->map = map;
+    module->len = size;
+    module->device = st.st_dev;
+    module->inode = st.st_ino;
+
+    auto base = static_cast<const char*>(map);
+    auto header = reinterpret_cast<const ModuleHeader*>(base);
+    if (std::memcmp(header->magic, "lain.mi", 8) != 0 || header->version != module_version()) {
+        return nullptr;
+    }
+    ModuleLayout layout(*header);
+    if (layout.total != size || hash_content({base + sizeof(ModuleHeader), size - sizeof(ModuleHeader)}) != header->check) {
+        return nullptr;
+    }
+
+    module->header = header;
+    module->entries = reinterpret_cast<const ModuleEntry*>(base + layout.entries);
+    module->nodes = reinterpret_cast<const Expression*>(base + layout.nodes);
+    module->edges = reinterpret_cast<const uint32_t*>(base + layout.edges);
+    module->literals = reinterpret_cast<const uint64_t*>(base + layout.literals);
+    module->ends = reinterpret_cast<const uint32_t*>(base + layout.names);
+    module->text = base + layout.text;
+    module->origin = base + layout.source;
+    return module;
+}
+
+bool ModuleInterface::current () const {
+    SourceBuffer buffer{std::string(source())};
+    return buffer && hash_content(buffer.view()) == key();
+}
+
+std::string_view ModuleInterface::name (uint32_t index) const {
+    if (index >= header->names) {
+        return {};
+    }
+    uint32_t begin = index ? ends[index - 1] : 0;
+    if (begin > ends[index] || ends[index] > header->text) {
+        return {};
+    }
+    return {text + begin, ends[index] - begin};
+}
+
+ExprId ModuleInterface::copy (uint32_t node, Ast &ast, Interner &interner, std::vector<ExprId> &scratch, uint32_t depth) const {
+    auto expr = nodes[node];
+    if (expr.type >= std::size(Arities) || expr.op >= OperatorTable.size() || (expr.flags & ~Modifiers) ||
+        expr.count < Arities[expr.type].min || expr.count > Arities[expr.type].max) {
+        return {};
+    }
+    switch (expr.type) {
+    case Expression::Identifier:
+    case Expression::String: {
+        auto str = name(expr.data);
+        if (!str.data()) {
+            return {};
+        }
+        expr.data = static_cast<uint32_t>(interner.intern(str));
+        return ast.nodes.make(expr);
+    }
+    case Expression::Integer:
+    case Expression::Character:
+    case Expression::Float:
+    case Expression::Ipv4:
+    case Expression::Color:
+        if (expr.data >= header->literals) {
+            return {};
+        }
+        expr.data = ast.literals.make(literals[expr.data]).id;
+        return ast.nodes.make(expr);
+    case Expression::Builtin:
+        if (expr.data >= TypeSpan || !(categorize(static_cast<Token::Type>(expr.data)) & Category::Type)) {
+            return {};
+        }
+        return ast.nodes.make(expr);
+    default:
+        break;
+    }
+
+    if (depth >= Depth || expr.data > header->edges || expr.count > header->edges - expr.data) {
+        return {};
+    }
+    auto base = scratch.size();
+    for (uint32_t i = 0; i < expr.count; i++) {
+        auto child = edges[expr.data + i];
+        // Children always come first, which also rules out cycles.
+        if (child >= node) {
+            return {};
+        }
+        auto id = copy(child, ast, interner, scratch, depth + 1);
+        if (!id) {
+            return {};
+        }
+        scratch.push_back(id);
+    }
+    auto id = ast.node(expr.type, expr.op, Loc::None, {scratch.data() + base, scratch.size() - base});
+    ast[id].flags = expr.flags;
+    scratch.resize(base);
+    return id;
+}
+
+ExprId ModuleInterface::import (std::string_view decl, Ast &ast, Interner &interner, bool hidden) const {
+    auto hash = hash_bytes(decl);
+    auto first = std::lower_bound(entries, entries + header->decls, hash,
+        [](const ModuleEntry &entry, uint64_t hash) { return entry.hash < hash; });
+    for (auto it = first; it != entries + header->decls && it->hash == hash; it++) {
+        if (name(it->name) == decl && it->root < header->nodes &&
+            (hidden || !(nodes[it->root].flags & Modifier::Private))) {
+            std::vector<ExprId> scratch;
+            return copy(it->root, ast, interner, scratch, 0);
+        }
+    }
+    return {};
+}
+
+// Directory of module interfaces, named after their modules. Interfaces are
+// mapped on first import, once their source is found unchanged, and shared by
+// every worker after that. A module missing or stale is looked up afresh by
+// each import, since an input of the same run may yet write it.
+class ModuleCache {
+    std::string dir;
+
+    std::mutex lock;
+    std::unordered_map<std::string, uptr<ModuleInterface>> modules;
+    // Interfaces replaced during a run, still mapped for the workers that
+    // found them before.
+    std::vector<uptr<ModuleInterface>> retired;
+
+    std::atomic<uint32_t> write_count = 0;
+    std::atomic<uint32_t> found_count = 0;
+    std::atomic<uint32_t> missing_count = 0;
+    std::atomic<uint32_t> imported_count = 0;
+
+    std::string path (const std::string &module) const {
+        return std::format("{}/{}.lain.mi", dir, module);
+    }
+
+public:
+    explicit ModuleCache (std::string dir) : dir(std::move(dir)) {
+        make_directories(this->dir);
+    }
+
+    // Writes the interface of the module declared in `unit`, read from
+    // `file`, if it declares one and its source changed since the interface
+    // was last written.
+    void emit (const Ast &ast, ExprId unit, const std::string &file, std::string_view source, const Interner &interner);
+
+    // Interface of `module`, or null if none has been written for its source
+    // as it is now.
+    const ModuleInterface *find (const std::string &module);
+
+    // Copies into `ast` each declaration of the modules imported by `unit`
+    // that `unit` names, and those the copied ones name in turn, private or
+    // not, appending their roots to `roots` if given. Returns
+    // how many were copied. An import with no interface is reported as a
+    // diagnostic at its declaration in `file`.
+    std::size_t import (Ast &ast, ExprId unit, std::string_view file, Interner &interner, std::vector<ExprId> *roots = nullptr);
+
+    // Forgets every interface, so a cache kept across runs checks each one
+    // against its source again, and starts counting afresh. No import may be
+    // in progress.
+    void refresh ();
+
+    uint32_t writes () const { return write_count.load(); }
+    uint32_t found () const { return found_count.load(); }
+    uint32_t missing () const { return missing_count.load(); }
+    uint32_t imported () const { return imported_count.load(); }
+};
+
+void ModuleCache::emit (const Ast &ast, ExprId unit, const std::string &file, std::string_view source, const Interner &interner) {
+    std::string module;
+    ModuleWriter writer(ast, interner);
+    for (auto decl: ast.children(unit)) {
+        if (ast[decl].type == Expression::Module) {
+            module = module_name(ast, ast.children(decl)[0], interner);
+        } else {
+            writer.add(decl);
+        }
+    }
+    if (module.empty()) {
+        return;
+    }
+
+    auto real = ::realpath(file.c_str(), nullptr);
+    if (!real) {
+        return;
+    }
+    std::string origin = real;
+    std::free(real);
+
+    auto key = hash_content(source);
+    auto target = path(module);
+    if (auto old = ModuleInterface::open(target); old && old->key() == key && old->source() == origin) {
+        return;
+    }
+
+    if (write_atomic(target, writer.finish(key, origin))) {
+        write_count++;
+        std::lock_guard guard(lock);
+        if (auto it = modules.find(module); it != modules.end()) {
+            retired.push_back(std::move(it->second));
+            modules.erase(it);
+        }
+    }
+}
+
+const ModuleInterface *ModuleCache::find (const std::string &module) {
+    std::lock_guard guard(lock);
+    if (auto it = modules.find(module); it != modules.end()) {
+        return it->second.get();
+    }
+    auto found = ModuleInterface::open(path(module));
+    if (!found || !found->current()) {
+        return nullptr;
+    }
+    return (modules[module] = std::move(found)).get();
+}
+
+void ModuleCache::refresh () {
+    std::lock_guard guard(lock);
+    modules.clear();
+    retired.clear();
+    write_count = found_count = missing_count = imported_count = 0;
+}
+
+// Reports that the module imported at `decl`, in `path`, has no interface.
+[[gnu::cold]]
+void import_error (const Ast &ast, ExprId decl, std::string_view path, Symbol module) {
+    const uint64_t args[] = {diag_arg(module), 0};
+    auto loc = ast[decl].loc;
+    if (loc == Loc::None) {
+        raise_diagnostic(Diag::ImportMissing, {path, {}, 0, 0}, 0, 0, args);
+        return;
+    }
+    auto &file = global_sources().file(loc);
+    auto pos = static_cast<uint32_t>(loc) - file.base;
+    raise_diagnostic(Diag::ImportMissing, file.locate(pos), pos, 0, args);
+}
+
+std::size_t ModuleCache::import (Ast &ast, ExprId unit, std::string_view file, Interner &interner, std::vector<ExprId> *roots) {
+    std::vector<const ModuleInterface*> imports;
+    for (auto decl: ast.children(unit)) {
+        if (ast[decl].type != Expression::Import) {
+            continue;
+        }
+        auto name = module_name(ast, ast.children(decl)[0], interner);
+        auto module = find(name);
+        if (module) {
+            imports.push_back(module);
+            found_count++;
+        } else {
+            missing_count++;
+            import_error(ast, decl, file, interner.intern(name));
+        }
+    }
+    if (imports.empty()) {
+        return 0;
+    }
+
+    // Every name the unit mentions.
+    std::vector<Symbol> used;
+    auto count = ast.nodes.size();
+    for (uint32_t i = 0; i < count; i++) {
+        if (ast[ExprId{i}].type == Expression::Identifier) {
+            used.push_back(ast.symbol(ExprId{i}));
+        }
+    }
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    // Names a copied declaration mentions, such as the functions its body
+    // calls, are pulled in after it, private ones included. Each is looked
+    // up at most once either way, and none the unit declares itself.
+    std::vector<std::pair<Symbol, bool>> work;
+    for (auto sym: used) {
+        work.emplace_back(sym, false);
+    }
+    std::unordered_set<uint32_t> done;
+    std::unordered_set<uint64_t> tried;
+    for (auto decl: ast.children(unit)) {
+        if (auto id = declared_name(ast, decl); id && ast[id].type == Expression::Identifier) {
+            done.insert(static_cast<uint32_t>(ast.symbol(id)));
+        }
+    }
+    std::size_t copied = 0;
+    for (std::size_t w = 0; w < work.size(); w++) {
+        auto [sym, hidden] = work[w];
+        auto key = static_cast<uint64_t>(sym) << 1 | hidden;
+        if (done.contains(static_cast<uint32_t>(sym)) || !tried.insert(key).second) {
+            continue;
+        }
+        auto name = interner.name(sym);
+        auto first = static_cast<uint32_t>(ast.nodes.size());
+        for (auto module: imports) {
+            if (auto root = module->import(name, ast, interner, hidden)) {
+                if (roots) {
+                    roots->push_back(root);
+                }
+                copied++;
+                done.insert(static_cast<uint32_t>(sym));
+                for (auto i = first; i < ast.nodes.size(); i++) {
+                    if (ast[ExprId{i}].type == Expression::Identifier) {
+                        work.emplace_back(ast.symbol(ExprId{i}), true);
+                    }
+                }
+                break;
+            }
+        }
+    }
+    imported_count += static_cast<uint32_t>(copied);
+    return copied;
+}
+
+// Module a source declares and the modules it imports, as named by the
+// `module` and `import` declarations at its head, before any other.
+struct ModuleHead {
+    std::string module;
+    std::vector<std::string> imports;
+};
+
+// Reads the head of the source at `path`, lexing no further than the first
+// other declaration. Errors are left for the compile proper to report.
+ModuleHead read_head (const std::string &path) {
+    ModuleHead head;
+    SourceFile file{path, SourceBuffer(path), 0, 0, {}, {}};
+    if (!file.buffer) {
+        return head;
+    }
+
+    Diagnostics dropped;
+    auto sink = diagnostic_sink;
+    diagnostic_sink = &dropped;
+
+    auto lexer = Lexer(file, global_interner());
+    while (true) {
+        auto keyword = lexer.next().type;
+        if (keyword != Token::Module && keyword != Token::Import) {
+            break;
+        }
+        std::string name;
+        auto lex = lexer.next();
+        while (lex.type == Token::Identifier) {
+            name += lexer.text(lex.pos, lex.len);
+            lex = lexer.next();
+            if (lex.type != Token::Dot) {
+                break;
+            }
+            name += '.';
+            lex = lexer.next();
+        }
+        if (lex.type != Token::Semi || name.empty() || name.back() == '.') {
+            break;
+        }
+        if (keyword == Token::Module) {
+            head.module = std::move(name);
+        } else {
+            head.imports.push_back(std::move(name));
+        }
+    }
+
+    diagnostic_sink = sink;
+    return head;
+}
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unistd.h>
+
+#include "allocator.h"
+
+namespace lain {
+
+// Append-only text in fixed 1 MiB chunks, for generated code. Appends copy
+// straight into the current chunk, so text viewed in a source buffer or the
+// interner never passes through a temporary string, and the chunks are
+// handed to writev as they are. Clearing keeps the chunks, so a worker
+// reusing its buffer from one unit to the next allocates nothing once warm.
+//
+// Every chunk but the last is full, so byte `pos` always sits at
+// pos % ChunkSize of chunk pos / ChunkSize.
+class OutputBuffer {
+public:
+    static constexpr std::size_t ChunkSize = 1 << 20;
+
+private:
+    tagged_vector<char*, Subsystem::Backend> chunks;
+    std::size_t length = 0;
+    char *cursor = nullptr;
+    char *limit = nullptr;
+
+    [[gnu::noinline]] void grow ();
+
+public:
+    OutputBuffer () = default;
+    OutputBuffer (const OutputBuffer&) = delete;
+    OutputBuffer& operator= (const OutputBuffer&) = delete;
+
+    ~OutputBuffer () {
+        for (auto chunk: chunks) {
+            heap_free(chunk, ChunkSize, Subsystem::Backend);
+        }
+    }
+
+    std::size_t size () const {
+        return cursor ? length + static_cast<std::size_t>(cursor - chunks[length / ChunkSize]) : 0;
+    }
+
+    void clear () {
+        length = 0;
+        cursor = chunks.empty() ? nullptr : chunks[0];
+        limit = cursor ? cursor + ChunkSize : nullptr;
+    }
+
+    void put (char c) {
+        if (cursor == limit) [[unlikely]] {
+            grow();
+        }
+        *cursor++ = c;
+    }
+
+    void append (std::string_view text) {
+        while (!text.empty()) {
+            if (cursor == limit) [[unlikely]] {
+                grow();
+            }
+            auto n = std::min(text.size(), static_cast<std::size_t>(limit - cursor));
+            std::memcpy(cursor, text.data(), n);
+            cursor += n;
+            text.remove_prefix(n);
+        }
+    }
+
+    OutputBuffer &operator<< (std::string_view text) {
+        append(text);
+        return *this;
+    }
+
+    OutputBuffer &operator<< (char c) {
+        put(c);
+        return *this;
+    }
+
+    // Numbers are formatted on the stack, with no allocation.
+    template <typename T>
+        requires std::is_arithmetic_v<T>
+    OutputBuffer &operator<< (T value) {
+        char buf[32];
+        auto end = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+        append({buf, static_cast<std::size_t>(end - buf)});
+        return *this;
+    }
+
+    // Adds the bytes from `begin` to `end` to `out` as iovecs.
+    void gather (std::size_t begin, std::size_t end, tagged_vector<iovec, Subsystem::Backend> &out) const;
+
+    // Appends the bytes from `begin` to `end` to `out`.
+    void copy (std::size_t begin, std::size_t end, std::string &out) const;
+};
+
+void OutputBuffer::grow () {
+    if (cursor) {
+        length += ChunkSize;
+    }
+    auto index = length / ChunkSize;
+    if (index == chunks.size()) {
+        auto chunk = static_cast<char*>(heap_alloc(ChunkSize, Subsystem::Backend));
+        if (!chunk) {
+            panic("Allocation failure");
+        }
+        chunks.push_back(chunk);
+    }
+    cursor = chunks[index];
+    limit = cursor + ChunkSize;
+}
+
+void OutputBuffer::gather (std::size_t begin, std::size_t end, tagged_vector<iovec, Subsystem::Backend> &out) const {
+    while (begin < end) {
+        auto offset = begin % ChunkSize;
+        auto n = std::min(end - begin, ChunkSize - offset);
+        out.push_back({chunks[begin / ChunkSize] + offset, n});
+        begin += n;
+    }
+}
+
+void OutputBuffer::copy (std::size_t begin, std::size_t end, std::string &out) const {
+    while (begin < end) {
+        auto offset = begin % ChunkSize;
+        auto n = std::min(end - begin, ChunkSize - offset);
+        out.append(chunks[begin / ChunkSize] + offset, n);
+        begin += n;
+    }
+}
+
+// Writes every iovec in `parts` to `fd`, up to IOV_MAX at a time, resuming
+// after short writes. Returns false on any other error.
+bool write_all (int fd, std::span<iovec> parts) {
+    while (!parts.empty()) {
+        auto count = static_cast<int>(std::min<std::size_t>(parts.size(), IOV_MAX));
+        auto n = ::writev(fd, parts.data(), count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        auto done = static_cast<std::size_t>(n);
+        while (!parts.empty() && done >= parts[0].iov_len) {
+            done -= parts[0].iov_len;
+            parts = parts.subspan(1);
+        }
+        if (done) {
+            parts[0].iov_base = static_cast<char*>(parts[0].iov_base) + done;
+            parts[0].iov_len -= done;
+        }
+    }
+    return true;
+}
+
+}
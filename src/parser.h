@@ -0,0 +1,501 @@
+#pragma once
+
+#include <bit>
+#include <charconv>
+#include <vector>
+#include <string>
+
+#include "expression.h"
+#include "stream.h"
+
+namespace lain {
+
+// Recursive descent parser for declarations and statements, handing every
+// expression to ExpressionParser. Everything lands in the flat Ast: a node's
+// children are collected on one shared scratch stack and copied out as a
+// single run once the node is complete, so no per-node lists are allocated.
+//
+// Optional children are always present, as Null nodes, so each node kind has
+// a fixed shape:
+//   variable  [type, name, init]
+//   function  [name, result, body, params...]
+//   if        [cond, then, else]
+//   for       [init, cond, step, body]
+//   struct    [name, fields...]
+//   enum      [name, base, entries...], entries being variables
+class Parser {
+    TokenStream &stream;
+    Ast &ast;
+
+    tagged_vector<ExprId, Subsystem::Ast> scratch;
+
+    // Statements, initializer lists and pointer types nest no deeper than
+    // this, so every later pass may recurse over the tree.
+    static constexpr uint32_t Depth = 256;
+    uint32_t depth = 0;
+
+    // Holds one level of nesting for as long as it lives.
+    struct Level {
+        uint32_t &depth;
+        explicit Level (uint32_t &depth) : depth(depth) { depth++; }
+        ~Level () { depth--; }
+    };
+
+    ExprId null (Loc loc) {
+        return ast.node(Expression::Null, Operator{}, loc, {});
+    }
+
+    // Builds a node over everything pushed to the scratch stack since `base`.
+    ExprId fold (Expression::Type type, Loc loc, std::size_t base, uint16_t flags = 0) {
+        auto id = ast.node(type, Operator{}, loc, {scratch.data() + base, scratch.size() - base});
+        ast[id].flags = flags;
+        scratch.resize(base);
+        return id;
+    }
+
+    bool at (Token::Type type) {
+        return stream.peek().type == type;
+    }
+
+    bool accept (Token::Type type) {
+        if (at(type)) {
+            stream.bump();
+            return true;
+        }
+        return false;
+    }
+
+    bool starts_declaration ();
+
+    uint16_t modifiers ();
+
+    ExprId name ();
+    ExprId expression (bool commas = true);
+    ExprId initializer ();
+    ExprId type ();
+
+    ExprId variable (uint16_t flags, Loc loc);
+    ExprId function (uint16_t flags);
+    ExprId structure (uint16_t flags);
+    ExprId enumeration (uint16_t flags);
+    ExprId path (Expression::Type type);
+
+    ExprId declaration ();
+    ExprId statement ();
+    ExprId block ();
+
+public:
+    Parser (TokenStream &stream, Ast &ast) : stream(stream), ast(ast) {}
+
+    // Parses the whole stream into a Unit node of top-level declarations.
+    ExprId parse ();
+
+    // Parses the next top-level declaration, then recovers past it if it
+    // failed, so the stream always stops where the next one starts.
+    ExprId next ();
+};
+
+uint16_t Parser::modifiers () {
+    uint16_t flags = Modifier::None;
+    while (true) {
+        switch (stream.peek().type) {
+        case Token::Protected:  flags |= Modifier::Protected;   break;
+        case Token::Private:    flags |= Modifier::Private;     break;
+        case Token::Static:     flags |= Modifier::Static;      break;
+        case Token::Const:      flags |= Modifier::Const;       break;
+        case Token::Comp:       flags |= Modifier::Comp;        break;
+        case Token::Unsafe:     flags |= Modifier::Unsafe;      break;
+        case Token::Unique:     flags |= Modifier::Unique;      break;
+        case Token::Debug:      flags |= Modifier::Debug;       break;
+        default:
+            return flags;
+        }
+        stream.bump();
+    }
+}
+
+// Whether the statement at the cursor declares something. A leading name is a
+// type if another name follows, possibly behind pointer stars, and that name
+// is then declared rather than used in an expression.
+bool Parser::starts_declaration () {
+    auto first = stream.peek().type;
+    auto cat = categorize(first);
+    if (first == Token::Var || (cat & (Category::Modifier | Category::Type)) || first == Token::Comp ||
+        first == Token::Fun || first == Token::Struct || first == Token::Enum) {
+        return true;
+    }
+    if (first != Token::Identifier) {
+        return false;
+    }
+    long off = 1;
+    while (off < 16 && stream.peek(off).type == Token::Mul) {
+        off++;
+    }
+    if (stream.peek(off).type != Token::Identifier) {
+        return false;
+    }
+    if (off == 1) {
+        return true;
+    }
+    auto after = stream.peek(off + 1).type;
+    return after == Token::Semi || after == Token::Assign || after == Token::LBracket;
+}
+
+ExprId Parser::name () {
+    auto token = stream.consume(Token::Identifier);
+    if (stream.failed()) {
+        return null(stream.loc(token));
+    }
+    return ast.leaf(token, stream.loc(token));
+}
+
+ExprId Parser::expression (bool commas) {
+    return ExpressionParser(stream, ast, commas).parse();
+}
+
+ExprId Parser::initializer () {
+    auto open = stream.peek();
+    if (open.type != Token::LBrace) {
+        return expression(false);
+    }
+    if (depth == Depth) [[unlikely]] {
+        stream.syntax_error(Diag::NestedDeep);
+        return null(stream.loc(open));
+    }
+    Level level(depth);
+    stream.bump();
+    auto base = scratch.size();
+    while (!at(Token::RBrace)) {
+        scratch.push_back(initializer());
+        if (!accept(Token::Comma)) {
+            break;
+        }
+    }
+    stream.consume(Token::RBrace);
+    return fold(Expression::List, stream.loc(open), base);
+}
+
+ExprId Parser::type () {
+    auto token = stream.peek();
+    ExprId result;
+    if (categorize(token.type) & Category::Type) {
+        stream.bump();
+        result = ast.nodes.make(Expression::Builtin, Operator{}, uint16_t{0}, stream.loc(token), uint32_t{token.type}, 0u);
+    } else if (token.type == Token::Identifier) {
+        result = name();
+    } else {
+        stream.syntax_error(Diag::ExpectedType, token.type);
+        result = null(stream.loc(token));
+    }
+    for (uint32_t stars = 0; at(Token::Mul); stars++) {
+        if (stars == Depth) [[unlikely]] {
+            stream.syntax_error(Diag::NestedDeep);
+            break;
+        }
+        auto star = stream.bump();
+        ExprId pointee[] = {result};
+        result = ast.node(Expression::Pointer, Operator{}, stream.loc(star), pointee);
+    }
+    return result;
+}
+
+// Parses `[type] name [size]... [= init]` after its modifiers, up to but not
+// including the terminator. `var` stands in for the type.
+ExprId Parser::variable (uint16_t flags, Loc loc) {
+    auto base = scratch.size();
+    if (accept(Token::Var)) {
+        scratch.push_back(null(loc));
+    } else {
+        scratch.push_back(type());
+    }
+    scratch.push_back(name());
+    while (at(Token::LBracket)) {
+        auto open = stream.bump();
+        auto inner = scratch.size();
+        scratch.push_back(scratch[base]);
+        if (!at(Token::RBracket)) {
+            scratch.push_back(expression());
+        }
+        stream.consume(Token::RBracket);
+        scratch[base] = fold(Expression::Array, stream.loc(open), inner);
+    }
+    if (accept(Token::Assign)) {
+        scratch.push_back(initializer());
+    } else {
+        scratch.push_back(null(loc));
+    }
+    return fold(Expression::Variable, loc, base, flags);
+}
+
+ExprId Parser::function (uint16_t flags) {
+    auto keyword = stream.consume(Token::Fun);
+    auto loc = stream.loc(keyword);
+    auto base = scratch.size();
+
+    scratch.push_back(name());
+    scratch.push_back(null(loc));
+    scratch.push_back(null(loc));
+
+    stream.consume(Token::LParen);
+    while (!at(Token::RParen)) {
+        auto param = stream.peek();
+        auto mods = modifiers();
+        scratch.push_back(variable(mods, stream.loc(param)));
+        if (!accept(Token::Comma)) {
+            break;
+        }
+    }
+    stream.consume(Token::RParen);
+
+    if (accept(Token::Colon)) {
+        scratch[base + 1] = type();
+    }
+    if (!accept(Token::Semi)) {
+        scratch[base + 2] = block();
+    }
+    return fold(Expression::Function, loc, base, flags);
+}
+
+ExprId Parser::structure (uint16_t flags) {
+    auto keyword = stream.consume(Token::Struct);
+    auto loc = stream.loc(keyword);
+    auto base = scratch.size();
+
+    scratch.push_back(name());
+    stream.consume(Token::LBrace);
+    while (!at(Token::RBrace) && !stream.done()) {
+        auto field = stream.peek();
+        auto mods = modifiers();
+        scratch.push_back(variable(mods, stream.loc(field)));
+        stream.consume(Token::Semi);
+    }
+    stream.consume(Token::RBrace);
+    accept(Token::Semi);
+    return fold(Expression::Struct, loc, base, flags);
+}
+
+ExprId Parser::enumeration (uint16_t flags) {
+    auto keyword = stream.consume(Token::Enum);
+    auto loc = stream.loc(keyword);
+    auto base = scratch.size();
+
+    scratch.push_back(name());
+    scratch.push_back(accept(Token::Colon) ? type() : null(loc));
+    stream.consume(Token::LBrace);
+    while (!at(Token::RBrace) && !stream.done()) {
+        auto entry = stream.peek();
+        auto inner = scratch.size();
+        scratch.push_back(null(stream.loc(entry)));
+        scratch.push_back(name());
+        scratch.push_back(accept(Token::Assign) ? initializer() : null(stream.loc(entry)));
+        scratch.push_back(fold(Expression::Variable, stream.loc(entry), inner));
+        if (!accept(Token::Semi)) {
+            accept(Token::Comma);
+        }
+    }
+    stream.consume(Token::RBrace);
+    accept(Token::Semi);
+    return fold(Expression::Enum, loc, base, flags);
+}
+
+ExprId Parser::path (Expression::Type type) {
+    auto keyword = stream.bump();
+    auto base = scratch.size();
+    scratch.push_back(expression());
+    stream.consume(Token::Semi);
+    return fold(type, stream.loc(keyword), base);
+}
+
+ExprId Parser::declaration () {
+    auto start = stream.peek();
+    auto flags = modifiers();
+
+    switch (stream.peek().type) {
+    case Token::Fun:
+        return function(flags);
+    case Token::Struct:
+        return structure(flags);
+    case Token::Enum:
+        return enumeration(flags);
+    default: {
+        auto var = variable(flags, stream.loc(start));
+        stream.consume(Token::Semi);
+        return var;
+    }
+    }
+}
+
+// A statement with a syntax error is kept as parsed so far, and parsing
+// resumes at the next one.
+ExprId Parser::block () {
+    auto open = stream.consume(Token::LBrace);
+    auto base = scratch.size();
+    while (!accept(Token::RBrace)) {
+        if (stream.done()) {
+            stream.syntax_error(Diag::UnclosedBlock);
+            break;
+        }
+        scratch.push_back(statement());
+        if (stream.failed()) [[unlikely]] {
+            stream.recover();
+        }
+    }
+    return fold(Expression::Block, stream.loc(open), base);
+}
+
+ExprId Parser::statement () {
+    auto token = stream.peek();
+    auto loc = stream.loc(token);
+    auto base = scratch.size();
+    if (depth == Depth) [[unlikely]] {
+        stream.syntax_error(Diag::NestedDeep);
+        return null(loc);
+    }
+    Level level(depth);
+
+    switch (token.type) {
+    case Token::LBrace:
+        return block();
+    case Token::If:
+        stream.bump();
+        stream.consume(Token::LParen);
+        scratch.push_back(expression());
+        stream.consume(Token::RParen);
+        scratch.push_back(statement());
+        scratch.push_back(accept(Token::Else) ? statement() : null(loc));
+        return fold(Expression::If, loc, base);
+    case Token::For:
+        stream.bump();
+        stream.consume(Token::LParen);
+        if (starts_declaration()) {
+            scratch.push_back(variable(modifiers(), loc));
+        } else {
+            scratch.push_back(at(Token::Semi) ? null(loc) : expression());
+        }
+        stream.consume(Token::Semi);
+        scratch.push_back(at(Token::Semi) ? null(loc) : expression());
+        stream.consume(Token::Semi);
+        scratch.push_back(at(Token::RParen) ? null(loc) : expression());
+        stream.consume(Token::RParen);
+        scratch.push_back(statement());
+        return fold(Expression::For, loc, base);
+    case Token::Return:
+        stream.bump();
+        if (!at(Token::Semi)) {
+            scratch.push_back(expression());
+        }
+        stream.consume(Token::Semi);
+        return fold(Expression::Return, loc, base);
+    case Token::Break:
+    case Token::Continue:
+        stream.bump();
+        stream.consume(Token::Semi);
+        return fold(token.type == Token::Break ? Expression::Break : Expression::Continue, loc, base);
+    default:
+        break;
+    }
+
+    if (starts_declaration()) {
+        return declaration();
+    }
+    auto expr = expression();
+    stream.consume(Token::Semi);
+    return expr;
+}
+
+ExprId Parser::next () {
+    ExprId root;
+    switch (stream.peek().type) {
+    case Token::Module:
+        root = path(Expression::Module);
+        break;
+    case Token::Import:
+        root = path(Expression::Import);
+        break;
+    default:
+        if (!starts_declaration()) {
+            stream.syntax_error(Diag::ExpectedDeclaration, stream.peek().type);
+        }
+        root = declaration();
+        break;
+    }
+    if (stream.failed()) [[unlikely]] {
+        stream.recover();
+        // Left by recovery inside a declaration that was never opened.
+        accept(Token::RBrace);
+    }
+    return root;
+}
+
+ExprId Parser::parse () {
+    auto loc = stream.loc(stream.peek());
+    auto base = scratch.size();
+    while (!stream.done()) {
+        scratch.push_back(next());
+    }
+    return fold(Expression::Unit, loc, base);
+}
+
+// Renders the tree under `id` as an s-expression, for dumps and tests.
+void print (const Ast &ast, ExprId id, std::string &out, const Interner &interner = global_interner()) {
+    auto &expr = ast[id];
+    switch (expr.type) {
+    case Expression::Integer:
+    case Expression::Character:
+        out += std::to_string(ast.literal(id));
+        return;
+    case Expression::Float: {
+        // Shortest text that reads back as the same double.
+        char buf[32];
+        auto end = std::to_chars(buf, buf + sizeof(buf), std::bit_cast<double>(ast.literal(id))).ptr;
+        out.append(buf, end);
+        return;
+    }
+    case Expression::Ipv4: {
+        auto address = ast.literal(id);
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out += std::to_string((address >> shift) & 0xff);
+            out += shift ? "." : "";
+        }
+        return;
+    }
+    case Expression::Color: {
+        auto rgba = ast.literal(id);
+        out += '#';
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            out += "0123456789abcdef"[(rgba >> shift) & 0xf];
+        }
+        return;
+    }
+    case Expression::Identifier:
+        out += interner.name(ast.symbol(id));
+        return;
+    case Expression::String:
+        out += '"';
+        out += interner.name(ast.symbol(id));
+        out += '"';
+        return;
+    case Expression::Null:
+        out += "_";
+        return;
+    case Expression::Builtin:
+        out += to_string(static_cast<Token::Type>(expr.data));
+        return;
+    case Expression::Unary:
+    case Expression::Binary:
+        out += '(';
+        out += OperatorTable[expr.op].name;
+        break;
+    default:
+        out += '(';
+        out += to_string(expr.type);
+        break;
+    }
+    for (auto child: ast.children(id)) {
+        out += ' ';
+        print(ast, child, out, interner);
+    }
+    out += ')';
+}
+
+}
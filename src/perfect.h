@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "allocator.h"
+#include "table.h"
+
+namespace lain {
+
+// Minimal perfect hash over a runtime key set, built in PTHash style for the
+// enum conversion tables a backend emits. Keys arrive as 64-bit hashes: the
+// bytes of a string through hash_bytes, any other value through hash_mix.
+//
+// A key is rehashed with the seed, sent to a bucket by its high half, and
+// placed at its low half mixed with the bucket's pilot. Buckets are skewed,
+// 60% of keys into 30% of buckets, and placed largest first, so the crowded
+// ones are settled while most slots are still free. The slots hold the
+// ordinal of the key placed there. A lookup is one multiply-xorshift, two
+// loads and a compare of the ordinal's value against the key, with no
+// branch but the final one. Building is linear in the key count.
+//
+// The table keeps about 1.5% of its slots empty rather than remapping the
+// overflow into the first `count` slots. Since a slot only holds an ordinal,
+// a remap table would be as large as the slots it saves.
+struct PerfectHash {
+    // Key hashes below this go to the dense buckets: 60% of 2^32.
+    static constexpr uint64_t Split = 0x9999999a;
+    static constexpr uint32_t MaxPilot = UINT16_MAX;
+    static constexpr uint32_t Seeds = 16;
+
+    uint64_t seed = 0;
+    uint32_t buckets = 0;
+    uint32_t dense = 0;
+    uint32_t slots = 0;
+
+    tagged_vector<uint16_t, Subsystem::Comp> pilots;
+    tagged_vector<uint32_t, Subsystem::Comp> order;
+
+    bool empty () const { return slots == 0; }
+
+    uint32_t bucket (uint64_t h) const {
+        auto high = h >> 32;
+        return static_cast<uint32_t>(high < Split ? high % dense : dense + high % (buckets - dense));
+    }
+
+    static uint64_t place (uint64_t h, uint32_t pilot, uint32_t slots) {
+        return (h ^ hash_mix(pilot + 1)) % slots;
+    }
+
+    // Ordinal of the entry whose key hashes to `key` if there is one, and of
+    // some other entry otherwise.
+    uint32_t find (uint64_t key) const {
+        auto h = hash_mix(key ^ seed);
+        return order[place(h, pilots[bucket(h)], slots)];
+    }
+
+    // Builds over `keys`, where key `i` is ordinal `i`. Fails when two keys
+    // hash alike, which for distinct values is all but impossible.
+    bool build (std::span<const uint64_t> keys);
+
+private:
+    bool attempt (std::span<const uint64_t> keys);
+};
+
+bool PerfectHash::build (std::span<const uint64_t> keys) {
+    auto n = static_cast<uint32_t>(keys.size());
+    slots = n + n / 64 + 1;
+    buckets = n / 3 + 2;
+    dense = buckets * 3 / 10 + 1;
+    for (uint32_t s = 0; s < Seeds; s++) {
+        seed = hash_mix(hash_bytes("lain.ph") + s);
+        if (attempt(keys)) {
+            return true;
+        }
+    }
+    slots = 0;
+    pilots.clear();
+    order.clear();
+    return false;
+}
+
+bool PerfectHash::attempt (std::span<const uint64_t> keys) {
+    auto n = static_cast<uint32_t>(keys.size());
+
+    // Keys grouped by bucket with a counting sort, then buckets ordered by
+    // size with another.
+    tagged_vector<uint64_t, Subsystem::Comp> hashes(n);
+    tagged_vector<uint32_t, Subsystem::Comp> start(buckets + 1, 0);
+    tagged_vector<uint32_t, Subsystem::Comp> members(n);
+    for (uint32_t i = 0; i < n; i++) {
+        hashes[i] = hash_mix(keys[i] ^ seed);
+        start[bucket(hashes[i]) + 1]++;
+    }
+    uint32_t largest = 0;
+    for (uint32_t b = 0; b < buckets; b++) {
+        largest = std::max(largest, start[b + 1]);
+        start[b + 1] += start[b];
+    }
+    {
+        tagged_vector<uint32_t, Subsystem::Comp> fill(start.begin(), start.end() - 1);
+        for (uint32_t i = 0; i < n; i++) {
+            members[fill[bucket(hashes[i])]++] = i;
+        }
+    }
+    tagged_vector<uint32_t, Subsystem::Comp> by_size(largest + 2, 0);
+    for (uint32_t b = 0; b < buckets; b++) {
+        by_size[largest - (start[b + 1] - start[b]) + 1]++;
+    }
+    for (uint32_t s = 0; s <= largest; s++) {
+        by_size[s + 1] += by_size[s];
+    }
+    tagged_vector<uint32_t, Subsystem::Comp> sorted(buckets);
+    for (uint32_t b = 0; b < buckets; b++) {
+        sorted[by_size[largest - (start[b + 1] - start[b])]++] = b;
+    }
+
+    pilots.assign(buckets, 0);
+    order.assign(slots, 0);
+    tagged_vector<uint64_t, Subsystem::Comp> taken((slots + 63) / 64, 0);
+    auto is_taken = [&](uint64_t s) { return taken[s / 64] >> (s % 64) & 1; };
+
+    uint64_t placed[64];
+    for (auto b: sorted) {
+        auto first = start[b], size = start[b + 1] - first;
+        if (size == 0) {
+            break;
+        }
+        if (size > std::size(placed)) {
+            return false;
+        }
+        // Keys that hash alike can never be told apart.
+        for (uint32_t i = 0; i < size; i++) {
+            for (uint32_t j = 0; j < i; j++) {
+                if (hashes[members[first + i]] == hashes[members[first + j]]) {
+                    return false;
+                }
+            }
+        }
+
+        uint32_t pilot = 0;
+        for (;; pilot++) {
+            if (pilot > MaxPilot) {
+                return false;
+            }
+            uint32_t i = 0;
+            for (; i < size; i++) {
+                auto s = place(hashes[members[first + i]], pilot, slots);
+                if (is_taken(s)) {
+                    break;
+                }
+                uint32_t j = 0;
+                while (j < i && placed[j] != s) {
+                    j++;
+                }
+                if (j < i) {
+                    break;
+                }
+                placed[i] = s;
+            }
+            if (i == size) {
+                break;
+            }
+        }
+
+        pilots[b] = static_cast<uint16_t>(pilot);
+        for (uint32_t i = 0; i < size; i++) {
+            taken[placed[i] / 64] |= uint64_t{1} << (placed[i] % 64);
+            order[placed[i]] = members[first + i];
+        }
+    }
+    return true;
+}
+
+}
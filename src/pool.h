@@ -0,0 +1,159 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+#include "error.h"
+
+namespace lain {
+
+// Fixed set of worker threads running indexed jobs. The threads are started
+// with the pool and wait between runs, so a run costs a wakeup rather than a
+// thread per worker. Jobs are dealt out to per-worker deques in contiguous
+// blocks; a worker takes from the front of its own deque and, once that runs
+// dry, steals from the back of the others, so uneven jobs balance out
+// without every worker contending on one queue.
+//
+// Jobs report failure through whatever they write to, never by leaving the
+// pool, so every worker comes back from its last job and goes idle before
+// run returns, and is joined when the pool goes away.
+class WorkPool {
+    struct alignas(64) Queue {
+        std::mutex lock;
+        std::deque<uint32_t> jobs;
+        uint32_t steals = 0;
+    };
+
+    std::vector<uptr<Queue>> queues;
+
+    std::function<void(uint, uint32_t)> job;
+
+    // Each run bumps `generation` to start the workers, and waits for `busy`
+    // to fall back to 0.
+    std::mutex lock;
+    std::condition_variable started;
+    std::condition_variable finished;
+    uint64_t generation = 0;
+    uint busy = 0;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+
+    bool take (uint worker, uint32_t &index);
+    void work (uint worker);
+
+public:
+    explicit WorkPool (uint workers);
+
+    WorkPool (const WorkPool&) = delete;
+    WorkPool& operator= (const WorkPool&) = delete;
+
+    ~WorkPool ();
+
+    uint size () const { return static_cast<uint>(queues.size()); }
+
+    // Jobs worker `worker` took from another worker's deque in the last run.
+    uint32_t steals (uint worker) const { return queues[worker]->steals; }
+
+    // Calls `job(worker, index)` for every index below `count` and returns
+    // once all have completed and every worker is idle again.
+    void run (uint32_t count, std::function<void(uint, uint32_t)> job);
+};
+
+WorkPool::WorkPool (uint workers) {
+    workers = std::max(workers, 1u);
+    for (uint i = 0; i < workers; i++) {
+        queues.push_back(uptr<Queue>(new Queue));
+    }
+    for (uint i = 0; i < workers; i++) {
+        threads.emplace_back(&WorkPool::work, this, i);
+    }
+}
+
+WorkPool::~WorkPool () {
+    {
+        std::lock_guard guard(lock);
+        stopping = true;
+    }
+    started.notify_all();
+    for (auto &thread: threads) {
+        thread.join();
+    }
+}
+
+bool WorkPool::take (uint worker, uint32_t &index) {
+    {
+        auto &own = *queues[worker];
+        std::lock_guard guard(own.lock);
+        if (!own.jobs.empty()) {
+            index = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+    for (uint off = 1; off < size(); off++) {
+        auto &victim = *queues[(worker + off) % size()];
+        std::lock_guard guard(victim.lock);
+        if (!victim.jobs.empty()) {
+            index = victim.jobs.back();
+            victim.jobs.pop_back();
+            queues[worker]->steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkPool::work (uint worker) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock guard(lock);
+            started.wait(guard, [&]{ return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        uint32_t index;
+        while (take(worker, index)) {
+            job(worker, index);
+        }
+        std::lock_guard guard(lock);
+        if (--busy == 0) {
+            finished.notify_all();
+        }
+    }
+}
+
+void WorkPool::run (uint32_t count, std::function<void(uint, uint32_t)> job) {
+    // Every worker is idle, so nothing else touches the queues until the
+    // workers are started below.
+    this->job = std::move(job);
+
+    // Contiguous blocks keep neighbouring inputs, often similar in size and
+    // sharing imports, on one worker until stealing kicks in.
+    for (uint i = 0; i < size(); i++) {
+        auto &queue = *queues[i];
+        queue.jobs.clear();
+        queue.steals = 0;
+        for (uint32_t j = count * i / size(); j < count * (i + 1) / size(); j++) {
+            queue.jobs.push_back(j);
+        }
+    }
+
+    std::unique_lock guard(lock);
+    generation++;
+    busy = size();
+    started.notify_all();
+    // Workers may still be looking for more work, and they touch the pool
+    // while they do, so the run only ends once every one of them is idle.
+    finished.wait(guard, [this]{ return busy == 0; });
+}
+
+}
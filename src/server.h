@@ -0,0 +1,392 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "driver.h"
+
+namespace lain {
+
+// Bumped whenever the messages below change. The cache and interface
+// formats are folded in as well, so a client never compiles through a server
+// that reads them differently: the server refuses, and the client compiles by
+// itself.
+constexpr uint32_t ServerProtocol = 3;
+
+consteval uint64_t server_version () {
+    return hash_mix(hash_bytes("lain.rq") ^ ServerProtocol ^ module_version());
+}
+
+// A request is this header followed by `size` bytes of NUL-terminated
+// strings: the client's working directory, the trace file, the token cache
+// and module directories, then each input.
+struct RequestHeader {
+    char magic[8];
+    uint64_t version;
+    uint64_t size;
+    uint32_t jobs;
+    uint8_t dump;
+    uint8_t stats;
+    uint8_t emit;
+    uint8_t reserved;
+};
+
+static_assert(sizeof(RequestHeader) == 32);
+
+// A reply is this header followed by the output, the report or error, the
+// trace and the generated C, which the client writes where it was asked to.
+struct ReplyHeader {
+    char magic[8];
+    uint32_t status;
+    uint32_t reserved;
+    uint64_t out;
+    uint64_t err;
+    uint64_t trace;
+    uint64_t code;
+};
+
+static_assert(sizeof(ReplyHeader) == 48);
+
+enum class ReplyStatus : uint32_t {
+    Done,
+    Failed,
+    Refused,
+};
+
+// Sends all of `data`, without raising SIGPIPE if the peer is gone.
+bool send_all (int fd, std::string_view data) {
+    while (!data.empty()) {
+        auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data.remove_prefix(static_cast<std::size_t>(n));
+    }
+    return true;
+}
+
+bool receive_all (int fd, void *buf, std::size_t size) {
+    auto p = static_cast<char*>(buf);
+    while (size > 0) {
+        auto n = ::recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+// A socket connected to `path`, or -1.
+int connect_socket (const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Compiles for clients on a Unix socket, one request at a time. Each request
+// runs in a forked child, in the client's working directory, so its output is
+// exactly that of compiling in the client, and nothing an input does to the
+// child, a panic or a stack overflow, takes the server down: the client is
+// told how the child died instead. Children start from the server's state
+// copy-on-write; what they build in memory dies with them, but the token
+// files and module interfaces they write are there for the next request.
+// Only clients of the same user are served.
+class Server {
+    std::string path;
+    int fd = -1;
+    Caches caches;
+
+    // Largest request read, and how long a client may take sending it or
+    // reading the reply.
+    static constexpr uint64_t MaxRequest = 64 << 20;
+    static constexpr int Timeout = 10;
+
+    void serve (int client);
+    void respond (int client, const RequestHeader &header, std::string_view body);
+
+    static void reply (int client, ReplyStatus status, const Output &output);
+    static bool decode (const RequestHeader &header, std::string_view body, std::string &cwd, Options &options);
+
+public:
+    explicit Server (std::string path);
+
+    Server (const Server&) = delete;
+    Server& operator= (const Server&) = delete;
+
+    ~Server ();
+
+    // Serves requests until accepting fails.
+    int run ();
+};
+
+Server::Server (std::string path) : path(std::move(path)) {
+    if (int live = connect_socket(this->path); live >= 0) {
+        ::close(live);
+        panic("a server is already listening on {}", this->path);
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (this->path.size() >= sizeof(addr.sun_path)) {
+        panic("socket path too long: {}", this->path);
+    }
+    std::memcpy(addr.sun_path, this->path.c_str(), this->path.size() + 1);
+
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        panic("could not create socket: {}", std::strerror(errno));
+    }
+    // A socket left by a server that did not exit cleanly.
+    ::unlink(this->path.c_str());
+    auto mask = ::umask(077);
+    auto bound = ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    ::umask(mask);
+    if (bound != 0 || ::listen(fd, 16) != 0) {
+        panic("could not listen on {}: {}", this->path, std::strerror(errno));
+    }
+}
+
+Server::~Server () {
+    if (fd >= 0) {
+        ::close(fd);
+        ::unlink(path.c_str());
+    }
+}
+
+int Server::run () {
+    std::fputs(std::format("lain: serving on {}\n", path).c_str(), stderr);
+    while (true) {
+        int client = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            panic("could not accept on {}: {}", path, std::strerror(errno));
+        }
+        serve(client);
+        ::close(client);
+    }
+}
+
+bool Server::decode (const RequestHeader &header, std::string_view body, std::string &cwd, Options &options) {
+    std::vector<std::string> fields;
+    while (!body.empty()) {
+        auto end = body.find('\0');
+        if (end == std::string_view::npos) {
+            return false;
+        }
+        fields.emplace_back(body.substr(0, end));
+        body.remove_prefix(end + 1);
+    }
+    if (fields.size() < 5 || header.jobs == 0 || header.dump > static_cast<uint8_t>(Options::Dump::Comp) ||
+        header.emit > 1) {
+        return false;
+    }
+
+    cwd = std::move(fields[0]);
+    options.trace = std::move(fields[1]);
+    options.token_cache = std::move(fields[2]);
+    options.module_dir = std::move(fields[3]);
+    options.inputs.assign(std::make_move_iterator(fields.begin() + 4), std::make_move_iterator(fields.end()));
+    // A client asking for more workers than there are cores gets one per core.
+    options.jobs = std::min(header.jobs, std::max(std::thread::hardware_concurrency(), 1u));
+    options.dump = static_cast<Options::Dump>(header.dump);
+    options.stats = header.stats != 0;
+    options.emit = header.emit != 0;
+    return true;
+}
+
+void Server::serve (int client) {
+    timeval timeout = {Timeout, 0};
+    ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    ucred peer;
+    socklen_t len = sizeof(peer);
+    if (::getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer, &len) != 0 || peer.uid != ::getuid()) {
+        return;
+    }
+
+    RequestHeader header;
+    if (!receive_all(client, &header, sizeof(header)) ||
+        std::memcmp(header.magic, "lain.rq", 8) != 0 || header.size > MaxRequest) {
+        return;
+    }
+    std::string body(header.size, '\0');
+    if (!receive_all(client, body.data(), body.size())) {
+        return;
+    }
+
+    // What the child prints, a panic above all, is kept for a child that
+    // dies before replying.
+    int log = ::memfd_create("lain-request", MFD_CLOEXEC);
+    auto child = ::fork();
+    if (child == 0) {
+        if (log >= 0) {
+            ::dup2(log, STDERR_FILENO);
+        }
+        respond(client, header, body);
+        // Nothing of the server's may be torn down here, its socket least.
+        ::_exit(0);
+    }
+
+    int status = 0;
+    while (child > 0 && ::waitpid(child, &status, 0) < 0 && errno == EINTR) {
+    }
+    Output output;
+    if (child < 0) {
+        reply(client, ReplyStatus::Refused, output);
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        if (log >= 0) {
+            char buf[4096];
+            ssize_t n;
+            for (off_t at = 0; (n = ::pread(log, buf, sizeof(buf), at)) > 0; at += n) {
+                output.err.append(buf, static_cast<std::size_t>(n));
+            }
+        }
+        output.err += WIFSIGNALED(status)
+            ? std::format("lain: the server's compile died: {}\n", ::strsignal(WTERMSIG(status)))
+            : std::format("lain: the server's compile exited with status {}\n", WEXITSTATUS(status));
+        output.failed = true;
+        reply(client, ReplyStatus::Failed, output);
+    }
+    if (log >= 0) {
+        ::close(log);
+    }
+}
+
+// Compiles one request and replies, in the child. A request that does not
+// decode gets no reply.
+void Server::respond (int client, const RequestHeader &header, std::string_view body) {
+    Output output;
+    auto status = ReplyStatus::Refused;
+    std::string cwd;
+    Options options;
+    if (header.version == server_version()) {
+        if (!decode(header, body, cwd, options)) {
+            return;
+        }
+        if (::chdir(cwd.c_str()) == 0) {
+            CountingAllocator::rebase();
+            caches.refresh();
+            Driver driver(options, caches);
+            output = driver.collect(options.emit && options.dump == Options::Dump::None);
+            status = output.failed ? ReplyStatus::Failed : ReplyStatus::Done;
+        }
+    }
+    reply(client, status, output);
+}
+
+void Server::reply (int client, ReplyStatus status, const Output &output) {
+    ReplyHeader reply{};
+    std::memcpy(reply.magic, "lain.rp", 8);
+    reply.status = static_cast<uint32_t>(status);
+    reply.out = output.out.size();
+    reply.err = output.err.size();
+    reply.trace = output.trace.size();
+    reply.code = output.code.size();
+    send_all(client, {reinterpret_cast<const char*>(&reply), sizeof(reply)}) &&
+        send_all(client, output.out) && send_all(client, output.err) && send_all(client, output.trace) &&
+        send_all(client, output.code);
+}
+
+// Compiles through the server listening on `options.connect`, printing what
+// compiling here would. Returns nothing if no server took the request, for
+// the caller to compile by itself.
+std::optional<int> compile_remote (const Options &options) {
+    // Standard input belongs to this process.
+    for (auto &input: options.inputs) {
+        if (input == "-") {
+            return std::nullopt;
+        }
+    }
+
+    char buf[PATH_MAX];
+    if (!::getcwd(buf, sizeof(buf))) {
+        return std::nullopt;
+    }
+    std::string cwd = buf;
+    auto absolute = [&](const std::string &dir) {
+        return dir.empty() || dir[0] == '/' ? dir : cwd + "/" + dir;
+    };
+
+    std::string body;
+    for (auto &field: {cwd, options.trace, absolute(options.token_cache), absolute(options.module_dir)}) {
+        body += field;
+        body += '\0';
+    }
+    for (auto &input: options.inputs) {
+        body += input;
+        body += '\0';
+    }
+
+    RequestHeader header{};
+    std::memcpy(header.magic, "lain.rq", 8);
+    header.version = server_version();
+    header.size = body.size();
+    header.jobs = options.jobs;
+    header.dump = static_cast<uint8_t>(options.dump);
+    header.stats = options.stats;
+    header.emit = options.emit;
+
+    int fd = connect_socket(options.connect);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    ReplyHeader reply;
+    Output output;
+    bool done = send_all(fd, {reinterpret_cast<const char*>(&header), sizeof(header)}) && send_all(fd, body) &&
+        receive_all(fd, &reply, sizeof(reply)) && std::memcmp(reply.magic, "lain.rp", 8) == 0 &&
+        reply.status != static_cast<uint32_t>(ReplyStatus::Refused);
+    if (done) {
+        output.out.resize(reply.out);
+        output.err.resize(reply.err);
+        output.trace.resize(reply.trace);
+        output.code.resize(reply.code);
+        done = receive_all(fd, output.out.data(), reply.out) && receive_all(fd, output.err.data(), reply.err) &&
+            receive_all(fd, output.trace.data(), reply.trace) && receive_all(fd, output.code.data(), reply.code);
+    }
+    ::close(fd);
+    if (!done) {
+        return std::nullopt;
+    }
+    output.failed = reply.status == static_cast<uint32_t>(ReplyStatus::Failed);
+    if (options.emit && options.dump == Options::Dump::None) {
+        iovec part{output.code.data(), output.code.size()};
+        write_code(options, {&part, 1});
+    }
+    return print_output(options, output);
+}
+
+}
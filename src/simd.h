@@ -0,0 +1,270 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define LAIN_SSE2 1
+#else
+#define LAIN_SSE2 0
+#endif
+
+namespace lain {
+
+// Character-class scanners over NUL padded buffers. Every kernel returns a
+// pointer to the first byte outside its class; NUL is outside every class, so
+// the padding of a SourceBuffer bounds the scan without an explicit length.
+// Vector loads may touch up to 31 bytes past the returned position.
+struct ScanKernels {
+    const char *(*space) (const char *p);
+    const char *(*ident) (const char *p);
+    const char *(*line) (const char *p);
+    // Appends the offset following every newline in [p, p + n).
+    void (*newlines) (const char *p, std::size_t n, std::vector<uint32_t> &out);
+    const char *name;
+};
+
+namespace scalar {
+
+constexpr bool is_space (char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+constexpr bool is_digit (char c) {
+    return c >= '0' && c <= '9';
+}
+
+constexpr bool is_alpha (char c) {
+    return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+constexpr bool is_alnum (char c) {
+    return is_alpha(c) || is_digit(c);
+}
+
+const char *space (const char *p) {
+    while (is_space(*p)) p++;
+    return p;
+}
+
+const char *ident (const char *p) {
+    while (is_alnum(*p)) p++;
+    return p;
+}
+
+const char *line (const char *p) {
+    while (*p && *p != '\n') p++;
+    return p;
+}
+
+void newlines (const char *p, std::size_t n, std::vector<uint32_t> &out) {
+    for (std::size_t i = 0; i < n; i++) {
+        if (p[i] == '\n') out.push_back(static_cast<uint32_t>(i + 1));
+    }
+}
+
+}
+
+#if LAIN_SSE2
+
+namespace sse2 {
+
+// Bytes >= 0x80 compare as negative, so they fall outside every range below.
+inline __m128i in_range (__m128i v, char lo, char hi) {
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+        _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(hi + 1))));
+}
+
+inline uint32_t space_mask (__m128i v) {
+    auto m = _mm_or_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+        in_range(v, '\t', '\r'));
+    return static_cast<uint32_t>(_mm_movemask_epi8(m));
+}
+
+inline uint32_t ident_mask (__m128i v) {
+    auto lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    auto m = _mm_or_si128(in_range(v, '0', '9'), in_range(lower, 'a', 'z'));
+    return static_cast<uint32_t>(_mm_movemask_epi8(m));
+}
+
+inline uint32_t line_mask (__m128i v) {
+    auto m = _mm_or_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+        _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    return static_cast<uint32_t>(_mm_movemask_epi8(m));
+}
+
+const char *space (const char *p) {
+    while (true) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto stop = ~space_mask(v) & 0xffff;
+        if (stop) return p + __builtin_ctz(stop);
+        p += 16;
+    }
+}
+
+const char *ident (const char *p) {
+    while (true) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto stop = ~ident_mask(v) & 0xffff;
+        if (stop) return p + __builtin_ctz(stop);
+        p += 16;
+    }
+}
+
+const char *line (const char *p) {
+    while (true) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto stop = line_mask(v);
+        if (stop) return p + __builtin_ctz(stop);
+        p += 16;
+    }
+}
+
+void newlines (const char *p, std::size_t n, std::vector<uint32_t> &out) {
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        auto m = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+        while (m) {
+            out.push_back(static_cast<uint32_t>(i + __builtin_ctz(m) + 1));
+            m &= m - 1;
+        }
+    }
+    for (; i < n; i++) {
+        if (p[i] == '\n') out.push_back(static_cast<uint32_t>(i + 1));
+    }
+}
+
+}
+
+namespace avx2 {
+
+[[gnu::target("avx2")]]
+inline __m256i in_range (__m256i v, char lo, char hi) {
+    return _mm256_and_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), v));
+}
+
+[[gnu::target("avx2")]]
+const char *space (const char *p) {
+    while (true) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        auto m = _mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+            in_range(v, '\t', '\r'));
+        auto stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(m));
+        if (stop) return p + __builtin_ctz(stop);
+        p += 32;
+    }
+}
+
+[[gnu::target("avx2")]]
+const char *ident (const char *p) {
+    while (true) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        auto lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        auto m = _mm256_or_si256(in_range(v, '0', '9'), in_range(lower, 'a', 'z'));
+        auto stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(m));
+        if (stop) return p + __builtin_ctz(stop);
+        p += 32;
+    }
+}
+
+[[gnu::target("avx2")]]
+const char *line (const char *p) {
+    while (true) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        auto m = _mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+            _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+        auto stop = static_cast<uint32_t>(_mm256_movemask_epi8(m));
+        if (stop) return p + __builtin_ctz(stop);
+        p += 32;
+    }
+}
+
+[[gnu::target("avx2")]]
+void newlines (const char *p, std::size_t n, std::vector<uint32_t> &out) {
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        auto m = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+        while (m) {
+            out.push_back(static_cast<uint32_t>(i + __builtin_ctz(m) + 1));
+            m &= m - 1;
+        }
+    }
+    for (; i < n; i++) {
+        if (p[i] == '\n') out.push_back(static_cast<uint32_t>(i + 1));
+    }
+}
+
+}
+
+#endif
+
+const ScanKernels &scan_kernels () {
+    static const ScanKernels kernels = []{
+#if LAIN_SSE2
+        if (__builtin_cpu_supports("avx2")) {
+            return ScanKernels{avx2::space, avx2::ident, avx2::line, avx2::newlines, "avx2"};
+        }
+        return ScanKernels{sse2::space, sse2::ident, sse2::line, sse2::newlines, "sse2"};
+#else
+        return ScanKernels{scalar::space, scalar::ident, scalar::line, scalar::newlines, "scalar"};
+#endif
+    }();
+    return kernels;
+}
+
+// Decimal digits parsed eight at a time within a 64-bit word, the first
+// byte in the low lane as a little-endian load leaves it.
+namespace swar {
+
+inline uint64_t load (const char *p) {
+    uint64_t w;
+    std::memcpy(&w, p, sizeof(w));
+    if constexpr (std::endian::native == std::endian::big) {
+        w = std::byteswap(w);
+    }
+    return w;
+}
+
+// Number of leading ASCII digits among the bytes of `w`. Bytes after the
+// first non-digit may be anything.
+constexpr uint32_t digit_count (uint64_t w) {
+    auto t = (w & 0xf0f0f0f0f0f0f0f0) | (((w + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) >> 4);
+    auto x = t ^ 0x3333333333333333;
+    auto stop = (((x & 0x7f7f7f7f7f7f7f7f) + 0x7f7f7f7f7f7f7f7f) | x) & 0x8080808080808080;
+    return stop ? static_cast<uint32_t>(std::countr_zero(stop)) / 8 : 8;
+}
+
+// Value of the first `n` bytes of `w`, all ASCII digits, for n from 1 to 8.
+// The digits are shifted into the high lanes, leaving zeros ahead of them,
+// then pairs, quads and octets are combined with three multiplies.
+constexpr uint32_t parse_digits (uint64_t w, uint32_t n) {
+    w -= 0x3030303030303030;
+    w <<= 8 * (8 - n);
+    w = w * 10 + (w >> 8);
+    w = (((w & 0x000000ff000000ff) * (100 + (1000000ull << 32))) +
+         (((w >> 16) & 0x000000ff000000ff) * (1 + (10000ull << 32)))) >> 32;
+    return static_cast<uint32_t>(w);
+}
+
+static_assert(digit_count(0x3837363534333231) == 8);
+static_assert(digit_count(0x3837362c34333231) == 4);
+static_assert(digit_count(0x383736353433323a) == 0);
+static_assert(parse_digits(0x3837363534333231, 8) == 12345678);
+static_assert(parse_digits(0x2c2c2c2c2c333231, 3) == 123);
+static_assert(parse_digits(0x0000000000000039, 1) == 9);
+
+}
+
+}
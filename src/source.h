@@ -0,0 +1,536 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "utils.h"
+#include "simd.h"
+#include "error.h"
+#include "allocator.h"
+
+namespace lain {
+
+// Read-only view of a source file. Regular files are mapped directly, anything
+// else (pipes, character devices) is read into a heap buffer. Either way the
+// buffer is followed by at least `Padding` zero bytes, so scanners may read a
+// full vector past the last character and always find a terminating NUL.
+class SourceBuffer {
+    enum class Kind {
+        Empty,
+        Mapped,
+        Buffered,
+    } kind = Kind::Empty;
+
+    char *base = nullptr;
+    std::size_t len = 0;
+    std::size_t cap = 0;
+
+    bool map (int fd, std::size_t size) noexcept;
+    bool read (int fd) noexcept;
+    void release () noexcept;
+
+public:
+    static constexpr std::size_t Padding = 64;
+
+    SourceBuffer () = default;
+    explicit SourceBuffer (const std::string &path) noexcept;
+
+    SourceBuffer (const SourceBuffer&) = delete;
+    SourceBuffer& operator= (const SourceBuffer&) = delete;
+
+    SourceBuffer (SourceBuffer &&other) noexcept;
+    SourceBuffer& operator= (SourceBuffer &&other) noexcept;
+
+    ~SourceBuffer () { release(); }
+
+    explicit operator bool () const noexcept { return kind != Kind::Empty; }
+
+    const char *data () const noexcept { return base; }
+    std::size_t size () const noexcept { return len; }
+    bool mapped () const noexcept { return kind == Kind::Mapped; }
+
+    const char &operator[] (std::size_t i) const noexcept { return base[i]; }
+
+    std::string_view view () const noexcept { return {base, len}; }
+
+    // Heap buffer holding a copy of `text`.
+    static SourceBuffer from (std::string_view text) noexcept;
+
+    // Replaces `removed` bytes at `offset` with `inserted`, copying a mapped
+    // file to the heap first.
+    bool splice (std::size_t offset, std::size_t removed, std::string_view inserted) noexcept;
+};
+
+SourceBuffer SourceBuffer::from (std::string_view text) noexcept {
+    SourceBuffer buffer;
+    auto capacity = std::max<std::size_t>(text.size(), 1 << 12);
+    auto data = static_cast<char*>(heap_alloc(capacity + Padding, Subsystem::Source));
+    if (!data) {
+        return buffer;
+    }
+    std::memcpy(data, text.data(), text.size());
+    std::memset(data + text.size(), 0, Padding);
+    buffer.kind = Kind::Buffered;
+    buffer.base = data;
+    buffer.len = text.size();
+    buffer.cap = capacity + Padding;
+    return buffer;
+}
+
+bool SourceBuffer::splice (std::size_t offset, std::size_t removed, std::string_view inserted) noexcept {
+    if (offset > len || removed > len - offset) {
+        return false;
+    }
+    if (kind != Kind::Buffered) {
+        auto copy = from(view());
+        if (!copy) {
+            return false;
+        }
+        *this = std::move(copy);
+    }
+
+    auto size = len - removed + inserted.size();
+    if (size + Padding > cap) {
+        auto capacity = std::max(size, cap * 2);
+        auto grown = static_cast<char*>(heap_resize(base, cap, capacity + Padding, Subsystem::Source));
+        if (!grown) {
+            return false;
+        }
+        base = grown;
+        cap = capacity + Padding;
+    }
+
+    if (inserted.size() != removed) {
+        std::memmove(base + offset + inserted.size(), base + offset + removed, len - offset - removed);
+    }
+    std::memcpy(base + offset, inserted.data(), inserted.size());
+    len = size;
+    std::memset(base + len, 0, Padding);
+    return true;
+}
+
+SourceBuffer::SourceBuffer (const std::string &path) noexcept {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        if (!map(fd, static_cast<std::size_t>(st.st_size))) {
+            read(fd);
+        }
+    } else {
+        read(fd);
+    }
+
+    ::close(fd);
+}
+
+SourceBuffer::SourceBuffer (SourceBuffer &&other) noexcept
+    : kind(other.kind), base(other.base), len(other.len), cap(other.cap) {
+    other.kind = Kind::Empty;
+    other.base = nullptr;
+    other.len = other.cap = 0;
+}
+
+SourceBuffer& SourceBuffer::operator= (SourceBuffer &&other) noexcept {
+    if (this != &other) {
+        release();
+        kind = other.kind;
+        base = other.base;
+        len = other.len;
+        cap = other.cap;
+        other.kind = Kind::Empty;
+        other.base = nullptr;
+        other.len = other.cap = 0;
+    }
+    return *this;
+}
+
+bool SourceBuffer::map (int fd, std::size_t size) noexcept {
+    const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    const auto total = (size + Padding + page - 1) & ~(page - 1);
+
+    // Reserve zeroed anonymous pages for the whole range first, then map the
+    // file over the front. The kernel zero-fills the tail of the last file
+    // page, and the pages after it stay anonymous, so the padding is never
+    // backed by the file and cannot SIGBUS.
+    void *region = ::mmap(nullptr, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        return false;
+    }
+
+    void *file = ::mmap(region, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    if (file == MAP_FAILED) {
+        ::munmap(region, total);
+        return false;
+    }
+
+    ::madvise(region, total, MADV_SEQUENTIAL);
+
+    kind = Kind::Mapped;
+    base = static_cast<char*>(region);
+    len = size;
+    cap = total;
+    return true;
+}
+
+bool SourceBuffer::read (int fd) noexcept {
+    std::size_t size = 0, capacity = 1 << 16;
+    auto buffer = static_cast<char*>(heap_alloc(capacity + Padding, Subsystem::Source));
+    if (!buffer) {
+        return false;
+    }
+
+    while (true) {
+        if (size == capacity) {
+            auto grown = static_cast<char*>(heap_resize(buffer, capacity + Padding, capacity * 2 + Padding, Subsystem::Source));
+            if (!grown) {
+                heap_free(buffer, capacity + Padding, Subsystem::Source);
+                return false;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+        auto n = ::read(fd, buffer + size, capacity - size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            heap_free(buffer, capacity + Padding, Subsystem::Source);
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        size += static_cast<std::size_t>(n);
+    }
+
+    std::memset(buffer + size, 0, Padding);
+
+    kind = Kind::Buffered;
+    base = buffer;
+    len = size;
+    cap = capacity + Padding;
+    return true;
+}
+
+void SourceBuffer::release () noexcept {
+    switch (kind) {
+    case Kind::Mapped:
+        ::munmap(base, cap);
+        break;
+    case Kind::Buffered:
+        heap_free(base, cap, Subsystem::Source);
+        break;
+    case Kind::Empty:
+        break;
+    }
+    kind = Kind::Empty;
+    base = nullptr;
+    len = cap = 0;
+}
+
+bool is_regular_file (const std::string &path) noexcept {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// Offset in the combined address space of every loaded source. Each file
+// owns the range [base, base + size], the last value being its end of file,
+// so a single 32-bit value identifies both the file and the byte. Only files
+// loaded at once share the space: a released file's range is used again.
+enum class Loc : uint32_t {
+    None = 0,
+};
+
+struct Location {
+    std::string_view file;
+    std::string_view line;
+    uint row, col;
+};
+
+struct SourceFile {
+    std::string path;
+    SourceBuffer buffer;
+    uint32_t id;
+    uint32_t base;
+
+    // Line start offsets, built by the first diagnostic that needs them.
+    mutable std::vector<uint32_t> lines;
+    mutable std::once_flag indexed;
+
+    Loc loc (std::size_t offset) const {
+        return static_cast<Loc>(base + offset);
+    }
+
+    const std::vector<uint32_t> &line_starts () const;
+
+    Location locate (std::size_t offset) const;
+};
+
+const std::vector<uint32_t> &SourceFile::line_starts () const {
+    std::call_once(indexed, [this]{
+        lines.push_back(0);
+        scan_kernels().newlines(buffer.data(), buffer.size(), lines);
+    });
+    return lines;
+}
+
+Location SourceFile::locate (std::size_t offset) const {
+    auto &starts = line_starts();
+
+    auto it = std::upper_bound(starts.begin(), starts.end(), offset);
+    auto row = static_cast<uint>(it - starts.begin()) - 1;
+    std::size_t begin = starts[row];
+    std::size_t end = row + 1 < starts.size() ? starts[row + 1] - 1 : buffer.size();
+
+    return {
+        path,
+        buffer.view().substr(begin, end - begin),
+        row,
+        static_cast<uint>(offset - begin),
+    };
+}
+
+class SourceManager {
+    // Loaded files, by base.
+    std::vector<uptr<SourceFile>> files;
+    uint32_t loaded = 0;
+    mutable std::mutex lock;
+
+public:
+    const SourceFile *load (const std::string &path);
+
+    // Forgets `file`, freeing its text and its range of the address space.
+    // Nothing located in it may be used afterwards.
+    void release (const SourceFile *file);
+
+    const SourceFile &file (Loc loc) const;
+
+    Location resolve (Loc loc) const;
+
+    // Forgets every file, freeing their text and address space. Nothing
+    // loaded before may be used afterwards.
+    void clear ();
+};
+
+const SourceFile *SourceManager::load (const std::string &path) {
+    SourceBuffer buffer(path);
+    if (!buffer) {
+        return nullptr;
+    }
+
+    // After the last file if there is room, or else in the first gap a
+    // released one left that is large enough.
+    auto end = [](const uptr<SourceFile> &file) { return uint64_t{file->base} + file->buffer.size() + 1; };
+    auto need = uint64_t{buffer.size()} + 1;
+    std::unique_lock guard(lock);
+    auto at = files.end();
+    uint64_t base = files.empty() ? 1 : end(files.back());
+    if (base + need > UINT32_MAX) {
+        base = 1;
+        for (at = files.begin(); at != files.end() && (*at)->base < base + need; at++) {
+            base = end(*at);
+        }
+        if (at == files.end()) {
+            // A failing thread never returns, so it must not keep the lock.
+            guard.unlock();
+            panic("source address space exhausted loading {}", path);
+        }
+    }
+    auto file = uptr<SourceFile>(new SourceFile{path, std::move(buffer), loaded++, static_cast<uint32_t>(base), {}, {}});
+    return files.insert(at, std::move(file))->get();
+}
+
+void SourceManager::release (const SourceFile *file) {
+    std::lock_guard guard(lock);
+    auto it = std::lower_bound(files.begin(), files.end(), file->base,
+        [](const uptr<SourceFile> &file, uint32_t base) { return file->base < base; });
+    if (it != files.end() && it->get() == file) {
+        files.erase(it);
+    }
+}
+
+void SourceManager::clear () {
+    std::lock_guard guard(lock);
+    files.clear();
+    loaded = 0;
+}
+
+const SourceFile &SourceManager::file (Loc loc) const {
+    auto pos = static_cast<uint32_t>(loc);
+    std::lock_guard guard(lock);
+    auto it = std::upper_bound(files.begin(), files.end(), pos,
+        [](uint32_t pos, const uptr<SourceFile> &file) { return pos < file->base; });
+    if (it == files.begin()) {
+        panic("Invalid source location {}", pos);
+    }
+    return **(it - 1);
+}
+
+Location SourceManager::resolve (Loc loc) const {
+    auto &src = file(loc);
+    return src.locate(static_cast<uint32_t>(loc) - src.base);
+}
+
+// Sliding window over a sequential input such as a pipe. The window always
+// ends in `Padding` zero bytes like a SourceBuffer, and only ever needs to hold
+// the lines that are still referenced, so memory stays bounded however long
+// the input runs. Positions are absolute byte offsets into the whole input.
+class StreamReader {
+    std::string path;
+    int fd = -1;
+    bool owned = false;
+    bool done = false;
+
+    char *buf = nullptr;
+    std::size_t cap = 0;
+    // The window is `size` bytes at `buf + head`. Dropped lines are only
+    // moved out once they take half the buffer, so each byte is moved a
+    // bounded number of times however small the reads.
+    std::size_t head = 0;
+    std::size_t size = 0;
+    std::size_t start = 0;
+    std::size_t lines = 0;
+
+public:
+    static constexpr std::size_t ChunkSize = 1 << 16;
+    static constexpr std::size_t Padding = SourceBuffer::Padding;
+
+    explicit StreamReader (const std::string &path) noexcept;
+
+    StreamReader (const StreamReader&) = delete;
+    StreamReader& operator= (const StreamReader&) = delete;
+
+    ~StreamReader ();
+
+    explicit operator bool () const noexcept { return fd >= 0 && buf; }
+
+    const std::string &name () const noexcept { return path; }
+    const char *data () const noexcept { return buf + head; }
+
+    std::size_t begin () const noexcept { return start; }
+    std::size_t end () const noexcept { return start + size; }
+
+    // End of the last complete line in the window, or of all input at EOF.
+    std::size_t complete () const noexcept;
+
+    // Drops the window before the line holding `keep`, then reads until a new
+    // complete line arrives. Returns false once the input is exhausted.
+    bool fill (std::size_t keep);
+
+    Location locate (std::size_t pos) const;
+
+    // Bytes currently held, including padding.
+    std::size_t capacity () const noexcept { return cap + Padding; }
+};
+
+StreamReader::StreamReader (const std::string &path) noexcept : path(path) {
+    if (path == "-") {
+        fd = STDIN_FILENO;
+        this->path = "<stdin>";
+    } else {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        owned = true;
+    }
+    cap = ChunkSize;
+    buf = static_cast<char*>(heap_alloc(cap + Padding, Subsystem::Lexer));
+    if (buf) {
+        std::memset(buf, 0, Padding);
+    }
+}
+
+StreamReader::~StreamReader () {
+    if (owned && fd >= 0) {
+        ::close(fd);
+    }
+    heap_free(buf, cap + Padding, Subsystem::Lexer);
+}
+
+std::size_t StreamReader::complete () const noexcept {
+    if (done) {
+        return end();
+    }
+    auto nl = static_cast<const char*>(::memrchr(buf + head, '\n', size));
+    return nl ? start + static_cast<std::size_t>(nl - (buf + head)) + 1 : start;
+}
+
+bool StreamReader::fill (std::size_t keep) {
+    if (done) {
+        return false;
+    }
+
+    auto window = buf + head;
+    keep = std::clamp(keep, start, end()) - start;
+    auto nl = static_cast<const char*>(::memrchr(window, '\n', keep));
+    auto drop = nl ? static_cast<std::size_t>(nl - window) + 1 : 0;
+    if (drop) {
+        lines += static_cast<std::size_t>(std::count(window, window + drop, '\n'));
+        head += drop;
+        size -= drop;
+        start += drop;
+    }
+
+    auto before = complete();
+    while (!done && complete() == before) {
+        if (cap - head - size < ChunkSize / 2 && head >= cap / 2) {
+            std::memmove(buf, buf + head, size);
+            head = 0;
+        }
+        if (cap - head - size < ChunkSize / 2) {
+            auto grown = static_cast<char*>(heap_resize(buf, cap + Padding, cap * 2 + Padding, Subsystem::Lexer));
+            if (!grown) {
+                panic("Allocation failure");
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        auto n = ::read(fd, buf + head + size, cap - head - size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            panic("could not read {}", path);
+        }
+        if (n == 0) {
+            done = true;
+        }
+        size += static_cast<std::size_t>(n);
+        std::memset(buf + head + size, 0, Padding);
+    }
+    return complete() != before;
+}
+
+Location StreamReader::locate (std::size_t pos) const {
+    auto window = buf + head;
+    auto offset = std::clamp(pos, start, end()) - start;
+    auto first = static_cast<const char*>(::memrchr(window, '\n', offset));
+    auto begin = first ? static_cast<std::size_t>(first - window) + 1 : 0;
+    auto last = static_cast<const char*>(std::memchr(window + offset, '\n', size - offset));
+    auto stop = last ? static_cast<std::size_t>(last - window) : size;
+
+    return {
+        path,
+        {window + begin, stop - begin},
+        static_cast<uint>(lines + static_cast<std::size_t>(std::count(window, window + begin, '\n'))),
+        static_cast<uint>(offset - begin),
+    };
+}
+
+SourceManager &global_sources () {
+    static SourceManager sources;
+    return sources;
+}
+
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "utils.h"
+
+namespace lain {
+
+using Clock = std::chrono::steady_clock;
+
+// One span of work on one thread, as a Chrome "complete" event.
+struct TraceEvent {
+    const char *name;
+    std::string detail;
+    uint thread;
+    Clock::time_point start;
+    Clock::duration length;
+};
+
+// Collects trace events from every thread. Events are recorded per phase of
+// a file, not per token, so a single lock is cheap enough, and nothing at
+// all is kept while the trace is off.
+class Trace {
+    std::mutex lock;
+    std::vector<TraceEvent> events;
+    std::vector<std::pair<std::string, double>> counters;
+    Clock::time_point epoch = Clock::now();
+
+public:
+    bool enabled = false;
+
+    void record (TraceEvent event);
+
+    // Adds a value shown as a counter track at the end of the trace.
+    void count (std::string name, double value);
+
+    // Trace-event JSON, loadable by chrome://tracing and Perfetto.
+    std::string json ();
+
+    // Drops everything recorded so far and starts the clock again.
+    void clear ();
+};
+
+Trace &global_trace () {
+    static Trace trace;
+    return trace;
+}
+
+void Trace::record (TraceEvent event) {
+    if (!enabled) {
+        return;
+    }
+    std::lock_guard guard(lock);
+    events.push_back(std::move(event));
+}
+
+void Trace::count (std::string name, double value) {
+    if (!enabled) {
+        return;
+    }
+    std::lock_guard guard(lock);
+    counters.emplace_back(std::move(name), value);
+}
+
+void Trace::clear () {
+    std::lock_guard guard(lock);
+    events.clear();
+    counters.clear();
+    epoch = Clock::now();
+}
+
+// Escapes the characters JSON strings cannot hold as they are.
+void json_escape (std::string &out, std::string_view str) {
+    for (char c: str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += std::format("\\u{:04x}", static_cast<unsigned>(c));
+        } else {
+            out += c;
+        }
+    }
+}
+
+std::string Trace::json () {
+    std::lock_guard guard(lock);
+    auto micros = [](Clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    };
+
+    std::string out = "{\"traceEvents\":[\n";
+    Clock::time_point end = epoch;
+    for (auto &event: events) {
+        out += std::format("{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}",
+            event.name, event.thread, micros(event.start - epoch), micros(event.length));
+        if (!event.detail.empty()) {
+            out += ",\"args\":{\"detail\":\"";
+            json_escape(out, event.detail);
+            out += "\"}";
+        }
+        out += "},\n";
+        end = std::max(end, event.start + event.length);
+    }
+    for (auto &[name, value]: counters) {
+        out += std::format("{{\"name\":\"{}\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":{:.3f},\"args\":{{\"value\":{}}}}},\n",
+            name, micros(end - epoch), value);
+    }
+    out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"lain\"}}\n]}\n";
+    return out;
+}
+
+// Times the enclosing scope. The elapsed milliseconds are added to `total`,
+// and when tracing, the scope is also recorded as a trace event. Costs two
+// clock reads when the trace is off.
+class ScopedTimer {
+    const char *name;
+    std::string_view detail;
+    double *total;
+    uint thread;
+    Clock::time_point start = Clock::now();
+    bool running = true;
+
+public:
+    ScopedTimer (const char *name, double &total, std::string_view detail = {}, uint thread = 0)
+        : name(name), detail(detail), total(&total), thread(thread) {}
+
+    ScopedTimer (const ScopedTimer&) = delete;
+    ScopedTimer& operator= (const ScopedTimer&) = delete;
+
+    ~ScopedTimer () {
+        stop();
+    }
+
+    // Ends the scope early, for work whose results must outlive the timer.
+    void stop () {
+        if (!running) {
+            return;
+        }
+        running = false;
+        auto length = Clock::now() - start;
+        *total += std::chrono::duration<double, std::milli>(length).count();
+        auto &trace = global_trace();
+        if (trace.enabled) {
+            trace.record({name, std::string(detail), thread, start, length});
+        }
+    }
+};
+
+// Peak resident set of the process so far, in KiB.
+std::size_t peak_rss () {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return static_cast<std::size_t>(usage.ru_maxrss);
+}
+
+}
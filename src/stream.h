@@ -1,70 +1,204 @@
 #pragma once
 
+#include <array>
+
 #include "lexer.h"
 #include "error.h"
 
 namespace lain {
 
+// Cursor over the tokens of one source. A file is lexed up front into a
+// TokenBuffer, or its columns come from the token cache; a stream is lexed on
+// demand into a ring of the most recent `Window` tokens, keeping half of it as
+// lookbehind and allowing up to the other half as lookahead, so memory does
+// not grow with the input. Token text from a stream is only valid until the
+// next token is pulled.
 class TokenStream {
+    static constexpr std::size_t Window = 64;
+
     Lexer lexer;
 
-    const std::vector<Token> &tokens;
+    // Every token of the file, when lexed up front or loaded from a cache.
+    TokenColumns tokens;
+    bool buffered = false;
+    std::size_t held = 0;
+    std::size_t hint = 0;
+
+    std::array<Lexeme, Window> ring;
+    std::size_t lexed = 0;
+
     std::size_t it = 0;
 
+    // Set by a syntax error until recover. Meanwhile the stream reads as
+    // ended, so the parser unwinds without reporting knock-on errors.
+    bool failing = false;
+
+    const Lexeme &pull (std::size_t i) {
+        if (i + Window / 2 < lexed || i >= it + Window / 2) {
+            panic("Token {} outside the stream window", i);
+        }
+        while (lexed <= i) {
+            if (lexed && ring[(lexed - 1) % Window].type == Token::Eof) {
+                ring[lexed % Window] = ring[(lexed - 1) % Window];
+            } else {
+                // The slot after this one holds the oldest token kept.
+                if (lexed + 1 >= Window) {
+                    lexer.release(ring[(lexed + 1) % Window].pos);
+                }
+                ring[lexed % Window] = lexer.next();
+            }
+            lexed++;
+        }
+        return ring[i % Window];
+    }
+
+    Token at (std::size_t i) {
+        if (buffered) {
+            return tokens.at(std::min(i, tokens.size() - 1), hint);
+        }
+        auto &lex = pull(i);
+        return make_token(lex, lexer.text(lex.pos, lex.len));
+    }
+
 public:
-    TokenStream (const std::string &path) 
-        : lexer(path), tokens(lexer.scan()) {}
+    // Lexes all of `file` up front, in chunks on `pool` if there is one.
+    TokenStream (const SourceFile &file, Interner &interner = global_interner(), WorkPool *pool = nullptr)
+        : lexer(file, interner) {
+        auto &buffer = pool ? lexer.scan(*pool) : lexer.scan();
+        tokens = buffer.columns();
+        buffered = true;
+        held = buffer.bytes();
+    }
+
+    // Cursor over tokens already lexed from `file`, starting at token `start`.
+    // The columns must outlive the stream.
+    TokenStream (const SourceFile &file, TokenColumns tokens, std::size_t start = 0,
+                 Interner &interner = global_interner())
+        : lexer(file, interner, 0, 0), tokens(tokens), buffered(true), it(start) {}
 
-    const Token &peek (long off = 0) const {
+    TokenStream (const SourceFile &file, const TokenBuffer &tokens, std::size_t start,
+                 Interner &interner = global_interner())
+        : TokenStream(file, tokens.columns(), start, interner) {
+        held = tokens.bytes();
+    }
+
+    TokenStream (StreamReader &reader, Interner &interner = global_interner())
+        : lexer(reader, interner) {}
+
+    Token peek (long off = 0) {
+        if (failing) [[unlikely]] {
+            return eof();
+        }
         if (off < 0 && static_cast<std::size_t>(-off) > it) {
-            syntax_error("Token expected before BOF");
-        } else if (it + off > tokens.size()) {
-            return tokens.back();
+            syntax_error(Diag::BeforeBof);
+            return eof();
         }
-        return tokens[it];
+        return at(it + off);
     }
 
-    const Token &bump () {
-        if (it >= tokens.size() - 1) {
-            syntax_error("EOF bumped");
+    Token bump () {
+        if (done()) {
+            syntax_error(Diag::EofBumped);
+            return eof();
         }
-        return tokens[it++];
+        return at(it++);
     }
 
-    const Token &consume (Token::Type type) {
-        auto &token = tokens[it];
+    Token consume (Token::Type type) {
+        auto token = peek();
         if (token.type != type) {
-            syntax_error("Expected {} not {}", to_string(type), to_string(token.type));
+            syntax_error(Diag::ExpectedToken, type, token.type);
+            return eof();
         }
         return bump();
     }
 
-    bool done () const {
-        return it >= tokens.size() - 1;
+    // Whether a syntax error is waiting for recover.
+    bool failed () const { return failing; }
+
+    // Resumes after a syntax error at the next statement or declaration:
+    // past a `;` or a whole `{}` block, or before a `}` closing the current
+    // one or a keyword starting a new construct. With nothing left to resume
+    // at, the stream stays failed, so enclosing constructs unwind quietly.
+    void recover () {
+        failing = false;
+        std::size_t depth = 0;
+        for (bool skipped = false; !done(); skipped = true) {
+            auto type = at(it).type;
+            if (depth == 0 && (type == Token::RBrace ||
+                (skipped && type != Token::Else && (categorize(type) & Category::Keyword)))) {
+                return;
+            }
+            it++;
+            if (type == Token::LBrace) {
+                depth++;
+            } else if (type == Token::RBrace && --depth == 0) {
+                return;
+            } else if (type == Token::Semi && depth == 0) {
+                return;
+            }
+        }
+        failing = true;
     }
 
+    // Tokens consumed so far.
+    std::size_t position () const { return it; }
+
+    // Heap bytes held by the token store; a stream keeps only its window.
+    std::size_t bytes () const { return held; }
+
+    Loc loc (const Token &token) const {
+        return lexer.loc(token.pos);
+    }
+
+    bool done () {
+        if (failing) [[unlikely]] {
+            return true;
+        }
+        if (buffered) {
+            return it >= tokens.size() - 1;
+        }
+        return pull(it).type == Token::Eof;
+    }
+
+    // Reports `id` at the current token, unless an earlier error has not
+    // been recovered from yet or the statement already has a lexical error,
+    // which most likely caused this one.
     template<typename... Args>
-    void syntax_error(const std::format_string<Args...> fmt, Args&&... args) const {
-        const auto &token = tokens[it];
-        
-        auto loc = error_location(lexer.name(), token.row, token.col);
-
-        auto line = lexer.line(token.row);
-        auto pre = line.substr(0, token.col);
-        auto tok = line.substr(token.col, token.len);
-        auto post = line.substr(token.col + token.len);
-        
-        std::string error_msg = std::format(fmt, std::forward<Args>(args)...);
-        
-        std::string msg = std::format(
-            "{} {}error:{} {}\n{}{}{}{}{}\n{:>{}}{}^{}\n", 
-            loc, Ansi::RedFB, Ansi::Reset, error_msg,
-            pre, Ansi::RedFB, tok, Ansi::Reset, post,
-            "", pre.size(), Ansi::RedFB, Ansi::Reset
-        );
-
-        term(msg);
+    [[gnu::cold]] void syntax_error(Diag id, Args... args) {
+        if (failing) {
+            return;
+        }
+        auto token = at(it);
+        if (!diagnostic_sink || !diagnostic_sink->lexical(statement_start(), token.pos + token.len)) {
+            const uint64_t packed[] = {diag_arg(args)..., 0};
+            raise_diagnostic(id, lexer.locate(token.pos), token.pos, token.len, packed);
+        }
+        failing = true;
+    }
+
+private:
+    // Position of the first token after the last `;`, `{` or `}`, looking
+    // back no further than a stream still holds.
+    std::size_t statement_start () {
+        auto floor = buffered || lexed <= Window / 2 ? 0 : lexed - Window / 2;
+        auto i = it;
+        for (; i > floor; i--) {
+            auto type = at(i - 1).type;
+            if (type == Token::Semi || type == Token::LBrace || type == Token::RBrace) {
+                break;
+            }
+        }
+        return at(i).pos;
+    }
+
+    // What the stream reads as once it failed.
+    Token eof () {
+        Token token;
+        token.type = Token::Eof;
+        token.pos = at(it).pos;
+        return token;
     }
 };
 
-}
\ No newline at end of file
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string_view>
+#include <algorithm>
+#include <utility>
 #include <cstdint>
 #include <array>
 
@@ -29,4 +31,235 @@ consteval auto max_len (const std::array<std::string_view, N>& arr) {
         len = std::max(len, val.size());
     }
     return len;
-}
\ No newline at end of file
+}
+template <std::size_t K, class T, std::size_t N, class P>
+consteval auto extract_if (const std::array<T,N>& arr, P pred) {
+    std::array<T, K> result{};
+    std::size_t k = 0;
+    for (const auto &entry: arr) {
+        if (pred(entry)) {
+            result[k++] = entry;
+        }
+    }
+    return result;
+}
+
+// Lays key/value pairs out as an array indexed by key, for dense enum keys.
+template <std::size_t Size, class K, class V, std::size_t N>
+consteval auto dense_table (const std::array<std::pair<K,V>, N>& pairs, V fallback) {
+    std::array<V, Size> result{};
+    result.fill(fallback);
+    for (const auto &[key, value]: pairs) {
+        result[static_cast<std::size_t>(key)] = value;
+    }
+    return result;
+}
+
+template <class K, class V, std::size_t N>
+consteval std::size_t key_span (const std::array<std::pair<K,V>, N>& pairs) {
+    std::size_t span = 0;
+    for (const auto &pair: pairs) {
+        span = std::max(span, static_cast<std::size_t>(pair.first) + 1);
+    }
+    return span;
+}
+
+constexpr uint64_t hash_bytes (std::string_view str) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (char c: str) {
+        h = (h ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    }
+    return h;
+}
+
+constexpr uint64_t hash_mix (uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    return x;
+}
+
+// Minimal perfect hash over a fixed string key set, built with hash and
+// displace: keys are grouped into buckets by the low hash half, and each
+// bucket gets a displacement that moves all of its keys into free slots.
+// Lookups are one hash, one displacement load and one key compare.
+template <class V, std::size_t N>
+struct PerfectMap {
+    static constexpr std::size_t Buckets = N / 2 + 1;
+
+    std::array<uint32_t, Buckets> disp{};
+    std::array<std::string_view, N> keys{};
+    std::array<V, N> values{};
+    bool ok = false;
+
+    static constexpr std::size_t place (uint64_t h, uint32_t d) {
+        return hash_mix((h >> 32) + d) % N;
+    }
+
+    constexpr std::size_t slot (uint64_t h) const {
+        return place(h, disp[(h & 0xffffffff) % Buckets]);
+    }
+
+    constexpr const V *find (std::string_view str, uint64_t h) const {
+        auto i = slot(h);
+        return keys[i] == str ? &values[i] : nullptr;
+    }
+
+    constexpr const V *find (std::string_view str) const {
+        return find(str, hash_bytes(str));
+    }
+};
+
+template <class V, std::size_t N>
+consteval auto make_perfect_map (const std::array<std::pair<std::string_view, V>, N>& pairs) {
+    using Map = PerfectMap<V, N>;
+    Map map{};
+
+    std::array<std::size_t, N> bucket{};
+    std::array<std::size_t, Map::Buckets> load{};
+    for (std::size_t i = 0; i < N; i++) {
+        bucket[i] = (hash_bytes(pairs[i].first) & 0xffffffff) % Map::Buckets;
+        load[bucket[i]]++;
+    }
+
+    std::array<bool, N> taken{};
+    // Largest buckets first, while the most slots are still free.
+    for (std::size_t size = N; size > 0; size--) {
+        for (std::size_t b = 0; b < Map::Buckets; b++) {
+            if (load[b] != size) {
+                continue;
+            }
+            bool placed = false;
+            for (uint32_t d = 0; d < (1u << 20) && !placed; d++) {
+                std::array<bool, N> trial = taken;
+                placed = true;
+                for (std::size_t i = 0; i < N && placed; i++) {
+                    if (bucket[i] != b) {
+                        continue;
+                    }
+                    auto s = Map::place(hash_bytes(pairs[i].first), d);
+                    placed = !trial[s];
+                    trial[s] = true;
+                }
+                if (placed) {
+                    taken = trial;
+                    map.disp[b] = d;
+                }
+            }
+            if (!placed) {
+                return map;
+            }
+        }
+    }
+
+    for (const auto &[key, value]: pairs) {
+        auto s = map.slot(hash_bytes(key));
+        map.keys[s] = key;
+        map.values[s] = value;
+    }
+    map.ok = true;
+    return map;
+}
+
+template <class T, std::size_t K>
+consteval std::size_t count_prefixes (const std::array<T,K>& arr, std::string_view T::* key) {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < K; i++) {
+        for (std::size_t len = 1; len <= (arr[i].*key).size(); len++) {
+            auto prefix = (arr[i].*key).substr(0, len);
+            bool seen = false;
+            for (std::size_t j = 0; j < i && !seen; j++) {
+                seen = (arr[j].*key).substr(0, len) == prefix;
+            }
+            count += !seen;
+        }
+    }
+    return count;
+}
+
+// Longest-match trie over a fixed string key set. The first byte is resolved
+// through a 256 entry table; every node keeps its children contiguous, so each
+// further byte is a short scan over sibling labels.
+template <class V, std::size_t N, std::size_t K>
+struct PrefixTrie {
+    static_assert(N < 256 && K < 256, "PrefixTrie indices are one byte");
+
+    struct Node {
+        char label;
+        uint8_t accept;
+        uint8_t first;
+        uint8_t count;
+    };
+
+    std::array<uint8_t, 256> root{};
+    std::array<Node, N + 1> nodes{};
+    std::array<V, K + 1> values{};
+
+    constexpr const V &match (const char *src) const {
+        std::size_t node = root[static_cast<uint8_t>(*src)];
+        std::size_t best = nodes[node].accept;
+        while (nodes[node].count) {
+            src++;
+            std::size_t next = 0;
+            for (std::size_t i = nodes[node].first; i < nodes[node].first + nodes[node].count; i++) {
+                if (nodes[i].label == *src) {
+                    next = i;
+                    break;
+                }
+            }
+            if (!next) {
+                break;
+            }
+            node = next;
+            if (nodes[node].accept) {
+                best = nodes[node].accept;
+            }
+        }
+        return values[best];
+    }
+};
+
+template <std::size_t N, class T, std::size_t K>
+consteval auto make_prefix_trie (const std::array<T,K>& arr, std::string_view T::* key, T fallback) {
+    PrefixTrie<T, N, K> trie{};
+
+    // Sorting prefixes by length then bytes lays the trie out breadth first,
+    // with the children of every node adjacent.
+    std::array<std::string_view, N> prefixes{};
+    std::size_t n = 0;
+    for (const auto &entry: arr) {
+        for (std::size_t len = 1; len <= (entry.*key).size(); len++) {
+            auto prefix = (entry.*key).substr(0, len);
+            if (std::find(prefixes.begin(), prefixes.begin() + n, prefix) == prefixes.begin() + n) {
+                prefixes[n++] = prefix;
+            }
+        }
+    }
+    std::sort(prefixes.begin(), prefixes.end(), [](auto a, auto b) {
+        return a.size() != b.size() ? a.size() < b.size() : a < b;
+    });
+
+    for (std::size_t i = 0; i < N; i++) {
+        auto &node = trie.nodes[i + 1];
+        node.label = prefixes[i].back();
+        if (prefixes[i].size() == 1) {
+            trie.root[static_cast<uint8_t>(node.label)] = static_cast<uint8_t>(i + 1);
+        }
+        for (std::size_t j = i + 1; j < N; j++) {
+            if (prefixes[j].size() == prefixes[i].size() + 1 && prefixes[j].starts_with(prefixes[i])) {
+                if (!node.count) {
+                    node.first = static_cast<uint8_t>(j + 1);
+                }
+                node.count++;
+            }
+        }
+    }
+
+    trie.values[0] = fallback;
+    for (std::size_t k = 0; k < K; k++) {
+        auto it = std::find(prefixes.begin(), prefixes.end(), arr[k].*key);
+        trie.nodes[static_cast<std::size_t>(it - prefixes.begin()) + 1].accept = static_cast<uint8_t>(k + 1);
+        trie.values[k + 1] = arr[k];
+    }
+    return trie;
+}
@@ -1,19 +1,20 @@
 #pragma once
 
-#include <unordered_map>
+#include <algorithm>
 #include <cstdint>
-#include <cstring>
 #include <string>
 #include <vector>
 #include <span>
 
 #include "utils.h"
 #include "table.h"
+#include "intern.h"
+#include "allocator.h"
 
 namespace lain {
 
 struct Token {
-    enum Type {
+    enum Type : uint8_t {
         Unknown,
 
         Identifier, Eof,
@@ -48,11 +49,15 @@ struct Token {
 
     } type = Unknown;
 
-    std::size_t row;
-    std::size_t col;
-    std::size_t len;
-    std::string str;
-    std::size_t num;
+    std::size_t pos = 0;
+    uint32_t len = 0;
+
+    // Identifier text or string contents, viewed in the source buffer.
+    std::string_view str;
+    // Packed value of numeric literals.
+    uint64_t num = 0;
+    // Interned text of identifiers and strings.
+    Symbol sym = Symbol::None;
 };
 
 namespace Category {
@@ -154,6 +159,7 @@ constexpr auto reserved = array_make<TokenInfo>({
     
     {"string",      Token::String,     Category::Literal | Category::Operand},
     {"integer",     Token::Integer,    Category::Literal | Category::Operand},
+    {"float",       Token::Float,      Category::Literal | Category::Operand},
     {"character",   Token::Character,  Category::Literal | Category::Operand},
     {"ipv4",        Token::Ipv4,       Category::Literal | Category::Operand},
     {"color",       Token::Color,      Category::Literal | Category::Operand},
@@ -161,61 +167,301 @@ constexpr auto reserved = array_make<TokenInfo>({
 
 static constexpr auto MaxLen = max_len(extract_key(reserved, &TokenInfo::str));
 
-const auto tokenize (const char *src) {
-    uint pos = 0, max = 0;
-    for (uint i = 1; i < reserved.size(); i++) {
-        auto &entry = reserved[i];
-        if (!(entry.categories & Category::Tokenizable)) {
-            continue;
-        }
-        const auto &str = entry.str;
-        if (max > str.size()) {
-            continue;
-        }
-        if (!strncmp(str.data(), src, str.size())) {
-            pos = i;
-            max = str.size();
-        }
-    }
-    return reserved[pos];
+constexpr bool is_word (const TokenInfo &info) {
+    return (info.categories & Category::Tokenizable) && (info.str[0] | 0x20) >= 'a' && (info.str[0] | 0x20) <= 'z';
 }
 
-const auto check_type (const std::string &str) {
-    static constexpr auto table = extract_pair(reserved, &TokenInfo::str, &TokenInfo::type);
-    static const auto map = std::unordered_map(table.begin(), table.end());
+static constexpr auto Words = extract_if<std::ranges::count_if(reserved, is_word)>(reserved, is_word);
+static constexpr auto WordMap = make_perfect_map(extract_pair(Words, &TokenInfo::str, &TokenInfo::type));
+static_assert(WordMap.ok, "No perfect hash found for reserved words");
+
+constexpr bool is_symbol (const TokenInfo &info) {
+    return (info.categories & Category::Tokenizable) && !is_word(info);
+}
+
+static constexpr auto Symbols = extract_if<std::ranges::count_if(reserved, is_symbol)>(reserved, is_symbol);
+static constexpr auto SymbolTrie = make_prefix_trie<count_prefixes(Symbols, &TokenInfo::str)>(
+    Symbols, &TokenInfo::str, reserved[0]);
+
+constexpr const TokenInfo &tokenize (const char *src) {
+    return SymbolTrie.match(src);
+}
+
+static_assert(tokenize("+=1").type == Token::AddEq);
+static_assert(tokenize("+1").type == Token::Add);
+static_assert(tokenize("&&&").type == Token::LogAnd);
+static_assert(tokenize("@").type == Token::Unknown);
+
+static constexpr auto TypeSpan = key_span(extract_pair(reserved, &TokenInfo::type, &TokenInfo::str));
+static constexpr auto TypeNames = dense_table<TypeSpan>(
+    extract_pair(reserved, &TokenInfo::type, &TokenInfo::str), reserved[0].str);
+static constexpr auto TypeCategories = dense_table<TypeSpan>(
+    extract_pair(reserved, &TokenInfo::type, &TokenInfo::categories), uint32_t{0});
+
+constexpr Token::Type check_type (std::string_view str, uint64_t hash) {
     if (str.size() > MaxLen) {
         return Token::Type::Unknown;
     }
-    auto it = map.find(str);
-    if (it == map.end()) {
+    auto type = WordMap.find(str, hash);
+    if (!type) {
         return Token::Type::Unknown;
     }
-    return it->second;
+    return *type;
 }
 
-uint32_t categorize (const Token::Type type) {
-    static const auto map = []{
-        std::unordered_map<Token::Type, uint32_t> m;
-        for (const auto &entry: reserved) {
-            m.emplace(entry.type, entry.categories);
-        }
-        return m;
-    }();
-    auto it = map.find(type);
-    if (it == map.end()) {
+constexpr Token::Type check_type (std::string_view str) {
+    return check_type(str, hash_bytes(str));
+}
+
+constexpr uint32_t categorize (const Token::Type type) {
+    auto i = static_cast<std::size_t>(type);
+    if (i >= TypeCategories.size()) {
         return 0;
     }
-    return it->second;
+    return TypeCategories[i];
 }
 
 constexpr std::string_view to_string (const Token::Type type) {
-    static constexpr auto table = extract_pair(reserved, &TokenInfo::type, &TokenInfo::str);
-    static const auto map = std::unordered_map(table.begin(), table.end());
-    auto it = map.find(type);
-    if (it == map.end()) {
+    auto i = static_cast<std::size_t>(type);
+    if (i >= TypeNames.size()) {
         return reserved[0].str;
     }
-    return it->second;
+    return TypeNames[i];
+}
+
+// Whether tokens of this type carry a value in the side table: identifiers
+// and strings their interned Symbol, numeric literals their packed value.
+constexpr bool has_value (const Token::Type type) {
+    return type == Token::Identifier || (categorize(type) & Category::Literal);
 }
 
+// A token as it leaves the lexer, before it is stored. Positions are absolute
+// byte offsets, which may exceed 32 bits when streaming.
+struct Lexeme {
+    Token::Type type = Token::Unknown;
+    std::size_t pos = 0;
+    uint32_t len = 0;
+    uint64_t value = 0;
+};
+
+// Builds the Token view of a lexeme whose source bytes are `text`.
+constexpr Token make_token (const Lexeme &lex, std::string_view text) {
+    Token token;
+    token.type = lex.type;
+    token.pos = lex.pos;
+    token.len = lex.len;
+    token.str = lex.type == Token::String ? text.substr(1, text.size() - 2) : text;
+    if (lex.type == Token::Identifier || lex.type == Token::String) {
+        token.sym = static_cast<Symbol>(lex.value);
+    } else {
+        token.num = lex.value;
+    }
+    return token;
+}
+
+// Side table entry: the value of token `token`. Entries are sorted by token.
+struct TokenValue {
+    uint32_t token;
+    uint64_t value;
+};
+
+// Read-only view of the columns of a TokenBuffer, or of the same columns
+// mapped from a token cache file, with the source they index into.
+struct TokenColumns {
+    std::string_view src;
+    std::span<const Token::Type> types;
+    std::span<const uint32_t> offsets;
+    std::span<const uint32_t> lengths;
+    std::span<const TokenValue> values;
+
+    std::size_t size () const { return types.size(); }
+
+    uint64_t value (std::size_t i) const {
+        auto it = std::lower_bound(values.begin(), values.end(), i,
+            [](const TokenValue &entry, std::size_t i) { return entry.token < i; });
+        if (it == values.end() || it->token != i) {
+            return 0;
+        }
+        return it->value;
+    }
+
+    // As above, starting from the side table entry `hint`, which is left at
+    // the entry found. Scanning tokens in order then never searches.
+    uint64_t value (std::size_t i, std::size_t &hint) const {
+        auto search = [&](std::size_t from, std::size_t to) {
+            return static_cast<std::size_t>(std::lower_bound(values.begin() + from, values.begin() + to, i,
+                [](const TokenValue &entry, std::size_t i) { return entry.token < i; }) - values.begin());
+        };
+        while (hint < values.size() && values[hint].token < i) {
+            if (hint + 8 < values.size() && values[hint + 8].token < i) {
+                hint = search(hint, values.size());
+                break;
+            }
+            hint++;
+        }
+        if (hint < values.size() && values[hint].token == i) {
+            return values[hint].value;
+        }
+        if (hint > 0 && values[hint - 1].token >= i) {
+            hint = search(0, hint);
+            if (hint < values.size() && values[hint].token == i) {
+                return values[hint].value;
+            }
+        }
+        return 0;
+    }
+
+    Lexeme lexeme (std::size_t i) const {
+        return {types[i], offsets[i], lengths[i], has_value(types[i]) ? value(i) : 0};
+    }
+
+    Token operator[] (std::size_t i) const {
+        return make_token(lexeme(i), src.substr(offsets[i], lengths[i]));
+    }
+
+    Token at (std::size_t i, std::size_t &hint) const {
+        Lexeme lex = {types[i], offsets[i], lengths[i], has_value(types[i]) ? value(i, hint) : 0};
+        return make_token(lex, src.substr(offsets[i], lengths[i]));
+    }
+};
+
+// Tokens of one source, stored column-wise: a one byte type, a 32-bit offset
+// and a 32-bit length per token. Text is never copied out of the source, and
+// literal values and identifier symbols live in a side table keyed by token
+// index, so a cache line of types covers 64 tokens.
+class TokenBuffer {
+    std::string_view src;
+
+    // Makes [first, last) of `column` `count` elements long, moving the tail
+    // once. The contents of the range are left for the caller to fill.
+    template <class T>
+    static void resize_range (tagged_vector<T, Subsystem::Tokens> &column, std::size_t first, std::size_t last, std::size_t count) {
+        auto removed = last - first;
+        if (count > removed) {
+            column.insert(column.begin() + static_cast<std::ptrdiff_t>(last), count - removed, T{});
+        } else if (count < removed) {
+            column.erase(column.begin() + static_cast<std::ptrdiff_t>(first + count),
+                         column.begin() + static_cast<std::ptrdiff_t>(last));
+        }
+    }
+
+    tagged_vector<Token::Type, Subsystem::Tokens> types;
+    tagged_vector<uint32_t, Subsystem::Tokens> offsets;
+    tagged_vector<uint32_t, Subsystem::Tokens> lengths;
+    tagged_vector<TokenValue, Subsystem::Tokens> values;
+
+public:
+    explicit TokenBuffer (std::string_view src) : src(src) {}
+
+    void reserve (std::size_t n) {
+        types.reserve(n);
+        offsets.reserve(n);
+        lengths.reserve(n);
+    }
+
+    void push (Token::Type type, uint32_t pos, uint32_t len) {
+        types.push_back(type);
+        offsets.push_back(pos);
+        lengths.push_back(len);
+    }
+
+    void push (Token::Type type, uint32_t pos, uint32_t len, uint64_t value) {
+        values.push_back({static_cast<uint32_t>(types.size()), value});
+        push(type, pos, len);
+    }
+
+    void push (const Lexeme &lex) {
+        if (has_value(lex.type)) {
+            push(lex.type, static_cast<uint32_t>(lex.pos), lex.len, lex.value);
+        } else {
+            push(lex.type, static_cast<uint32_t>(lex.pos), lex.len);
+        }
+    }
+
+    // Appends the first `count` tokens of `other`, whose offsets are already
+    // relative to the same source.
+    void append (const TokenBuffer &other, std::size_t count) {
+        auto shift = static_cast<uint32_t>(types.size());
+        types.insert(types.end(), other.types.begin(), other.types.begin() + count);
+        offsets.insert(offsets.end(), other.offsets.begin(), other.offsets.begin() + count);
+        lengths.insert(lengths.end(), other.lengths.begin(), other.lengths.begin() + count);
+        for (auto [index, value]: other.values) {
+            if (index >= count) {
+                break;
+            }
+            values.push_back({index + shift, value});
+        }
+    }
+
+    // Replaces tokens [first, last) with `lexemes`, moving the offsets of the
+    // tokens after them by `shift` bytes. Each column is moved at most once,
+    // and not at all when the token count is unchanged.
+    void splice (std::size_t first, std::size_t last, std::span<const Lexeme> lexemes, int64_t shift) {
+        auto count = lexemes.size();
+        auto moved = static_cast<int64_t>(count) - static_cast<int64_t>(last - first);
+
+        resize_range(types, first, last, count);
+        resize_range(offsets, first, last, count);
+        resize_range(lengths, first, last, count);
+        for (std::size_t i = 0; i < count; i++) {
+            types[first + i] = lexemes[i].type;
+            offsets[first + i] = static_cast<uint32_t>(lexemes[i].pos);
+            lengths[first + i] = lexemes[i].len;
+        }
+        if (shift) {
+            for (std::size_t i = first + count; i < offsets.size(); i++) {
+                offsets[i] = static_cast<uint32_t>(offsets[i] + shift);
+            }
+        }
+
+        auto lo = std::lower_bound(values.begin(), values.end(), first,
+            [](const TokenValue &entry, std::size_t i) { return entry.token < i; });
+        auto hi = std::lower_bound(lo, values.end(), last,
+            [](const TokenValue &entry, std::size_t i) { return entry.token < i; });
+        auto at = static_cast<std::size_t>(lo - values.begin());
+        auto valued = static_cast<std::size_t>(std::ranges::count_if(lexemes,
+            [](const Lexeme &lex) { return has_value(lex.type); }));
+        resize_range(values, at, static_cast<std::size_t>(hi - values.begin()), valued);
+        for (std::size_t i = 0; i < count; i++) {
+            if (has_value(lexemes[i].type)) {
+                values[at++] = {static_cast<uint32_t>(first + i), lexemes[i].value};
+            }
+        }
+        if (moved) {
+            for (auto i = at; i < values.size(); i++) {
+                values[i].token = static_cast<uint32_t>(values[i].token + moved);
+            }
+        }
+    }
+
+    // Points the buffer at its source again after the text moved.
+    void rebind (std::string_view text) { src = text; }
+
+    std::size_t size () const { return types.size(); }
+
+    Token::Type type (std::size_t i) const { return types[i]; }
+    uint32_t offset (std::size_t i) const { return offsets[i]; }
+    uint32_t length (std::size_t i) const { return lengths[i]; }
+
+    uint64_t value (std::size_t i) const { return columns().value(i); }
+
+    uint64_t value (std::size_t i, std::size_t &hint) const { return columns().value(i, hint); }
+
+    Lexeme lexeme (std::size_t i) const { return columns().lexeme(i); }
+
+    Token operator[] (std::size_t i) const { return columns()[i]; }
+
+    Token at (std::size_t i, std::size_t &hint) const { return columns().at(i, hint); }
+
+    TokenColumns columns () const { return {src, types, offsets, lengths, values}; }
+
+    // Heap bytes held by the buffer, including spare capacity.
+    std::size_t bytes () const {
+        return types.capacity() * sizeof(Token::Type)
+             + offsets.capacity() * sizeof(uint32_t)
+             + lengths.capacity() * sizeof(uint32_t)
+             + values.capacity() * sizeof(TokenValue);
+    }
+};
+
 }
\ No newline at end of file
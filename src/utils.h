@@ -1,7 +1,6 @@
 #pragma once
 
 #include <iostream>
-#include <fstream>
 #include <cstdint>
 #include <cstdio>
 #include <memory>
@@ -35,36 +34,4 @@ constexpr auto array_make(const T (&arr)[N]) {
     return ret;
 }
 
-std::unique_ptr<char[]> file_read(const std::string &path, std::size_t& size) noexcept {
-    auto in = std::ifstream(path, std::ios::in | std::ios::ate);
-    if (!in.is_open()) {
-        return nullptr;
-    }
-
-    auto end = in.tellg();
-    if (end < 0) {
-        return nullptr;
-    }
-    const auto length = static_cast<std::size_t>(end);
-
-    in.seekg(0, std::ios::beg);
-
-    auto buffer = std::unique_ptr<char[]>(new (std::nothrow) char[length + 1]);
-    if (!buffer) {
-        return nullptr;
-    }
-
-    in.read(buffer.get(), static_cast<std::streamsize>(length));
-    if (!in && !in.eof()) {
-        return nullptr;
-    }
-
-    const auto read = in.gcount();
-    buffer[read] = '\0';
-    size = static_cast<std::size_t>(read);
-
-    return buffer;
-}
-
-
 }
\ No newline at end of file